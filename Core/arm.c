@@ -10,6 +10,15 @@
 
 #include "arm.h"
 
+//
+// x86-64 recompiler (SysV ABI); needs mprotect for W^X code
+//
+#if defined(__amd64__) && !defined(_WIN64) && defined(HAVE_MPROTECT)
+#define ARM_JIT
+#include <stdlib.h>
+#include <sys/mman.h>
+#endif
+
 //int armcount = 0;
 
 //extern void subtimeon(void);
@@ -119,6 +128,56 @@ sint32 EMU_CALL arm_init(void) {
 #define EXCEPTION_IRQ      (6)
 #define EXCEPTION_FIQ      (7)
 
+//
+// Guest code is only decoded or compiled below ARM_CODE_LIMIT, which is
+// tracked in 64-byte chunks
+//
+#define ARM_CODE_LIMIT    (0x1000000)
+
+//
+// Memory below ARM_CODE_LIMIT is dispatched through a table of 64KB pages;
+// anything above it always walks the map
+//
+#define ARM_PAGE_SHIFT (16)
+#define ARM_PAGE_SIZE  (1<<ARM_PAGE_SHIFT)
+#define ARM_PAGE_MASK  (ARM_PAGE_SIZE-1)
+#define ARM_PAGES      (ARM_CODE_LIMIT>>ARM_PAGE_SHIFT)
+#define ARM_BLOCKS        (512)
+#define ARM_BLOCK_OPS     (16)
+
+#ifdef ARM_JIT
+#define ARM_JIT_BLOCKS    (8192)
+#define ARM_JIT_BLOCK_MAX (32)
+#define ARM_JIT_RUNS      (8)   // decoded runs before a block is compiled
+struct JITPOOL_SLOT;
+#endif
+
+//
+// A decoded instruction.  h picks the handler from opcalltable, or 0 to use
+// the inscalltable entry for the instruction word.
+//
+struct ARM_OP {
+  uint32 insword;
+  uint32 operand; // immediate operand 2, immediate offset, or branch target
+  uint8 cond;
+  uint8 h;
+  uint8 rd;
+  uint8 rn;
+  uint8 rm;
+  uint8 shift; // immediate shift amount, below 32
+};
+
+//
+// A straight run of decoded instructions, ending at a branch, a PC write,
+// or ARM_BLOCK_OPS
+//
+struct ARM_BLOCK {
+  uint32 pc;
+  uint32 n; // 0 = empty
+  uint32 runs;
+  struct ARM_OP op[ARM_BLOCK_OPS];
+};
+
 struct ARM_STATE {
   //
   // Registers
@@ -139,15 +198,55 @@ struct ARM_STATE {
 
   sint32 cycles_remaining;
   sint32 cycles_remaining_last_checkpoint;
+  sint32 cycles_deferred; // rest of the slice, after the next interrupt check
 
   //
   // These are REGISTERED EXTERNAL POINTERS.
   //
   arm_advance_callback_t advance;
+  arm_interrupt_callback_t interrupt;
   void *hwstate;
   struct ARM_MEMORY_MAP *map_load;
   struct ARM_MEMORY_MAP *map_store;
 
+  //
+  // Built from the maps above whenever they're registered or changed.
+  // Host pointer to the start of each page, or NULL to walk the map.
+  // Use PAGE_LOAD/PAGE_STORE, which range check the address.
+  //
+  uint8 *page_load[ARM_PAGES];
+  uint8 *page_store[ARM_PAGES];
+
+  //
+  // Decoded blocks, direct-mapped by PC.  One bit per 64-byte chunk of
+  // guest code that's been decoded or compiled, checked on every store.
+  //
+  struct ARM_BLOCK block[ARM_BLOCKS];
+  uint32 code_bits[ARM_CODE_LIMIT >> 11];
+  uint8 code_stale; // code was dropped during a block
+
+#ifdef ARM_JIT
+  //
+  // Recompiler: which pool slot holds this state's code, and the serial it
+  // had when we last touched it; and the slot arm_execute holds while it
+  // runs, if any
+  //
+  uint8 jit_enabled;
+  uint32 jit_slot;
+  uint32 jit_serial;
+  struct JITPOOL_SLOT *jit_run;
+#endif
+
+  //
+  // Lazy flags.  A flag-setting data operation records its result (and
+  // operands, for arithmetic) here instead of packing NZCV into cpsr; the
+  // flags in cpsr are only current while flag_mode is FLAGS_CPSR.
+  //
+  uint8 flag_mode;
+  uint32 flag_result;
+  uint32 flag_op1;
+  uint32 flag_op2;
+
   //
   // The following are TEMPORARY.
   // There are no location invariance issues.
@@ -211,9 +310,93 @@ static void setuserreg(struct ARM_STATE *state, uint32 n, uint32 v) {
   state->r[n] = v; return;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+//
+// Lazy flags
+//
+#define FLAGS_CPSR (0) // cpsr is current
+#define FLAGS_NZ   (1) // NZ from flag_result, CV in cpsr
+#define FLAGS_ADD  (2) // NZCV from flag_op1 + flag_op2 (+ carry) = flag_result
+#define FLAGS_SUB  (3) // NZCV from flag_op1 - flag_op2 (- borrow) = flag_result
+
+//
+// cpsr with the flags brought up to date, leaving the state alone
+//
+static uint32 flags_psr_lazy(struct ARM_STATE *state) {
+  uint32 psr = state->cpsr;
+  uint32 r = state->flag_result;
+  uint32 a = state->flag_op1;
+  uint32 b = state->flag_op2;
+  switch(state->flag_mode) {
+  case FLAGS_ADD:
+    psr &= ~((PSR_CMASK)|(PSR_VMASK));
+    psr |= (((b^r)&(~(a^b))) >> 31) << PSR_POS_V;
+    psr |= ((r^((a^b)|(b^r))) >> 31) << PSR_POS_C;
+    break;
+  case FLAGS_SUB:
+    psr &= ~((PSR_CMASK)|(PSR_VMASK));
+    psr |= (((b^a)&(~(b^r))) >> 31) << PSR_POS_V;
+    psr |= ((~(a^((b^a)|(a^r)))) >> 31) << PSR_POS_C;
+    break;
+  }
+  psr &= ~((PSR_NMASK)|(PSR_ZMASK));
+  psr |= (r & 0x80000000) | (((uint32)(r == 0)) << PSR_POS_Z);
+  return psr;
+}
+
+static EMU_INLINE uint32 flags_psr(struct ARM_STATE *state) {
+  if(state->flag_mode == FLAGS_CPSR) { return state->cpsr; }
+  return flags_psr_lazy(state);
+}
+
+//
+// C alone, for carry-in and RRX
+//
+static EMU_INLINE uint32 flags_c(struct ARM_STATE *state) {
+  uint32 r = state->flag_result;
+  uint32 a = state->flag_op1;
+  uint32 b = state->flag_op2;
+  switch(state->flag_mode) {
+  case FLAGS_ADD: return (r^((a^b)|(b^r))) >> 31;
+  case FLAGS_SUB: return (~(a^((b^a)|(a^r)))) >> 31;
+  }
+  return ((state->cpsr) >> PSR_POS_C) & 1;
+}
+
+//
+// Whether condition cond (0-15) passes.  EQ/NE/MI/PL come straight from a
+// lazy result.
+//
+static EMU_INLINE int flags_cond(struct ARM_STATE *state, uint32 cond) {
+  if(state->flag_mode != FLAGS_CPSR) {
+    if(cond < 2) { return (state->flag_result == 0) ^ cond; }
+    if((cond & 0xE) == 4) { return (state->flag_result >> 31) ^ (cond & 1); }
+  }
+  return condtable[cond + (flags_psr(state) >> 24)];
+}
+
+//
+// Pack the flags into cpsr
+//
+static EMU_INLINE void flags_sync(struct ARM_STATE *state) {
+  if(state->flag_mode == FLAGS_CPSR) { return; }
+  state->cpsr = flags_psr(state);
+  state->flag_mode = FLAGS_CPSR;
+}
+
+//
+// Make C and V in cpsr current; NZ may stay lazy
+//
+static EMU_INLINE void flags_sync_cv(struct ARM_STATE *state) {
+  if(state->flag_mode > FLAGS_NZ) { flags_sync(state); }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
 static void setcpsr(struct ARM_STATE *state, uint32 psr) {
   regswap(state);
   state->cpsr = psr & 0xF00000FF;
+  state->flag_mode = FLAGS_CPSR;
   regswap(state);
 }
 
@@ -227,6 +410,7 @@ static void exception(struct ARM_STATE *state, uint32 n) {
   };
   uint32 spsr;
   n &= 7;
+  flags_sync(state);
   spsr = state->cpsr;
   setcpsr(state, ((state->cpsr) & (~(MODE_MASK))) | mode_on_entry[n]);
   state->spsr = spsr;
@@ -240,10 +424,56 @@ static void exception(struct ARM_STATE *state, uint32 n) {
 
 void EMU_CALL arm_clear_state(void *state) {
   memset(state, 0, sizeof(struct ARM_STATE));
+#ifdef ARM_JIT
+  ARMSTATE->jit_enabled = 1;
+#endif
   exception(ARMSTATE, EXCEPTION_RESET);
 }
 
+static void code_invalidate(struct ARM_STATE *state, uint32 a);
+static void code_forget(struct ARM_STATE *state, uint32 x, uint32 y);
+#ifdef ARM_JIT
+static void jit_drop(struct ARM_STATE *state, uint32 lo, uint32 hi);
+#endif
+
 /////////////////////////////////////////////////////////////////////////////
+//
+// Page table
+//
+// A page gets a direct host pointer only if the first map entry touching it
+// is a pointer entry covering all of it, and the entry's mask doesn't wrap
+// inside the page.  Anything else (callbacks, pages split between entries)
+// is NULL and goes through mmwalk.
+//
+static uint8 *page_lookup(struct ARM_MEMORY_MAP *map, uint32 page) {
+  uint32 start = page << ARM_PAGE_SHIFT;
+  uint32 end = start + ARM_PAGE_MASK;
+  for(;; map++) {
+    uint32 x = map->x;
+    uint32 y = map->y;
+    if(y < start || x > end) continue;
+    if(x > start || y < end) return NULL;
+    if(map->type.n != ARM_MAP_TYPE_POINTER) return NULL;
+    if(((map->type.mask) & ARM_PAGE_MASK) != ARM_PAGE_MASK) return NULL;
+    return ((uint8*)(map->type.p)) + (start & (map->type.mask));
+  }
+}
+
+static void page_update(struct ARM_STATE *state, uint32 first, uint32 last) {
+  uint32 page;
+  if(first >= ARM_PAGES) return;
+  if(last >= ARM_PAGES) last = ARM_PAGES - 1;
+  for(page = first; page <= last; page++) {
+    uint8 *p = page_lookup(state->map_load, page);
+    // code decoded from what used to be here is gone
+    if(p != state->page_load[page]) {
+      code_forget(state, page << ARM_PAGE_SHIFT, (page << ARM_PAGE_SHIFT) + ARM_PAGE_MASK);
+    }
+    state->page_load [page] = p;
+    state->page_store[page] = page_lookup(state->map_store, page);
+  }
+}
+
 //
 // Registration of external pointers within the state
 //
@@ -254,6 +484,12 @@ void EMU_CALL arm_set_memory_maps(
 ) {
   ARMSTATE->map_load  = map_load;
   ARMSTATE->map_store = map_store;
+  page_update(ARMSTATE, 0, ARM_PAGES - 1);
+}
+
+void EMU_CALL arm_memory_maps_changed(void *state, uint32 x, uint32 y) {
+  if(x > y) return;
+  page_update(ARMSTATE, x >> ARM_PAGE_SHIFT, y >> ARM_PAGE_SHIFT);
 }
 
 void EMU_CALL arm_set_advance_callback(
@@ -265,6 +501,13 @@ void EMU_CALL arm_set_advance_callback(
   ARMSTATE->hwstate = hwstate;
 }
 
+void EMU_CALL arm_set_interrupt_callback(
+  void *state,
+  arm_interrupt_callback_t interrupt
+) {
+  ARMSTATE->interrupt = interrupt;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 
 uint32 EMU_CALL arm_getreg(void *state, sint32 regnum) {
@@ -273,7 +516,7 @@ uint32 EMU_CALL arm_getreg(void *state, sint32 regnum) {
     return ARMSTATE->r[n];
   }
   switch(regnum) {
-  case ARM_REG_CPSR: return ARMSTATE->cpsr;
+  case ARM_REG_CPSR: return flags_psr(ARMSTATE);
   case ARM_REG_SPSR: return ARMSTATE->spsr;
   }
   return 0;
@@ -285,7 +528,20 @@ uint32 EMU_CALL arm_getreg(void *state, sint32 regnum) {
 /////////////////////////////////////////////////////////////////////////////
 
 void EMU_CALL arm_break(void *state) {
+  ARMSTATE->cycles_deferred = 0;
+  if(ARMSTATE->cycles_remaining <= 0) return;
+  ARMSTATE->cycles_remaining_last_checkpoint -= ARMSTATE->cycles_remaining;
+  ARMSTATE->cycles_remaining                  = 0;
+}
+
+//
+// End the current stretch so the interrupt callback is asked before the next
+// instruction.  Without one, return to the caller as before.
+//
+void EMU_CALL arm_interrupt_changed(void *state) {
+  if(!(ARMSTATE->interrupt)) { arm_break(state); return; }
   if(ARMSTATE->cycles_remaining <= 0) return;
+  ARMSTATE->cycles_deferred                  += ARMSTATE->cycles_remaining;
   ARMSTATE->cycles_remaining_last_checkpoint -= ARMSTATE->cycles_remaining;
   ARMSTATE->cycles_remaining                  = 0;
 }
@@ -313,9 +569,23 @@ static void hw_sync(struct ARM_STATE *state) {
 
 /////////////////////////////////////////////////////////////////////////////
 
+//
+// Host pointer to the page holding an address, or NULL to walk the map
+//
+#define PAGE_LOAD(a)  (((a) < ARM_CODE_LIMIT) ? state->page_load [(a) >> ARM_PAGE_SHIFT] : NULL)
+#define PAGE_STORE(a) (((a) < ARM_CODE_LIMIT) ? state->page_store[(a) >> ARM_PAGE_SHIFT] : NULL)
+
 static EMU_INLINE void renew_fetch_region(struct ARM_STATE *state) {
   struct ARM_MEMORY_TYPE *t;
+  uint8 *page;
   state->r[15] &= ~3;
+  page = PAGE_LOAD(state->r[15]);
+  if(page) {
+    uint32 astart = (state->r[15]) & (~ARM_PAGE_MASK);
+    state->maxpc = astart + ARM_PAGE_SIZE;
+    state->fetchbase = page - astart;
+    return;
+  }
   t = mmwalk(state->map_load, state->r[15]);
   if(t->n == ARM_MAP_TYPE_POINTER) {
     uint32 astart = (state->r[15]) & (~(t->mask));
@@ -328,10 +598,22 @@ static EMU_INLINE void renew_fetch_region(struct ARM_STATE *state) {
   }
 }
 
+/////////////////////////////////////////////////////////////////////////////
+//
+// Drop decoded or compiled code before it's overwritten
+//
+#define CODE_STORE_CHECK(a) {                                                 \
+  if((a) < ARM_CODE_LIMIT && ((state->code_bits[(a) >> 11] >> (((a) >> 6) & 31)) & 1)) { \
+    code_invalidate(state, (a));                                              \
+  }                                                                           \
+}
+
 /////////////////////////////////////////////////////////////////////////////
 
 static EMU_INLINE uint32 lb(struct ARM_STATE *state, uint32 a) {
   struct ARM_MEMORY_TYPE *t;
+  uint8 *page = PAGE_LOAD(a);
+  if(page) { return page[(a & ARM_PAGE_MASK) ^ EMU_ENDIAN_XOR(3)]; }
 //armsubtimeon();
   t = mmwalk(state->map_load, a);
   a &= t->mask;
@@ -352,6 +634,11 @@ static EMU_INLINE uint32 lb(struct ARM_STATE *state, uint32 a) {
 static EMU_INLINE uint32 lh(struct ARM_STATE *state, uint32 a) {
   struct ARM_MEMORY_TYPE *t;
   uint32 sh;
+  uint8 *page = PAGE_LOAD(a);
+  if(page) {
+    sh = (a & 3) * 8;
+    return ((*((uint32*)(page + (a & ARM_PAGE_MASK & (~3))))) >> sh) & 0xFFFF;
+  }
 //armsubtimeon();
   t = mmwalk(state->map_load, a);
   sh = (a & 3) * 8;
@@ -370,6 +657,11 @@ static EMU_INLINE uint32 lh(struct ARM_STATE *state, uint32 a) {
 static EMU_INLINE uint32 lw(struct ARM_STATE *state, uint32 a) {
   struct ARM_MEMORY_TYPE *t;
   uint32 sh;
+  uint8 *page = PAGE_LOAD(a);
+  if(page) {
+    sh = (a & 3) * 8;
+    return (*((uint32*)(page + (a & ARM_PAGE_MASK & (~3))))) >> sh;
+  }
 //armsubtimeon();
   t = mmwalk(state->map_load, a);
   sh = (a & 3) * 8;
@@ -386,6 +678,9 @@ static EMU_INLINE uint32 lw(struct ARM_STATE *state, uint32 a) {
 
 static EMU_INLINE void sb(struct ARM_STATE *state, uint32 a, uint32 d) {
   struct ARM_MEMORY_TYPE *t;
+  uint8 *page = PAGE_STORE(a);
+  CODE_STORE_CHECK(a)
+  if(page) { page[(a & ARM_PAGE_MASK) ^ EMU_ENDIAN_XOR(3)] = d; return; }
 //armsubtimeon();
   t = mmwalk(state->map_store, a);
   a &= t->mask;
@@ -404,6 +699,16 @@ static EMU_INLINE void sb(struct ARM_STATE *state, uint32 a, uint32 d) {
 static EMU_INLINE void sh(struct ARM_STATE *state, uint32 a, uint32 d) {
   struct ARM_MEMORY_TYPE *t;
   uint32 sh;
+  uint8 *page = PAGE_STORE(a);
+  CODE_STORE_CHECK(a)
+  if(page) {
+    uint32 *p = (uint32*)(page + (a & ARM_PAGE_MASK & (~3)));
+    sh = (a & 3) * 8;
+    d &= 0xFFFF;
+    *p &= ~(0xFFFF << sh);
+    *p |=  (d      << sh);
+    return;
+  }
 //armsubtimeon();
   t = mmwalk(state->map_store, a);
   sh = (a & 3) * 8;
@@ -422,6 +727,15 @@ static EMU_INLINE void sh(struct ARM_STATE *state, uint32 a, uint32 d) {
 static EMU_INLINE void sw(struct ARM_STATE *state, uint32 a, uint32 d) {
   struct ARM_MEMORY_TYPE *t;
   uint32 sh;
+  uint8 *page = PAGE_STORE(a);
+  CODE_STORE_CHECK(a)
+  if(page) {
+    uint32 *p = (uint32*)(page + (a & ARM_PAGE_MASK & (~3)));
+    sh = (a & 3) * 8;
+    *p &= ~(0xFFFFFFFF << sh);
+    *p |=  (d          << sh);
+    return;
+  }
 //armsubtimeon();
   t = mmwalk(state->map_store, a);
   sh = (a & 3) * 8;
@@ -455,8 +769,9 @@ static void EMU_CALL badins(struct ARM_STATE *state, uint32 insword) {
 #define WRITESTATUS(N) (((N)&1)!=0)
 #define ISLOGIC(N) ((((N)&0x0C)==0x00)||(((N)&0x18)==0x18))
 
-#define C_TO_CPSR { state->cpsr &= ~PSR_CMASK; state->cpsr |= (c&1) << PSR_POS_C; }
-#define GET_NZ_TO_CPSR(V) { state->cpsr &= ~((PSR_NMASK)|(PSR_ZMASK)); state->cpsr |= ((V)&0x80000000) | (((uint32)((V)==0))<<(PSR_POS_Z)); }
+#define C_TO_CPSR { flags_sync_cv(state); state->cpsr &= ~PSR_CMASK; state->cpsr |= (c&1) << PSR_POS_C; }
+#define GET_NZ_TO_CPSR(V) { flags_sync_cv(state); state->flag_result = (V); state->flag_mode = FLAGS_NZ; }
+#define GET_C_FROM_CPSR (flags_c(state))
 
 #define DATAOP(N) (((N)>>1)&0xF)
 
@@ -477,13 +792,136 @@ static void EMU_CALL badins(struct ARM_STATE *state, uint32 insword) {
 #define DATA_BIC (0xE)
 #define DATA_MVN (0xF)
 
+/////////////////////////////////////////////////////////////////////////////
+//
+// Shift operand2 by shiftby, setting C for logical S ops
+// Register counts of 32 and up shift everything out (LSL/LSR give 0, ASR
+// the sign), as on the ARM; shifting the value by them in C is undefined
+//
+#define DATA_SHIFT(N)                                                      \
+  if(shiftby) {                                                            \
+    switch(IFIELD(5,2)) {                                                  \
+    case 0: /* LSL */                                                      \
+      if(WRITESTATUS(N) && ISLOGIC(N)) {                                   \
+        if(shiftby > 32) { c = 0; } else { c = operand2 >> (32-shiftby); } \
+        C_TO_CPSR;                                                         \
+      }                                                                    \
+      if(shiftby >= 32) { operand2 = 0; } else { operand2 <<= shiftby; }   \
+      break;                                                               \
+    case 1: /* LSR */                                                      \
+      if(WRITESTATUS(N) && ISLOGIC(N)) {                                   \
+        if(shiftby > 32) { c = 0; } else { c = operand2 >> (shiftby-1); }  \
+        C_TO_CPSR;                                                         \
+      }                                                                    \
+      if(shiftby >= 32) { operand2 = 0; } else { operand2 >>= shiftby; }   \
+      break;                                                               \
+    case 2: /* ASR */                                                      \
+      if(WRITESTATUS(N) && ISLOGIC(N)) {                                   \
+        if(shiftby >= 32) { c = operand2 >> 31; } else { c = operand2 >> (shiftby-1); } \
+        C_TO_CPSR;                                                         \
+      }                                                                    \
+      if(shiftby >= 32) { shiftby = 31; }                                  \
+      operand2 = ((sint32)(((sint32)operand2) >> shiftby));                \
+      break;                                                               \
+    case 3: /* ROR */                                                      \
+      if(WRITESTATUS(N) && ISLOGIC(N)) {                                   \
+        c = operand2 >> ((shiftby-1)&31);                                  \
+        C_TO_CPSR;                                                         \
+      }                                                                    \
+      shiftby &= 31;                                                       \
+      if(shiftby) { operand2 = (operand2 >> shiftby) | (operand2 << (32-shiftby)); } \
+      break;                                                               \
+    }                                                                      \
+  }
+
+//
+// Operate on operand1 and operand2, with the PC advanced by 8, and write back
+//
+#define DATA_OPERATE(N)                                                                      \
+  /*                                                   */                        \
+  /* Do stuff depending on the instruction             */                        \
+  /*                                                   */                        \
+  /* for anything except MOV and MVN, we want operand1 */                        \
+  if(DATAOP(N) != DATA_MOV && DATAOP(N) != DATA_MVN) {                           \
+    operand1 = state->r[IFIELD(16,4)];                                         \
+  }                                                                            \
+         if(DATAOP(N) == DATA_MOV) { result = operand2;                         \
+  } else if(DATAOP(N) == DATA_MVN) { result = operand2 ^ 0xFFFFFFFF;            \
+  } else if(DATAOP(N) == DATA_AND) { result = operand1 & operand2;              \
+  } else if(DATAOP(N) == DATA_TST) { result = operand1 & operand2;              \
+  } else if(DATAOP(N) == DATA_EOR) { result = operand1 ^ operand2;              \
+  } else if(DATAOP(N) == DATA_TEQ) { result = operand1 ^ operand2;              \
+  } else if(DATAOP(N) == DATA_ORR) { result = operand1 | operand2;              \
+  } else if(DATAOP(N) == DATA_BIC) { result = operand1 & (~operand2);           \
+  /*                                            */                             \
+  /* (moving on to the arithmetic instructions) */                             \
+  /*                                            */                             \
+  /* ADD and CMN and ADC                        */                             \
+  } else if(               \
+    DATAOP(N)==DATA_ADD || \
+    DATAOP(N)==DATA_CMN || \
+    DATAOP(N)==DATA_ADC    \
+  ) {       \
+    result = operand1 + operand2;                                              \
+    if(DATAOP(N)==DATA_ADC) result += GET_C_FROM_CPSR;                         \
+    /* C and V are worked out from the operands when needed */                 \
+    if(WRITESTATUS(N)) {                                                       \
+      state->flag_op1 = operand1;                                              \
+      state->flag_op2 = operand2;                                              \
+      state->flag_mode = FLAGS_ADD;                                            \
+    }                                                                          \
+  /* SUB and RSB and CMP and SBC and RSC  */                                   \
+  } else if(               \
+    DATAOP(N)==DATA_SUB || \
+    DATAOP(N)==DATA_RSB || \
+    DATAOP(N)==DATA_CMP || \
+    DATAOP(N)==DATA_SBC || \
+    DATAOP(N)==DATA_RSC    \
+  ) {                      \
+    /* swap for RSB and RSC   */                                                            \
+    if(DATAOP(N)==DATA_RSB || DATAOP(N)==DATA_RSC) {                 \
+      result = operand1; operand1 = operand2; operand2 = result; }   \
+    result = operand1 - operand2;                                                           \
+    /* carry where needed */                                                                \
+    if(DATAOP(N)==DATA_SBC || DATAOP(N)==DATA_RSC) {                                        \
+      result += GET_C_FROM_CPSR;                                                            \
+      result--;                                                                             \
+    }                                                                                       \
+    if(WRITESTATUS(N)) {                                                                   \
+      state->flag_op1 = operand1;                                                          \
+      state->flag_op2 = operand2;                                                          \
+      state->flag_mode = FLAGS_SUB;                                                        \
+    }                                                                                      \
+  }                                                                                        \
+  /* set N and Z here if we want them  */                                                  \
+  if(WRITESTATUS(N)) {                                                                     \
+    if(ISLOGIC(N)) { GET_NZ_TO_CPSR(result); } else { state->flag_result = result; }       \
+  }                                                                                        \
+  /* it's safe to decrement the program counter again here */                              \
+  state->r[15] -= 4;                                                                       \
+  /* write results to the destination register if applicable */                            \
+  if((N & 0x18) != 0x10) {                                                                 \
+    uint32 rd = IFIELD(12,4);                                                              \
+    state->r[rd] = result;                                                                 \
+    /* if the destination reg was the PC:   */                                             \
+    if(rd == 15) {                                                                         \
+      /* force fetch base recalculation    */                                              \
+      pcchanged(state);                                                                    \
+      /* and also, if S was set, return from exception  */                                 \
+      if(WRITESTATUS(N)) {                                                                 \
+        setcpsr(state, state->spsr);                                                       \
+        arm_interrupt_changed(state);                                                      \
+      }                                                                                    \
+    }                                                                                      \
+  }
+
 /////////////////////////////////////////////////////////////////////////////
 //
 // Template for a Data Processing instruction (0x00-0x3F in the list)
 //
 #define INSDATA(N)                                                           \
 static void EMU_CALL insdata##N(struct ARM_STATE *state, uint32 insword) {   \
-  uint32 v, c;                                                               \
+  uint32 c;                                                                  \
   uint32 result, operand1, operand2;                                         \
   uint32 rd;                                                                 \
   /*                                                                 */      \
@@ -535,7 +973,7 @@ static void EMU_CALL insdata##N(struct ARM_STATE *state, uint32 insword) {   \
     if((insword & 0x0FFF0FFF) == 0x010F0000) {                 \
       state->r[15] += 4;                                       \
       rd = IFIELD(12, 4);                                      \
-      if(rd != 15) state->r[rd] = state->cpsr;                 \
+      if(rd != 15) state->r[rd] = flags_psr(state);            \
       return;                                                  \
     }                                                          \
     if((insword & 0x0FFF0FFF) == 0x014F0000) {                 \
@@ -548,7 +986,7 @@ static void EMU_CALL insdata##N(struct ARM_STATE *state, uint32 insword) {   \
       state->r[15] += 8;                                       \
       setcpsr(state, state->r[IFIELD(0,4)]);                   \
       state->r[15] -= 4;                                       \
-      arm_break(state);                                        \
+      arm_interrupt_changed(state);                            \
       return;                                                  \
     }                                                          \
     if((insword & 0x0FFFFFF0) == 0x0169F000) {                 \
@@ -562,6 +1000,7 @@ static void EMU_CALL insdata##N(struct ARM_STATE *state, uint32 insword) {   \
       state->r[15] += 8;                                       \
       src = state->r[IFIELD(0,4)];                             \
       state->r[15] -= 4;                                       \
+      state->flag_mode = FLAGS_CPSR;                           \
       state->cpsr &=        0x0FFFFFFF;                        \
       state->cpsr |= (src & 0xF0000000);                       \
       return;                                                  \
@@ -579,6 +1018,7 @@ static void EMU_CALL insdata##N(struct ARM_STATE *state, uint32 insword) {   \
       uint32 src = IFIELD(0,8);                                \
       uint32 ror = IFIELD(8,4) * 2;                            \
       src = (src >> ror) | (src << (32-ror));                  \
+      state->flag_mode = FLAGS_CPSR;                           \
       state->cpsr &=        0x0FFFFFFF;                        \
       state->cpsr |= (src & 0xF0000000);                       \
       return;                                                  \
@@ -605,7 +1045,7 @@ static void EMU_CALL insdata##N(struct ARM_STATE *state, uint32 insword) {   \
     /* rrx is a special case */                                               \
     if((insword & 0xFF0) == 0x060) {                                        \
       c = operand2 & 1;                                                     \
-      operand2 = (operand2 >> 1) | ((state->cpsr << 2) & 0x80000000);       \
+      operand2 = (operand2 >> 1) | (GET_C_FROM_CPSR << 31);                 \
       if(WRITESTATUS(N) && ISLOGIC(N)) { C_TO_CPSR; }                       \
     } else {                                                                \
       uint8 shiftby;                                                        \
@@ -615,122 +1055,14 @@ static void EMU_CALL insdata##N(struct ARM_STATE *state, uint32 insword) {   \
       } else {                                                              \
         shiftby = state->r[IFIELD(8,4)];                                    \
       }                                                                     \
-      if(shiftby) {                                                         \
-        switch(IFIELD(5,2)) {                                               \
-        case 0: /* LSL */                                                   \
-          if(WRITESTATUS(N) && ISLOGIC(N)) {                                \
-            if(shiftby > 32) { c = 0; } else { c = operand2 >> (32-shiftby); } \
-            C_TO_CPSR;                                                         \
-          }                                                                    \
-          operand2 <<= shiftby;                                                \
-          break;                                                               \
-        case 1: /* LSR */                                                      \
-          if(WRITESTATUS(N) && ISLOGIC(N)) {                                   \
-            if(shiftby > 32) { c = 0; } else { c = operand2 >> (shiftby-1); }  \
-            C_TO_CPSR;                                                         \
-          }                                                                    \
-          operand2 >>= shiftby;                                                \
-          break;                                                               \
-        case 2: /* ASR */                                                      \
-          if(WRITESTATUS(N) && ISLOGIC(N)) {                                   \
-            if(shiftby >= 32) { c = operand2 >> 31; } else { c = operand2 >> (shiftby-1); }      \
-            C_TO_CPSR;                                                         \
-          }                                                                    \
-          operand2 = ((sint32)(((sint32)operand2) >> shiftby));                \
-          break;                                                               \
-        case 3: /* ROR */                                                      \
-          if(WRITESTATUS(N) && ISLOGIC(N)) {                                   \
-            c = operand2 >> ((shiftby-1)&31);                                  \
-            C_TO_CPSR;                                                         \
-          }                                                                    \
-          shiftby &= 31;                                                       \
-          operand2 = (operand2 >> shiftby) | (operand2 << (32-shiftby));       \
-          break;                                                               \
-        }                                                                      \
-      }                                                                        \
+      DATA_SHIFT(N)                                                         \
     }                                                                          \
   } else {                                                                     \
     uint32 ror = IFIELD(8,4) * 2;                                              \
     operand2 = IFIELD(0,8);                                                    \
     operand2 = (operand2 >> ror) | (operand2 << (32 - ror));                   \
   }                                                                            \
-  /*                                                   */                        \
-  /* Do stuff depending on the instruction             */                        \
-  /*                                                   */                        \
-  /* for anything except MOV and MVN, we want operand1 */                        \
-  if(DATAOP(N) != DATA_MOV && DATAOP(N) != DATA_MVN) {                           \
-    operand1 = state->r[IFIELD(16,4)];                                         \
-  }                                                                            \
-         if(DATAOP(N) == DATA_MOV) { result = operand2;                         \
-  } else if(DATAOP(N) == DATA_MVN) { result = operand2 ^ 0xFFFFFFFF;            \
-  } else if(DATAOP(N) == DATA_AND) { result = operand1 & operand2;              \
-  } else if(DATAOP(N) == DATA_TST) { result = operand1 & operand2;              \
-  } else if(DATAOP(N) == DATA_EOR) { result = operand1 ^ operand2;              \
-  } else if(DATAOP(N) == DATA_TEQ) { result = operand1 ^ operand2;              \
-  } else if(DATAOP(N) == DATA_ORR) { result = operand1 | operand2;              \
-  } else if(DATAOP(N) == DATA_BIC) { result = operand1 & (~operand2);           \
-  /*                                            */                             \
-  /* (moving on to the arithmetic instructions) */                             \
-  /*                                            */                             \
-  /* ADD and CMN and ADC                        */                             \
-  } else if(               \
-    DATAOP(N)==DATA_ADD || \
-    DATAOP(N)==DATA_CMN || \
-    DATAOP(N)==DATA_ADC    \
-  ) {       \
-    result = operand1 + operand2;                                              \
-    if(DATAOP(N)==DATA_ADC) result += (((state->cpsr) >> PSR_POS_C) & 1);       \
-    if(WRITESTATUS(N)) {                                                       \
-      v = ((operand2^result)&(~(operand1^operand2))) >> 31;                    \
-      c = (result^((operand1^operand2)|(operand2^result))) >> 31;              \
-      state->cpsr &= ~((PSR_CMASK)|(PSR_VMASK));                               \
-      state->cpsr |= v << PSR_POS_V;                                           \
-      state->cpsr |= c << PSR_POS_C;                                           \
-    }                                                                          \
-  /* SUB and RSB and CMP and SBC and RSC  */                                   \
-  } else if(               \
-    DATAOP(N)==DATA_SUB || \
-    DATAOP(N)==DATA_RSB || \
-    DATAOP(N)==DATA_CMP || \
-    DATAOP(N)==DATA_SBC || \
-    DATAOP(N)==DATA_RSC    \
-  ) {                      \
-    /* swap for RSB and RSC   */                                                            \
-    if(DATAOP(N)==DATA_RSB || DATAOP(N)==DATA_RSC) {                 \
-      result = operand1; operand1 = operand2; operand2 = result; }   \
-    result = operand1 - operand2;                                                           \
-    /* carry where needed */                                                                \
-    if(DATAOP(N)==DATA_SBC || DATAOP(N)==DATA_RSC) {                                        \
-      result += (((state->cpsr) >> PSR_POS_C) & 1);                                         \
-      result--;                                                                             \
-    }                                                                                       \
-    if(WRITESTATUS(N)) {                                                                   \
-      v = ((operand2^operand1)&(~(operand2^result))) >> 31;                                \
-      c = (~(operand1^((operand2^operand1)|(operand1^result)))) >> 31;                     \
-      state->cpsr &= ~((PSR_CMASK)|(PSR_VMASK));                                           \
-      state->cpsr |= v << PSR_POS_V;                                                       \
-      state->cpsr |= c << PSR_POS_C;                                                       \
-    }                                                                                      \
-  }                                                                                        \
-  /* set N and Z here if we want them  */                                                  \
-  if(WRITESTATUS(N)) { GET_NZ_TO_CPSR(result); }                                           \
-  /* it's safe to decrement the program counter again here */                              \
-  state->r[15] -= 4;                                                                       \
-  /* write results to the destination register if applicable */                            \
-  if((N & 0x18) != 0x10) {                                                                 \
-    uint32 rd = IFIELD(12,4);                                                              \
-    state->r[rd] = result;                                                                 \
-    /* if the destination reg was the PC:   */                                             \
-    if(rd == 15) {                                                                         \
-      /* force fetch base recalculation    */                                              \
-      pcchanged(state);                                                                    \
-      /* and also, if S was set, return from exception  */                                 \
-      if(WRITESTATUS(N)) {                                                                 \
-        setcpsr(state, state->spsr);                                                       \
-        arm_break(state);                                                                  \
-      }                                                                                    \
-    }                                                                                      \
-  }                                                                                        \
+  DATA_OPERATE(N)                                                                \
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -755,32 +1087,50 @@ INSDATA(0x38) INSDATA(0x39) INSDATA(0x3A) INSDATA(0x3B) INSDATA(0x3C) INSDATA(0x
 #define SDT_W(N) (((N)>>1)&1)
 #define SDT_L(N) (((N)>>0)&1)
 
-#define INSSDT(N)                                                           \
-static void EMU_CALL inssdt##N(struct ARM_STATE *state, uint32 insword) {   \
-  uint32 rn = IFIELD(16,4);                                                 \
-  uint32 rd = IFIELD(12,4);                                                 \
-  uint32 address, offset;                                                   \
-  /* PC is advanced by 8 here */                                            \
-  state->r[15] += 8;                                                        \
-  /* get base address */                                                    \
-  address = state->r[rn];                                                   \
-  /* get offset */                                                          \
-  if(!(SDT_I(N))) {                                                          \
-    offset = insword & 0xFFF;                                               \
-  } else {                                                                  \
+//
+// Transfer at address and offset, with the PC advanced by 8
+//
+#define SDT_TRANSFER(N)                                                                     \
+  if(( SDT_P(N))) { if(SDT_U(N)) { address += offset; } else { address -= offset; } } \
+  if(SDT_L(N)) {                                                                      \
+    if(SDT_B(N)) { state->r[rd] = (uint8 )lb(state, address); }                       \
+    else         { state->r[rd] = (uint32)lw(state, address); }                       \
+    if(rd == 15) { state->r[15] += 4; pcchanged(state); }                             \
+  } else {                                                                            \
+    if(SDT_B(N)) { sb(state, address, state->r[rd] & 0xFF); }                         \
+    else         { sw(state, address, state->r[rd]       ); }                         \
+  }                                                                                   \
+  if((!SDT_P(N))) { if(SDT_U(N)) { address += offset; } else { address -= offset; } } \
+  /* remember: post implies writeback */                                              \
+  if((!SDT_P(N)) || SDT_W(N)) { state->r[rn] = address; }                                \
+  state->r[15] -= 4;
+
+#define INSSDT(N)                                                           \
+static void EMU_CALL inssdt##N(struct ARM_STATE *state, uint32 insword) {   \
+  uint32 rn = IFIELD(16,4);                                                 \
+  uint32 rd = IFIELD(12,4);                                                 \
+  uint32 address, offset;                                                   \
+  /* PC is advanced by 8 here */                                            \
+  state->r[15] += 8;                                                        \
+  /* get base address */                                                    \
+  address = state->r[rn];                                                   \
+  /* get offset */                                                          \
+  if(!(SDT_I(N))) {                                                          \
+    offset = insword & 0xFFF;                                               \
+  } else {                                                                  \
     offset = state->r[IFIELD(0,4)];                                         \
     /* shift                 */                                             \
     /* rrx is a special case */                                             \
     if((insword & 0xFF0) == 0x060) {                                        \
-      offset = (offset >> 1) | ((state->cpsr << 2) & 0x80000000);           \
+      offset = (offset >> 1) | (GET_C_FROM_CPSR << 31);                     \
     } else {                                                                \
       uint8 shiftby = IFIELD(7,5);                                          \
       shiftby |= ((shiftby == 0) & ((insword & 0x60) != 0)) << 5;           \
       if(shiftby) {                                                         \
         switch(IFIELD(5,2)) {                                               \
         case 0: /* LSL */ offset <<= shiftby; break;                        \
-        case 1: /* LSR */ offset >>= shiftby; break;                        \
-        case 2: /* ASR */ offset = ((sint32)(((sint32)offset) >> shiftby)); break; \
+        case 1: /* LSR */ offset = (shiftby >= 32) ? 0 : (offset >> shiftby); break; \
+        case 2: /* ASR */ offset = ((sint32)(((sint32)offset) >> ((shiftby >= 32) ? 31 : shiftby))); break; \
         case 3: /* ROR */                                                   \
           shiftby &= 31;                                                    \
           offset = (offset >> shiftby) | (offset << (32-shiftby));          \
@@ -789,19 +1139,7 @@ static void EMU_CALL inssdt##N(struct ARM_STATE *state, uint32 insword) {   \
       }                                                                     \
     }                                                                       \
   }                                                                         \
-  if(( SDT_P(N))) { if(SDT_U(N)) { address += offset; } else { address -= offset; } } \
-  if(SDT_L(N)) {                                                                      \
-    if(SDT_B(N)) { state->r[rd] = (uint8 )lb(state, address); }                       \
-    else         { state->r[rd] = (uint32)lw(state, address); }                       \
-    if(rd == 15) { state->r[15] += 4; pcchanged(state); }                             \
-  } else {                                                                            \
-    if(SDT_B(N)) { sb(state, address, state->r[rd] & 0xFF); }                         \
-    else         { sw(state, address, state->r[rd]       ); }                         \
-  }                                                                                   \
-  if((!SDT_P(N))) { if(SDT_U(N)) { address += offset; } else { address -= offset; } } \
-  /* remember: post implies writeback */                                              \
-  if((!SDT_P(N)) || SDT_W(N)) { state->r[rn] = address; }                                \
-  state->r[15] -= 4;                                                        \
+  SDT_TRANSFER(N)                                                           \
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -825,6 +1163,21 @@ INSSDT(0x78) INSSDT(0x79) INSSDT(0x7A) INSSDT(0x7B) INSSDT(0x7C) INSSDT(0x7D) IN
 #define BDT_W(N) (((N)>>1)&1)
 #define BDT_L(N) (((N)>>0)&1)
 
+//
+// Host pointer to the word at a block transfer's base address, if it's
+// aligned and every word the transfer could touch is in the same directly
+// mapped page, or NULL to go word by word
+//
+static EMU_INLINE uint32 *bdt_block(struct ARM_STATE *state, uint32 address, uint32 N) {
+  uint8 *page;
+  uint32 offset = address & ARM_PAGE_MASK;
+  if(address & 3) { return NULL; }
+  if(BDT_U(N) ? (offset > ARM_PAGE_SIZE - 68) : (offset < 64)) { return NULL; }
+  page = BDT_L(N) ? PAGE_LOAD(address) : PAGE_STORE(address);
+  if(!page) { return NULL; }
+  return (uint32*)(page + offset);
+}
+
 #define INSBDT(N)                                                             \
 static void EMU_CALL insbdt##N(struct ARM_STATE *state, uint32 insword) {     \
   uint32 address = state->r[IFIELD(16,4)];                                    \
@@ -832,39 +1185,72 @@ static void EMU_CALL insbdt##N(struct ARM_STATE *state, uint32 insword) {     \
   sint32 r = 0;                                                               \
   sint32 rend = 16;                                                           \
   sint32 rstep = 1;                                                           \
+  uint32 *base;                                                               \
   /* R15 is stored as +12 - we can restore later if necessary */              \
   state->r[15] += 12;                                                         \
   /* count registers backwards if decrementing */                             \
   if(!(BDT_U(N))) { r=15; rend=-1; rstep=-1; }                                \
-  for(; r!=rend; r+=rstep) if((insword>>r)&1) {                               \
-    if(( BDT_P(N))) { if(BDT_U(N)) { address += 4; } else { address -= 4; } } \
-    if(BDT_L(N)) {                                                            \
-      if(BDT_S(N)) {                                                          \
-        if((insword&0x8000)==0) { setuserreg(state, r, lw(state, address)); } \
-        else { state->r[r] = lw(state, address); }                            \
+  base = bdt_block(state, address, N);                                        \
+  if(base) {                                                                  \
+    /* in register order, straight to or from the page */                     \
+    uint32 *p = base + (BDT_U(N) ? BDT_P(N) : -BDT_P(N));                     \
+    uint32 *first = p;                                                        \
+    uint32 m = insword & 0xFFFF;                                              \
+    /* stop after the last register in the list */                            \
+    for(; m; r+=rstep) if((m>>r)&1) {                                         \
+      m &= ~(1 << r);                                                         \
+      if(BDT_L(N)) {                                                          \
+        if(BDT_S(N) && (insword&0x8000)==0) { setuserreg(state, r, *p); }     \
+        else { state->r[r] = *p; }                                            \
+        if(r == 15) {                                                         \
+          state->r[15] += 8; pcchanged(state);                                \
+          if(BDT_S(N)) { rfe = 1; }                                           \
+        }                                                                     \
       } else {                                                                \
-        state->r[r] = lw(state, address);                                     \
+        if(BDT_S(N)) { *p = getuserreg(state, r); }                           \
+        else { *p = state->r[r]; }                                            \
       }                                                                       \
-      /* if we just loaded the PC: */                                         \
-      if(r == 15) {                                                           \
-        /* adjust for it */                                                   \
-        state->r[15] += 8; pcchanged(state);                                  \
-        /* also if S is set, return from exception */                         \
+      p += rstep;                                                             \
+    }                                                                         \
+    /* at most 64 bytes were stored, so at most two chunks of code */         \
+    if(!(BDT_L(N)) && p != first) {                                           \
+      uint32 a0 = address + 4 * ((uint32)(first - base));                     \
+      uint32 a1 = address + 4 * ((uint32)(p - rstep - base));                 \
+      CODE_STORE_CHECK(a0)                                                    \
+      CODE_STORE_CHECK(a1)                                                    \
+    }                                                                         \
+    address += 4 * ((uint32)(p - first));                                     \
+  } else {                                                                    \
+    for(; r!=rend; r+=rstep) if((insword>>r)&1) {                             \
+      if(( BDT_P(N))) { if(BDT_U(N)) { address += 4; } else { address -= 4; } } \
+      if(BDT_L(N)) {                                                          \
         if(BDT_S(N)) {                                                        \
-          rfe = 1;                                                            \
+          if((insword&0x8000)==0) { setuserreg(state, r, lw(state, address)); } \
+          else { state->r[r] = lw(state, address); }                          \
+        } else {                                                              \
+          state->r[r] = lw(state, address);                                   \
+        }                                                                     \
+        /* if we just loaded the PC: */                                       \
+        if(r == 15) {                                                         \
+          /* adjust for it */                                                 \
+          state->r[15] += 8; pcchanged(state);                                \
+          /* also if S is set, return from exception */                       \
+          if(BDT_S(N)) {                                                      \
+            rfe = 1;                                                          \
+          }                                                                   \
         }                                                                     \
+      } else {                                                                \
+        if(BDT_S(N)) { sw(state, address, getuserreg(state, r)); }            \
+        else { sw(state, address, state->r[r]); }                             \
       }                                                                       \
-    } else {                                                                  \
-      if(BDT_S(N)) { sw(state, address, getuserreg(state, r)); }              \
-      else { sw(state, address, state->r[r]); }                               \
+      if((!BDT_P(N))) { if(BDT_U(N)) { address += 4; } else { address -= 4; } } \
     }                                                                         \
-    if((!BDT_P(N))) { if(BDT_U(N)) { address += 4; } else { address -= 4; } } \
   }                                                                           \
   if(BDT_W(N)) { state->r[IFIELD(16,4)] = address; if(IFIELD(16,4)==15) pcchanged(state); } \
   state->r[15] -= 8;                                                          \
   if(rfe) {                                                             \
     setcpsr(state, state->spsr);                                        \
-    arm_break(state);                                                   \
+    arm_interrupt_changed(state);                                       \
   }                                                                     \
 }
 
@@ -947,6 +1333,1157 @@ static inscallback inscalltable[256] = {
   badins,badins,badins,badins,badins,badins,badins,badins
 };
 
+/////////////////////////////////////////////////////////////////////////////
+//
+// Decoded blocks
+//
+// The interpreter decodes a block at a time into ARM_OPs with the operands
+// pulled out ahead of time.  Data processing with an immediate or an
+// immediately-shifted register, single data transfer with an immediate or
+// unshifted register offset, and branches get their own handlers here;
+// anything else runs through inscalltable from the op.  Handlers see the
+// PC at the instruction, as they do when interpreting.
+//
+typedef void (EMU_CALL *opcallback)(struct ARM_STATE *state, const struct ARM_OP *op);
+
+#define OP_INS      (0x00)
+#define OP_DATA(N)  (0x01 + (N)) // 0x00-0x3F
+#define OP_SDT(N)   (0x01 + (N)) // 0x40-0x7F
+#define OP_B        (0x81)
+#define OP_BL       (0x82)
+#define OP_COUNT    (0x83)
+
+#define OPDATA(N)                                                              \
+static void EMU_CALL opdata##N(struct ARM_STATE *state, const struct ARM_OP *op) { \
+  uint32 insword = op->insword;                                                \
+  uint32 c;                                                                    \
+  uint32 result, operand1, operand2;                                           \
+  state->r[15] += 8;                                                           \
+  if(N & 0x20) {                                                               \
+    operand2 = op->operand;                                                    \
+  } else {                                                                     \
+    uint8 shiftby = op->shift & 31;                                            \
+    operand2 = state->r[op->rm];                                               \
+    DATA_SHIFT(N)                                                              \
+  }                                                                            \
+  DATA_OPERATE(N)                                                              \
+}
+
+#define OPSDT(N)                                                               \
+static void EMU_CALL opsdt##N(struct ARM_STATE *state, const struct ARM_OP *op) { \
+  uint32 rn = op->rn;                                                          \
+  uint32 rd = op->rd;                                                          \
+  uint32 address, offset;                                                      \
+  state->r[15] += 8;                                                           \
+  address = state->r[rn];                                                      \
+  if(SDT_I(N)) { offset = state->r[op->rm]; } else { offset = op->operand; }   \
+  SDT_TRANSFER(N)                                                              \
+}
+
+OPDATA(0x00) OPDATA(0x01) OPDATA(0x02) OPDATA(0x03) OPDATA(0x04) OPDATA(0x05) OPDATA(0x06) OPDATA(0x07)
+OPDATA(0x08) OPDATA(0x09) OPDATA(0x0A) OPDATA(0x0B) OPDATA(0x0C) OPDATA(0x0D) OPDATA(0x0E) OPDATA(0x0F)
+OPDATA(0x10) OPDATA(0x11) OPDATA(0x12) OPDATA(0x13) OPDATA(0x14) OPDATA(0x15) OPDATA(0x16) OPDATA(0x17)
+OPDATA(0x18) OPDATA(0x19) OPDATA(0x1A) OPDATA(0x1B) OPDATA(0x1C) OPDATA(0x1D) OPDATA(0x1E) OPDATA(0x1F)
+OPDATA(0x20) OPDATA(0x21) OPDATA(0x22) OPDATA(0x23) OPDATA(0x24) OPDATA(0x25) OPDATA(0x26) OPDATA(0x27)
+OPDATA(0x28) OPDATA(0x29) OPDATA(0x2A) OPDATA(0x2B) OPDATA(0x2C) OPDATA(0x2D) OPDATA(0x2E) OPDATA(0x2F)
+OPDATA(0x30) OPDATA(0x31) OPDATA(0x32) OPDATA(0x33) OPDATA(0x34) OPDATA(0x35) OPDATA(0x36) OPDATA(0x37)
+OPDATA(0x38) OPDATA(0x39) OPDATA(0x3A) OPDATA(0x3B) OPDATA(0x3C) OPDATA(0x3D) OPDATA(0x3E) OPDATA(0x3F)
+
+OPSDT(0x40) OPSDT(0x41) OPSDT(0x42) OPSDT(0x43) OPSDT(0x44) OPSDT(0x45) OPSDT(0x46) OPSDT(0x47)
+OPSDT(0x48) OPSDT(0x49) OPSDT(0x4A) OPSDT(0x4B) OPSDT(0x4C) OPSDT(0x4D) OPSDT(0x4E) OPSDT(0x4F)
+OPSDT(0x50) OPSDT(0x51) OPSDT(0x52) OPSDT(0x53) OPSDT(0x54) OPSDT(0x55) OPSDT(0x56) OPSDT(0x57)
+OPSDT(0x58) OPSDT(0x59) OPSDT(0x5A) OPSDT(0x5B) OPSDT(0x5C) OPSDT(0x5D) OPSDT(0x5E) OPSDT(0x5F)
+OPSDT(0x60) OPSDT(0x61) OPSDT(0x62) OPSDT(0x63) OPSDT(0x64) OPSDT(0x65) OPSDT(0x66) OPSDT(0x67)
+OPSDT(0x68) OPSDT(0x69) OPSDT(0x6A) OPSDT(0x6B) OPSDT(0x6C) OPSDT(0x6D) OPSDT(0x6E) OPSDT(0x6F)
+OPSDT(0x70) OPSDT(0x71) OPSDT(0x72) OPSDT(0x73) OPSDT(0x74) OPSDT(0x75) OPSDT(0x76) OPSDT(0x77)
+OPSDT(0x78) OPSDT(0x79) OPSDT(0x7A) OPSDT(0x7B) OPSDT(0x7C) OPSDT(0x7D) OPSDT(0x7E) OPSDT(0x7F)
+
+static void EMU_CALL opbranch(struct ARM_STATE *state, const struct ARM_OP *op) {
+  state->r[15] = op->operand;
+  pcchanged(state);
+}
+
+static void EMU_CALL opbranchlink(struct ARM_STATE *state, const struct ARM_OP *op) {
+  state->r[14] = state->r[15] + 4;
+  state->r[15] = op->operand;
+  pcchanged(state);
+}
+
+static opcallback opcalltable[OP_COUNT] = {
+  NULL,
+// 00
+  opdata0x00,opdata0x01,opdata0x02,opdata0x03,opdata0x04,opdata0x05,opdata0x06,opdata0x07,
+  opdata0x08,opdata0x09,opdata0x0A,opdata0x0B,opdata0x0C,opdata0x0D,opdata0x0E,opdata0x0F,
+// 10
+  opdata0x10,opdata0x11,opdata0x12,opdata0x13,opdata0x14,opdata0x15,opdata0x16,opdata0x17,
+  opdata0x18,opdata0x19,opdata0x1A,opdata0x1B,opdata0x1C,opdata0x1D,opdata0x1E,opdata0x1F,
+// 20
+  opdata0x20,opdata0x21,opdata0x22,opdata0x23,opdata0x24,opdata0x25,opdata0x26,opdata0x27,
+  opdata0x28,opdata0x29,opdata0x2A,opdata0x2B,opdata0x2C,opdata0x2D,opdata0x2E,opdata0x2F,
+// 30
+  opdata0x30,opdata0x31,opdata0x32,opdata0x33,opdata0x34,opdata0x35,opdata0x36,opdata0x37,
+  opdata0x38,opdata0x39,opdata0x3A,opdata0x3B,opdata0x3C,opdata0x3D,opdata0x3E,opdata0x3F,
+// 40
+  opsdt0x40,opsdt0x41,opsdt0x42,opsdt0x43,opsdt0x44,opsdt0x45,opsdt0x46,opsdt0x47,
+  opsdt0x48,opsdt0x49,opsdt0x4A,opsdt0x4B,opsdt0x4C,opsdt0x4D,opsdt0x4E,opsdt0x4F,
+// 50
+  opsdt0x50,opsdt0x51,opsdt0x52,opsdt0x53,opsdt0x54,opsdt0x55,opsdt0x56,opsdt0x57,
+  opsdt0x58,opsdt0x59,opsdt0x5A,opsdt0x5B,opsdt0x5C,opsdt0x5D,opsdt0x5E,opsdt0x5F,
+// 60
+  opsdt0x60,opsdt0x61,opsdt0x62,opsdt0x63,opsdt0x64,opsdt0x65,opsdt0x66,opsdt0x67,
+  opsdt0x68,opsdt0x69,opsdt0x6A,opsdt0x6B,opsdt0x6C,opsdt0x6D,opsdt0x6E,opsdt0x6F,
+// 70
+  opsdt0x70,opsdt0x71,opsdt0x72,opsdt0x73,opsdt0x74,opsdt0x75,opsdt0x76,opsdt0x77,
+  opsdt0x78,opsdt0x79,opsdt0x7A,opsdt0x7B,opsdt0x7C,opsdt0x7D,opsdt0x7E,opsdt0x7F,
+// branches
+  opbranch,opbranchlink
+};
+
+static void op_decode(struct ARM_OP *op, uint32 insword, uint32 pc) {
+  uint32 N = (insword >> 20) & 0xFF;
+  op->insword = insword;
+  op->operand = 0;
+  op->cond = insword >> 28;
+  op->h = OP_INS;
+  op->rd = IFIELD(12,4);
+  op->rn = IFIELD(16,4);
+  op->rm = IFIELD(0,4);
+  op->shift = 0;
+  if(N < 0x40) {
+    // multiply, swap, halfword transfers and PSR transfers are left alone
+    if(!(N & 0x20) && (insword & 0x90) == 0x90) { return; }
+    if((N & 0x19) == 0x10) { return; }
+    if(N & 0x20) {
+      uint32 ror = IFIELD(8,4) * 2;
+      op->operand = IFIELD(0,8);
+      if(ror) { op->operand = (op->operand >> ror) | (op->operand << (32 - ror)); }
+      op->h = OP_DATA(N);
+    // immediate shift other than RRX and LSR/ASR #32
+    } else if(!(insword & 0x10) && ((insword & 0xF80) || !(insword & 0x60))) {
+      op->shift = IFIELD(7,5);
+      op->h = OP_DATA(N);
+    }
+  } else if(N < 0x80) {
+    if(!SDT_I(N)) {
+      op->operand = insword & 0xFFF;
+      op->h = OP_SDT(N);
+    } else if((insword & 0xFF0) == 0) {
+      op->h = OP_SDT(N);
+    }
+  } else if((N & 0xE0) == 0xA0) {
+    op->operand = pc + 8 + (((sint32)(insword << 8)) >> 6);
+    op->h = (N & 0x10) ? OP_BL : OP_B;
+  }
+}
+
+//
+// Whether the instruction always or maybe writes the PC
+//
+static int op_ends_block(uint32 insword) {
+  uint32 N = (insword >> 20) & 0xFF;
+  uint32 rd = IFIELD(12,4);
+  uint32 rn = IFIELD(16,4);
+  if(N < 0x40) {
+    // MUL/MLA write the field at 16
+    if((N & 0xFC) == 0x00 && (insword & 0xF0) == 0x90) { return rn == 15; }
+    return rd == 15;
+  }
+  if(N < 0x80) {
+    if(SDT_L(N) && rd == 15) { return 1; }
+    return (SDT_W(N) || !SDT_P(N)) && rn == 15;
+  }
+  if(N < 0xA0) {
+    if(BDT_L(N) && (insword & 0x8000)) { return 1; }
+    return BDT_W(N) && rn == 15;
+  }
+  return 1;
+}
+
+//
+// Drop any decoded or compiled blocks in the 64-byte chunk at a
+//
+static void code_invalidate(struct ARM_STATE *state, uint32 a) {
+  uint32 lo = a & (~63);
+  uint32 hi = lo + 63;
+  // only blocks starting up to ARM_BLOCK_OPS-1 instructions before can reach
+  uint32 pc = (lo >= 4 * (ARM_BLOCK_OPS - 1)) ? (lo - 4 * (ARM_BLOCK_OPS - 1)) : 0;
+  state->code_bits[a >> 11] &= ~(1 << ((a >> 6) & 31));
+  state->code_stale = 1;
+  for(; pc <= hi; pc += 4) {
+    struct ARM_BLOCK *b = state->block + ((pc >> 2) & (ARM_BLOCKS - 1));
+    if(b->n && b->pc == pc && (pc + 4 * b->n - 1) >= lo) { b->n = 0; }
+  }
+#ifdef ARM_JIT
+  jit_drop(state, lo, hi);
+#endif
+}
+
+//
+// Drop any blocks between x and y (inclusive)
+//
+static void code_forget(struct ARM_STATE *state, uint32 x, uint32 y) {
+  if(x > y || x >= ARM_CODE_LIMIT) { return; }
+  if(y >= ARM_CODE_LIMIT) { y = ARM_CODE_LIMIT - 1; }
+  for(x &= ~63; x <= y; x += 64) {
+    uint32 bits = state->code_bits[x >> 11];
+    // skip to the next word if there's nothing in this one
+    if(!bits) { x |= 0x7C0; continue; }
+    if((bits >> ((x >> 6) & 31)) & 1) { code_invalidate(state, x); }
+  }
+}
+
+//
+// Find or decode the block at the PC, or NULL to fetch as usual
+//
+static struct ARM_BLOCK *block_lookup(struct ARM_STATE *state) {
+  uint32 pc = state->r[15];
+  struct ARM_BLOCK *b = state->block + ((pc >> 2) & (ARM_BLOCKS - 1));
+  const uint32 *ins;
+  uint8 *page;
+  uint32 n, max, a;
+  if(b->n && b->pc == pc) { return b; }
+  if((pc & 3) || pc >= ARM_CODE_LIMIT) { return NULL; }
+  page = state->page_load[pc >> ARM_PAGE_SHIFT];
+  if(!page) { return NULL; }
+  ins = (const uint32*)(page + (pc & ARM_PAGE_MASK));
+  max = (ARM_PAGE_SIZE - (pc & ARM_PAGE_MASK)) / 4;
+  if(max > ARM_BLOCK_OPS) { max = ARM_BLOCK_OPS; }
+  for(n = 0; n < max; ) {
+    op_decode(b->op + n, ins[n], pc + 4 * n);
+    if(op_ends_block(ins[n++])) { break; }
+  }
+  b->pc = pc;
+  b->n = n;
+  b->runs = 0;
+  for(a = pc & (~63); a < pc + 4 * n; a += 64) {
+    state->code_bits[a >> 11] |= 1 << ((a >> 6) & 31);
+  }
+  return b;
+}
+
+//
+// Run a block until it ends, runs out of cycles, leaves it, or drops code
+//
+static void block_run(struct ARM_STATE *state, struct ARM_BLOCK *b) {
+  const struct ARM_OP *op = b->op;
+  const struct ARM_OP *end = op + b->n;
+  b->runs++;
+  state->code_stale = 0;
+  for(;;) {
+    // instruction may be skipped due to condition
+    if(op->cond != 0xE && !flags_cond(state, op->cond)) {
+      state->r[15] += 4;
+    } else if(op->h) {
+      opcalltable[op->h](state, op);
+    } else {
+      inscalltable[(op->insword >> 20) & 0xFF](state, op->insword);
+    }
+    state->cycles_remaining -= 2;
+    // only the last op can write the PC
+    if(++op == end || state->cycles_remaining <= 0 || state->code_stale) { break; }
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// x86-64 recompiler
+//
+// Compiles a basic block at a time (up to ARM_JIT_BLOCK_MAX instructions,
+// never crossing a page) into code that keeps the registers and CPSR in
+// the state, reached through RBX.  Data processing with an immediate shift,
+// MUL/MLA, LDR/STR(B) and LDM/STM without the PC or user bank, and B/BL
+// are compiled; anything else calls the interpreter's handler, and the
+// block goes on if that left the PC where it expected.
+//
+// Cycles are counted as the interpreter counts them, two per instruction
+// whether or not its condition passes.  They're flushed to cycles_remaining
+// before anything that can call out, so hw_sync sees what the interpreter
+// would, and the block returns after any instruction that leaves them at or
+// below zero (arm_break).  A block is only entered if the interpreter would
+// have run all of it.
+//
+// Stores check the bitmap of 64-byte chunks holding decoded or compiled
+// code.  A hit drops the blocks there and returns after the storing
+// instruction.
+//
+#ifdef ARM_JIT
+
+#ifndef JITPOOL_SLOT_SIZE
+#define JITPOOL_SLOT_SIZE (0x200000)
+#endif
+#define JITPOOL_HEADROOM  (0x10000) // more than the largest block
+#define JITPOOL_PAGE      (0x1000) // protection granularity
+
+struct JIT_BLOCK {
+  uint32 pc;
+  uint32 n; // instructions
+  uint8 *code; // NULL = empty
+  uint32 size; // bytes of code
+};
+
+//
+// Code is owned by the library, one slot per state.  A state keeps the
+// slot and serial of its code; the serial changes whenever code is compiled
+// or dropped, so a copy or an older snapshot of the state doesn't run code
+// it didn't see compiled.  Slots are made as states need them, up to
+// ARM_JIT_SLOTS; past that the least recently used idle slot is taken.
+// Slots in use are busy and never taken.
+//
+// Pages a run compiles into stay writable until jit_end makes them all
+// executable at once, so blocks compiled in a run start running in the
+// next one.
+//
+struct JITPOOL_SLOT {
+  uint8 *code;
+  void *owner;
+  uint32 serial;
+  uint32 busy;
+  uint32 last_used;
+  uint32 used; // bytes of code
+  uint32 open, open_end; // writable pages, or JITPOOL_SLOT_SIZE and 0
+  struct JIT_BLOCK block[ARM_JIT_BLOCKS]; // direct-mapped by PC
+};
+
+static uint8 jitpool_failed = 0;
+static volatile int jitpool_lock = 0;
+static uint32 jitpool_serial = 0;
+static uint32 jitpool_clock = 0;
+static uint32 jitpool_slots = 0; // made so far
+static struct JITPOOL_SLOT *jitpool_slot[ARM_JIT_SLOTS];
+
+static void jitpool_enter(void) {
+  while(__sync_lock_test_and_set(&jitpool_lock, 1)) { }
+}
+
+static void jitpool_leave(void) {
+  __sync_lock_release(&jitpool_lock);
+}
+
+//
+// Whether the state's slot is still its own (call with the lock held)
+//
+static struct JITPOOL_SLOT *jitpool_owned(struct ARM_STATE *state) {
+  struct JITPOOL_SLOT *slot;
+  if(state->jit_slot >= jitpool_slots) { return NULL; }
+  slot = jitpool_slot[state->jit_slot];
+  if(slot->owner != state || slot->serial != state->jit_serial) { return NULL; }
+  return slot;
+}
+
+//
+// New serial for the state's slot (call with the lock held)
+//
+static void jitpool_touch(struct ARM_STATE *state, struct JITPOOL_SLOT *slot) {
+  jitpool_serial++;
+  if(!jitpool_serial) { jitpool_serial++; }
+  slot->serial = jitpool_serial;
+  state->jit_serial = jitpool_serial;
+}
+
+//
+// Empty the slot (call with the lock held)
+//
+static void jitpool_flush(struct ARM_STATE *state, struct JITPOOL_SLOT *slot) {
+  memset(slot->block, 0, sizeof(slot->block));
+  slot->used = 0;
+  jitpool_touch(state, slot);
+}
+
+//
+// Make another slot (call with the lock held)
+// Returns nonzero if it did
+//
+static int jitpool_grow(void) {
+  struct JITPOOL_SLOT *slot;
+  void *p;
+  if(jitpool_slots >= ARM_JIT_SLOTS) { return 0; }
+  slot = (struct JITPOOL_SLOT*)calloc(1, sizeof(struct JITPOOL_SLOT));
+  if(!slot) { return 0; }
+  p = mmap(NULL, JITPOOL_SLOT_SIZE, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED) { free(slot); return 0; }
+  slot->code = (uint8*)p;
+  slot->open = JITPOOL_SLOT_SIZE;
+  jitpool_slot[jitpool_slots++] = slot;
+  return 1;
+}
+
+//
+// Unmap and free every slot (call with the lock held, none busy)
+// States still holding a slot index find it gone or someone else's
+//
+static void jitpool_release(void) {
+  uint32 n;
+  for(n = 0; n < jitpool_slots; n++) {
+    munmap(jitpool_slot[n]->code, JITPOOL_SLOT_SIZE);
+    free(jitpool_slot[n]);
+    jitpool_slot[n] = NULL;
+  }
+  jitpool_slots = 0;
+  jitpool_failed = 0;
+}
+
+//
+// Get the state's slot for executing, or NULL to interpret
+// Must be paired with jit_end
+//
+static struct JITPOOL_SLOT *jit_begin(struct ARM_STATE *state) {
+  struct JITPOOL_SLOT *slot;
+  uint32 n, best;
+  if(!(state->jit_enabled)) { return NULL; }
+  jitpool_enter();
+  slot = jitpool_owned(state);
+  if(!slot) {
+    //
+    // Prefer a slot we had, then an empty one, then a new one, else the
+    // least recently used idle one
+    //
+    best = jitpool_slots;
+    for(n = 0; n < jitpool_slots; n++) {
+      if(jitpool_slot[n]->busy) { continue; }
+      if(jitpool_slot[n]->owner == state) { best = n; break; }
+    }
+    if(best == jitpool_slots) {
+      for(n = 0; n < jitpool_slots; n++) {
+        if(jitpool_slot[n]->busy) { continue; }
+        if(!jitpool_slot[n]->owner) { best = n; break; }
+      }
+    }
+    if(best == jitpool_slots && jitpool_grow()) { best = jitpool_slots - 1; }
+    if(best == jitpool_slots) {
+      for(n = 0; n < jitpool_slots; n++) {
+        if(jitpool_slot[n]->busy) { continue; }
+        if(
+          best == jitpool_slots ||
+          (jitpool_clock - jitpool_slot[n]->last_used) >
+          (jitpool_clock - jitpool_slot[best]->last_used)
+        ) { best = n; }
+      }
+    }
+    if(best == jitpool_slots) { jitpool_leave(); return NULL; }
+    slot = jitpool_slot[best];
+    slot->owner = state;
+    state->jit_slot = best;
+    jitpool_flush(state, slot);
+  }
+  slot->busy++;
+  slot->last_used = ++jitpool_clock;
+  jitpool_leave();
+  return slot;
+}
+
+//
+// Make what the run compiled executable, and let the slot go
+//
+static void jit_end(struct ARM_STATE *state, struct JITPOOL_SLOT *slot) {
+  uint32 hi = (slot->used + JITPOOL_PAGE - 1) & (~(JITPOOL_PAGE - 1));
+  uint8 failed = 0;
+  if(slot->open < slot->open_end) {
+    failed = (mprotect(slot->code + slot->open, hi - slot->open, PROT_READ | PROT_EXEC) != 0);
+    slot->open = JITPOOL_SLOT_SIZE;
+    slot->open_end = 0;
+  }
+  jitpool_enter();
+  if(failed) {
+    // none of the code there can run; drop it all and compile nothing more
+    jitpool_failed = 1;
+    jitpool_flush(state, slot);
+  }
+  slot->busy--;
+  jitpool_leave();
+}
+
+//
+// Drop any compiled blocks overlapping lo-hi; only blocks starting up to
+// ARM_JIT_BLOCK_MAX-1 instructions before lo can
+//
+static void jit_drop_blocks(struct JITPOOL_SLOT *slot, uint32 lo, uint32 hi) {
+  uint32 pc = (lo >= 4 * (ARM_JIT_BLOCK_MAX - 1)) ? (lo - 4 * (ARM_JIT_BLOCK_MAX - 1)) : 0;
+  for(; pc <= hi; pc += 4) {
+    struct JIT_BLOCK *b = slot->block + ((pc >> 2) & (ARM_JIT_BLOCKS - 1));
+    if(b->code && b->pc == pc && (pc + 4 * b->n - 1) >= lo) { b->code = NULL; }
+  }
+}
+
+//
+// Stores by a running state need no lock: its slot is busy, so nobody
+// else can take it.  From outside a run, check the slot is still ours.
+// Dropping code leaves the serial alone; a copy of the state that still
+// has it only finds less code.
+//
+static void jit_drop(struct ARM_STATE *state, uint32 lo, uint32 hi) {
+  struct JITPOOL_SLOT *slot;
+  if(state->jit_run) {
+    jit_drop_blocks(state->jit_run, lo, hi);
+    return;
+  }
+  jitpool_enter();
+  slot = jitpool_owned(state);
+  if(slot) { jit_drop_blocks(slot, lo, hi); }
+  jitpool_leave();
+}
+
+//
+// Slow paths called from compiled code
+//
+static uint32 jit_lb(struct ARM_STATE *state, uint32 a) { return (uint8)lb(state, a); }
+static uint32 jit_lw(struct ARM_STATE *state, uint32 a) { return lw(state, a); }
+static void jit_sb(struct ARM_STATE *state, uint32 a, uint32 d) { sb(state, a, d & 0xFF); }
+static void jit_sw(struct ARM_STATE *state, uint32 a, uint32 d) { sw(state, a, d); }
+static void jit_flags(struct ARM_STATE *state) { flags_sync(state); }
+
+#define C(N) { *outp++ = ((uint8)(N)); }
+#define C32(N) { *((uint32*)outp) = ((uint32)(N)); outp += 4; }
+#define C64(N) { *((uint64*)outp) = ((uint64)(N)); outp += 8; }
+
+// short forward jumps: emit, then patch at the target
+#define J8(OP,P) { C(OP) (P) = outp; C(0) }
+#define L8(P) { *(P) = (uint8)(outp - ((P) + 1)); }
+#define J32(OP,P) { C(0x0F) C(OP) (P) = outp; C32(0) }
+#define L32(P) { *((uint32*)(P)) = (uint32)(outp - ((P) + 4)); }
+
+#define STRUCTOFS(thetype,thefield) ((uint32)((size_t)(&(((struct thetype*)0)->thefield))))
+#define STATEOFS(thefield) STRUCTOFS(ARM_STATE,thefield)
+#define REGOFS(n) (STATEOFS(r[0]) + 4 * (n))
+
+#define X86_EAX (0)
+#define X86_ECX (1)
+#define X86_EDX (2)
+#define X86_EBP (5)
+#define X86_ESI (6)
+
+//
+// mov x86reg,<ARM register>; the PC reads as the interpreter has it, +8
+//
+static uint8 *jit_get(uint8 *outp, uint32 x86reg, uint32 armreg, uint32 pc) {
+  if(armreg == 15) {
+    C(0xB8 + x86reg) C32(pc + 8)                     // mov reg,imm32
+  } else {
+    C(0x8B) C(0x83 | (x86reg << 3)) C32(REGOFS(armreg)) // mov reg,[rbx+<OFS32:r>]
+  }
+  return outp;
+}
+
+static uint8 *jit_put(uint8 *outp, uint32 x86reg, uint32 armreg) {
+  C(0x89) C(0x83 | (x86reg << 3)) C32(REGOFS(armreg)) // mov [rbx+<OFS32:r>],reg
+  return outp;
+}
+
+static uint8 *jit_call(uint8 *outp, void *f) {
+  C(0x48) C(0x89) C(0xDF)                         // mov rdi,rbx
+  C(0x48) C(0xB8) C64((size_t)f)                  // mov rax,imm64
+  C(0xFF) C(0xD0)                                 // call rax
+  return outp;
+}
+
+static uint8 *jit_epilogue(uint8 *outp) {
+  C(0x41) C(0x5C)                                 // pop r12
+  C(0x5D)                                         // pop rbp
+  C(0x5B)                                         // pop rbx
+  C(0xC3)                                         // ret
+  return outp;
+}
+
+//
+// Return with the PC at pc and n more instructions' worth of cycles spent
+//
+static uint8 *jit_exit(uint8 *outp, uint32 pc, uint32 n) {
+  C(0xC7) C(0x83) C32(REGOFS(15)) C32(pc)         // mov dword [rbx+<OFS32:r15>],pc
+  if(n) {
+    C(0x81) C(0xAB) C32(STATEOFS(cycles_remaining)) C32(2 * n) // sub dword [rbx+<OFS32:cycles>],2n
+  }
+  return jit_epilogue(outp);
+}
+
+//
+// Jump to the returned pointer (rel32) if the condition fails
+//
+static uint8 *jit_cond(uint8 *outp, uint32 cond, uint8 **skip) {
+  uint32 mask = 0;
+  uint32 nzcv;
+  for(nzcv = 0; nzcv < 16; nzcv++) {
+    if(condtable[(nzcv << 4) + cond]) { mask |= 1 << nzcv; }
+  }
+  C(0x8B) C(0x83) C32(STATEOFS(cpsr))             // mov eax,[rbx+<OFS32:cpsr>]
+  C(0xC1) C(0xE8) C(0x1C)                         // shr eax,28
+  C(0xB9) C32(mask)                               // mov ecx,mask
+  C(0x0F) C(0xA3) C(0xC1)                         // bt ecx,eax
+  J32(0x83, *skip)                                // jnc skip
+  return outp;
+}
+
+//
+// Load from the address in ESI to EAX
+//
+static uint8 *jit_load(uint8 *outp, int byte) {
+  uint8 *slow1 = NULL, *slow2, *slow3, *done;
+  if(!byte) {
+    C(0xF7) C(0xC6) C32(3)                        // test esi,3
+    J8(0x75, slow1)                               // jnz slow
+  }
+  C(0x89) C(0xF0)                                 // mov eax,esi
+  C(0xC1) C(0xE8) C(ARM_PAGE_SHIFT)               // shr eax,16
+  C(0x3D) C32(ARM_PAGES)                          // cmp eax,<pages>
+  J8(0x73, slow3)                                 // jae slow
+  C(0x48) C(0x8B) C(0x94) C(0xC3) C32(STATEOFS(page_load)) // mov rdx,[rbx+rax*8+<OFS32:page_load>]
+  C(0x48) C(0x85) C(0xD2)                         // test rdx,rdx
+  J8(0x74, slow2)                                 // jz slow
+  C(0x0F) C(0xB7) C(0xC6)                         // movzx eax,si
+  if(byte) {
+    C(0x0F) C(0xB6) C(0x04) C(0x02)               // movzx eax,byte [rdx+rax]
+  } else {
+    C(0x8B) C(0x04) C(0x02)                       // mov eax,[rdx+rax]
+  }
+  J8(0xEB, done)                                  // jmp done
+  if(slow1) { L8(slow1) }
+  L8(slow2)
+  L8(slow3)
+  outp = jit_call(outp, byte ? ((void*)jit_lb) : ((void*)jit_lw));
+  L8(done)
+  return outp;
+}
+
+//
+// Store EDX to the address in ESI
+//
+static uint8 *jit_store(uint8 *outp, int byte) {
+  uint8 *slow1 = NULL, *slow2, *slow3, *slow4, *done;
+  if(!byte) {
+    C(0xF7) C(0xC6) C32(3)                        // test esi,3
+    J8(0x75, slow1)                               // jnz slow
+  }
+  C(0x89) C(0xF0)                                 // mov eax,esi
+  C(0xC1) C(0xE8) C(ARM_PAGE_SHIFT)               // shr eax,16
+  C(0x3D) C32(ARM_PAGES)                          // cmp eax,<pages>
+  J8(0x73, slow4)                                 // jae slow
+  C(0x48) C(0x8B) C(0x8C) C(0xC3) C32(STATEOFS(page_store)) // mov rcx,[rbx+rax*8+<OFS32:page_store>]
+  C(0x48) C(0x85) C(0xC9)                         // test rcx,rcx
+  J8(0x74, slow2)                                 // jz slow
+  //
+  // Compiled code there?  Paged addresses are all inside the bitmap
+  //
+  C(0x89) C(0xF0)                                 // mov eax,esi
+  C(0xC1) C(0xE8) C(0x0B)                         // shr eax,11
+  C(0x8B) C(0x84) C(0x83) C32(STATEOFS(code_bits)) // mov eax,[rbx+rax*4+<OFS32:code_bits>]
+  C(0x89) C(0xF7)                                 // mov edi,esi
+  C(0xC1) C(0xEF) C(0x06)                         // shr edi,6
+  C(0x0F) C(0xA3) C(0xF8)                         // bt eax,edi
+  J8(0x72, slow3)                                 // jc slow
+  C(0x0F) C(0xB7) C(0xC6)                         // movzx eax,si
+  if(byte) {
+    C(0x88) C(0x14) C(0x01)                       // mov [rcx+rax],dl
+  } else {
+    C(0x89) C(0x14) C(0x01)                       // mov [rcx+rax],edx
+  }
+  J8(0xEB, done)                                  // jmp done
+  if(slow1) { L8(slow1) }
+  L8(slow2)
+  L8(slow3)
+  L8(slow4)
+  outp = jit_call(outp, byte ? ((void*)jit_sb) : ((void*)jit_sw));
+  L8(done)
+  return outp;
+}
+
+//
+// Account for an instruction that may have called out: return at pc+4 if
+// that used up the cycles, or if it was a store that hit compiled code
+//
+static uint8 *jit_check(uint8 *outp, uint32 pc, int stored) {
+  uint8 *ex = NULL, *cont;
+  C(0x83) C(0xAB) C32(STATEOFS(cycles_remaining)) C(2) // sub dword [rbx+<OFS32:cycles>],2
+  if(stored) {
+    J8(0x7E, ex)                                  // jle exit
+    C(0x80) C(0xBB) C32(STATEOFS(code_stale)) C(0) // cmp byte [rbx+<OFS32:code_stale>],0
+    J8(0x74, cont)                                // je cont
+  } else {
+    J8(0x7F, cont)                                // jg cont
+  }
+  if(ex) { L8(ex) }
+  outp = jit_exit(outp, pc + 4, 0);
+  L8(cont)
+  return outp;
+}
+
+//
+// Operand 2 of a data processing instruction to ECX, and the shifter carry
+// to EDI if it's needed.  Returns NULL if the interpreter has to do it.
+//
+static uint8 *jit_operand2(uint8 *outp, uint32 insword, uint32 pc, int *carry) {
+  uint32 N = (insword >> 20) & 0xFF;
+  uint32 shiftby, type;
+  *carry = 0;
+  if(N & 0x20) {
+    uint32 ror = IFIELD(8,4) * 2;
+    uint32 v = IFIELD(0,8);
+    if(ror) { v = (v >> ror) | (v << (32 - ror)); }
+    C(0xB9) C32(v)                                // mov ecx,imm32
+    return outp;
+  }
+  // register-specified shifts aren't compiled
+  if(insword & 0x10) { return NULL; }
+  outp = jit_get(outp, X86_ECX, IFIELD(0,4), pc);
+  shiftby = IFIELD(7,5);
+  type = IFIELD(5,2);
+  // a shift by 32 is left to the interpreter
+  if(shiftby == 0 && (type == 1 || type == 2)) { return NULL; }
+  if(shiftby == 0 && type == 0) { return outp; }
+  if(WRITESTATUS(N) && ISLOGIC(N)) {
+    uint32 bit = (shiftby == 0) ? 0 : (type == 0) ? (32 - shiftby) : (shiftby - 1);
+    *carry = 1;
+    C(0x89) C(0xCF)                               // mov edi,ecx
+    if(bit) { C(0xC1) C(0xEF) C(bit) }            // shr edi,bit
+    C(0x83) C(0xE7) C(0x01)                       // and edi,1
+  }
+  if(shiftby == 0) {
+    // RRX
+    C(0x8B) C(0x83) C32(STATEOFS(cpsr))           // mov eax,[rbx+<OFS32:cpsr>]
+    C(0xC1) C(0xE0) C(0x02)                       // shl eax,2
+    C(0x25) C32(0x80000000)                       // and eax,80000000h
+    C(0xD1) C(0xE9)                               // shr ecx,1
+    C(0x09) C(0xC1)                               // or ecx,eax
+    return outp;
+  }
+  switch(type) {
+  case 0: C(0xC1) C(0xE1) C(shiftby) break;       // shl ecx,n
+  case 1: C(0xC1) C(0xE9) C(shiftby) break;       // shr ecx,n
+  case 2: C(0xC1) C(0xF9) C(shiftby) break;       // sar ecx,n
+  case 3: C(0xC1) C(0xC9) C(shiftby) break;       // ror ecx,n
+  }
+  return outp;
+}
+
+//
+// Put N and Z from EAX into the CPSR, and C from EDI if carry is set
+//
+static uint8 *jit_nz(uint8 *outp, int carry) {
+  C(0x8B) C(0x93) C32(STATEOFS(cpsr))             // mov edx,[rbx+<OFS32:cpsr>]
+  C(0x81) C(0xE2) C32(~(PSR_NMASK | PSR_ZMASK | (carry ? PSR_CMASK : 0))) // and edx,mask
+  C(0x41) C(0x89) C(0xC0)                         // mov r8d,eax
+  C(0x41) C(0x81) C(0xE0) C32(PSR_NMASK)          // and r8d,80000000h
+  C(0x44) C(0x09) C(0xC2)                         // or edx,r8d
+  C(0x45) C(0x31) C(0xC9)                         // xor r9d,r9d
+  C(0x85) C(0xC0)                                 // test eax,eax
+  C(0x41) C(0x0F) C(0x94) C(0xC1)                 // setz r9b
+  C(0x41) C(0xC1) C(0xE1) C(PSR_POS_Z)            // shl r9d,30
+  C(0x44) C(0x09) C(0xCA)                         // or edx,r9d
+  if(carry) {
+    C(0xC1) C(0xE7) C(PSR_POS_C)                  // shl edi,29
+    C(0x09) C(0xFA)                               // or edx,edi
+  }
+  C(0x89) C(0x93) C32(STATEOFS(cpsr))             // mov [rbx+<OFS32:cpsr>],edx
+  return outp;
+}
+
+//
+// A data processing instruction, or NULL if the interpreter has to do it
+//
+static uint8 *jit_data(uint8 *outp, uint32 insword, uint32 pc) {
+  uint32 N = (insword >> 20) & 0xFF;
+  uint32 op = DATAOP(N);
+  int s = WRITESTATUS(N);
+  int writes = ((N & 0x18) != 0x10);
+  int arith = !ISLOGIC(N);
+  int carry;
+  //
+  // MUL, MLA
+  //
+  if(!(N & 0x20) && (insword & 0x90) == 0x90) {
+    if((N & 0xFC) != 0x00 || (insword & 0xF0) != 0x90) { return NULL; }
+    if(IFIELD(16,4) == 15) { return NULL; }
+    outp = jit_get(outp, X86_EAX, IFIELD(0,4), pc);
+    outp = jit_get(outp, X86_ECX, IFIELD(8,4), pc);
+    C(0x0F) C(0xAF) C(0xC1)                       // imul eax,ecx
+    if(N & 2) {
+      outp = jit_get(outp, X86_ECX, IFIELD(12,4), pc);
+      C(0x01) C(0xC8)                             // add eax,ecx
+    }
+    outp = jit_put(outp, X86_EAX, IFIELD(16,4));
+    if(s) { outp = jit_nz(outp, 0); }
+    return outp;
+  }
+  // MSR, MRS, and the flagless compares
+  if((N & 0x19) == 0x10) { return NULL; }
+  if(writes && IFIELD(12,4) == 15) { return NULL; }
+  outp = jit_operand2(outp, insword, pc, &carry);
+  if(!outp) { return NULL; }
+  if(op != DATA_MOV && op != DATA_MVN) {
+    outp = jit_get(outp, X86_EAX, IFIELD(16,4), pc);
+  }
+  if(s && arith) {
+    C(0x45) C(0x31) C(0xC0)                       // xor r8d,r8d
+    C(0x45) C(0x31) C(0xC9)                       // xor r9d,r9d
+    C(0x45) C(0x31) C(0xD2)                       // xor r10d,r10d
+    C(0x45) C(0x31) C(0xDB)                       // xor r11d,r11d
+  }
+  if(op == DATA_ADC || op == DATA_SBC || op == DATA_RSC) {
+    C(0x0F) C(0xBA) C(0xA3) C32(STATEOFS(cpsr)) C(PSR_POS_C) // bt dword [rbx+<OFS32:cpsr>],29
+    if(op != DATA_ADC) { C(0xF5) }                // cmc
+  }
+  switch(op) {
+  case DATA_AND: case DATA_TST: C(0x21) C(0xC8) break;          // and eax,ecx
+  case DATA_EOR: case DATA_TEQ: C(0x31) C(0xC8) break;          // xor eax,ecx
+  case DATA_ORR: C(0x09) C(0xC8) break;                         // or eax,ecx
+  case DATA_BIC: C(0xF7) C(0xD1) C(0x21) C(0xC8) break;         // not ecx; and eax,ecx
+  case DATA_MOV: C(0x89) C(0xC8) break;                         // mov eax,ecx
+  case DATA_MVN: C(0x89) C(0xC8) C(0xF7) C(0xD0) break;         // mov eax,ecx; not eax
+  case DATA_ADD: case DATA_CMN: C(0x01) C(0xC8) break;          // add eax,ecx
+  case DATA_ADC: C(0x11) C(0xC8) break;                         // adc eax,ecx
+  case DATA_SUB: case DATA_CMP: C(0x29) C(0xC8) break;          // sub eax,ecx
+  case DATA_SBC: C(0x19) C(0xC8) break;                         // sbb eax,ecx
+  case DATA_RSB: C(0x29) C(0xC1) C(0x89) C(0xC8) break;         // sub ecx,eax; mov eax,ecx
+  case DATA_RSC: C(0x19) C(0xC1) C(0x89) C(0xC8) break;         // sbb ecx,eax; mov eax,ecx
+  }
+  if(s && arith) {
+    //
+    // The interpreter's C is x86's carry for addition, and its inverse
+    // (no borrow) for subtraction
+    //
+    int add = (op == DATA_ADD || op == DATA_CMN || op == DATA_ADC);
+    C(0x41) C(0x0F) C(0x98) C(0xC0)               // sets r8b
+    C(0x41) C(0x0F) C(0x94) C(0xC1)               // setz r9b
+    C(0x41) C(0x0F) C(add ? 0x92 : 0x93) C(0xC2)  // setc/setnc r10b
+    C(0x41) C(0x0F) C(0x90) C(0xC3)               // seto r11b
+    C(0x41) C(0xC1) C(0xE0) C(PSR_POS_N)          // shl r8d,31
+    C(0x41) C(0xC1) C(0xE1) C(PSR_POS_Z)          // shl r9d,30
+    C(0x41) C(0xC1) C(0xE2) C(PSR_POS_C)          // shl r10d,29
+    C(0x41) C(0xC1) C(0xE3) C(PSR_POS_V)          // shl r11d,28
+    C(0x45) C(0x09) C(0xC8)                       // or r8d,r9d
+    C(0x45) C(0x09) C(0xD0)                       // or r8d,r10d
+    C(0x45) C(0x09) C(0xD8)                       // or r8d,r11d
+    C(0x8B) C(0x93) C32(STATEOFS(cpsr))           // mov edx,[rbx+<OFS32:cpsr>]
+    C(0x81) C(0xE2) C32(0x0FFFFFFF)               // and edx,0FFFFFFFh
+    C(0x44) C(0x09) C(0xC2)                       // or edx,r8d
+    C(0x89) C(0x93) C32(STATEOFS(cpsr))           // mov [rbx+<OFS32:cpsr>],edx
+  } else if(s) {
+    outp = jit_nz(outp, carry);
+  }
+  if(writes) { outp = jit_put(outp, X86_EAX, IFIELD(12,4)); }
+  return outp;
+}
+
+//
+// A single data transfer, or NULL if the interpreter has to do it
+//
+static uint8 *jit_sdt(uint8 *outp, uint32 insword, uint32 pc) {
+  uint32 N = (insword >> 20) & 0xFF;
+  uint32 rn = IFIELD(16,4);
+  uint32 rd = IFIELD(12,4);
+  int writeback = (!SDT_P(N)) || SDT_W(N);
+  uint32 imm = 0;
+  if(rd == 15) { return NULL; }
+  if(rn == 15 && writeback) { return NULL; }
+  outp = jit_get(outp, X86_EBP, rn, pc);
+  //
+  // Offset: an immediate, or to R12D
+  //
+  if(!SDT_I(N)) {
+    imm = insword & 0xFFF;
+  } else {
+    uint32 shiftby = IFIELD(7,5);
+    uint32 type = IFIELD(5,2);
+    outp = jit_get(outp, X86_ECX, IFIELD(0,4), pc);
+    if((insword & 0xFF0) == 0x060) {
+      // RRX
+      C(0x8B) C(0x83) C32(STATEOFS(cpsr))         // mov eax,[rbx+<OFS32:cpsr>]
+      C(0xC1) C(0xE0) C(0x02)                     // shl eax,2
+      C(0x25) C32(0x80000000)                     // and eax,80000000h
+      C(0xD1) C(0xE9)                             // shr ecx,1
+      C(0x09) C(0xC1)                             // or ecx,eax
+    } else if(shiftby == 0 && type != 0) {
+      // a shift by 32 is left to the interpreter
+      return NULL;
+    } else if(shiftby) {
+      switch(type) {
+      case 0: C(0xC1) C(0xE1) C(shiftby) break;   // shl ecx,n
+      case 1: C(0xC1) C(0xE9) C(shiftby) break;   // shr ecx,n
+      case 2: C(0xC1) C(0xF9) C(shiftby) break;   // sar ecx,n
+      case 3: C(0xC1) C(0xC9) C(shiftby) break;   // ror ecx,n
+      }
+    }
+    C(0x41) C(0x89) C(0xCC)                       // mov r12d,ecx
+  }
+#define SDT_OFFSET                                                           \
+  if(!SDT_I(N)) {                                                            \
+    if(imm) {                                                                \
+      C(0x81) C(SDT_U(N) ? 0xC5 : 0xED) C32(imm)  /* add/sub ebp,imm32 */    \
+    }                                                                        \
+  } else {                                                                   \
+    C(0x44) C(SDT_U(N) ? 0x01 : 0x29) C(0xE5)     /* add/sub ebp,r12d */     \
+  }
+  if(SDT_P(N)) { SDT_OFFSET }
+  C(0x89) C(0xEE)                                 // mov esi,ebp
+  if(SDT_L(N)) {
+    outp = jit_load(outp, SDT_B(N));
+    outp = jit_put(outp, X86_EAX, rd);
+  } else {
+    outp = jit_get(outp, X86_EDX, rd, pc);
+    outp = jit_store(outp, SDT_B(N));
+  }
+  if(!SDT_P(N)) { SDT_OFFSET }
+#undef SDT_OFFSET
+  if(writeback) { outp = jit_put(outp, X86_EBP, rn); }
+  return outp;
+}
+
+//
+// A block data transfer, or NULL if the interpreter has to do it
+//
+static uint8 *jit_bdt(uint8 *outp, uint32 insword, uint32 pc) {
+  uint32 N = (insword >> 20) & 0xFF;
+  uint32 rn = IFIELD(16,4);
+  sint32 r, rend, rstep;
+  sint32 offset = 0;
+  if(BDT_S(N) || (insword & 0x8000) || rn == 15) { return NULL; }
+  outp = jit_get(outp, X86_EBP, rn, pc);
+  if(BDT_U(N)) { r = 0; rend = 16; rstep = 1; } else { r = 15; rend = -1; rstep = -1; }
+  for(; r != rend; r += rstep) if((insword >> r) & 1) {
+    if(BDT_P(N)) { offset += BDT_U(N) ? 4 : -4; }
+    C(0x8D) C(0xB5) C32(offset)                   // lea esi,[rbp+offset]
+    if(BDT_L(N)) {
+      outp = jit_load(outp, 0);
+      outp = jit_put(outp, X86_EAX, r);
+    } else {
+      outp = jit_get(outp, X86_EDX, r, pc);
+      outp = jit_store(outp, 0);
+    }
+    if(!BDT_P(N)) { offset += BDT_U(N) ? 4 : -4; }
+  }
+  if(BDT_W(N)) {
+    C(0x8D) C(0x85) C32(offset)                   // lea eax,[rbp+offset]
+    outp = jit_put(outp, X86_EAX, rn);
+  }
+  return outp;
+}
+
+static int jit_ends_block(uint32 insword) {
+  return ((insword >> 25) & 7) == 5; // B, BL
+}
+
+//
+// Compile n instructions at pc
+//
+static uint8 *jit_emit(uint8 *outp, const uint32 *ins, uint32 pc, uint32 n) {
+  uint32 pending = 0; // instructions whose cycles aren't in cycles_remaining yet
+  uint32 i;
+  //
+  // Prefix
+  //
+  C(0x53)                                         // push rbx
+  C(0x55)                                         // push rbp
+  C(0x41) C(0x54)                                 // push r12
+  C(0x48) C(0x89) C(0xFB)                         // mov rbx,rdi
+  for(i = 0; i < n; i++, pc += 4) {
+    uint32 insword = ins[i];
+    uint32 cond = insword >> 28;
+    uint32 cls = (insword >> 25) & 7;
+    uint8 *skip = NULL;
+    uint8 *body;
+    // never executes
+    if(cond == 0xF) { pending++; continue; }
+    //
+    // B, BL
+    //
+    if(cls == 5) {
+      uint32 target = pc + 8 + (((sint32)(insword << 8)) >> 6);
+      if(cond != 0xE) { outp = jit_cond(outp, cond, &skip); }
+      if(insword & 0x01000000) {
+        C(0xC7) C(0x83) C32(REGOFS(14)) C32(pc + 4) // mov dword [rbx+<OFS32:r14>],pc+4
+      }
+      outp = jit_exit(outp, target, pending + 1);
+      if(skip) {
+        L32(skip)
+        outp = jit_exit(outp, pc + 4, pending + 1);
+      }
+      return outp;
+    }
+    //
+    // Data processing: nothing here calls out
+    //
+    if(cls < 2) {
+      body = outp;
+      if(cond != 0xE) { outp = jit_cond(outp, cond, &skip); }
+      outp = jit_data(outp, insword, pc);
+      if(outp) {
+        if(skip) { L32(skip) }
+        pending++;
+        continue;
+      }
+      outp = body;
+      skip = NULL;
+    }
+    //
+    // Anything else may call out, so bring the cycle count up to date
+    //
+    if(pending) {
+      C(0x81) C(0xAB) C32(STATEOFS(cycles_remaining)) C32(2 * pending) // sub dword [rbx+<OFS32:cycles>],2n
+      pending = 0;
+    }
+    if(cls == 2 || cls == 3 || cls == 4) {
+      body = outp;
+      if(cond != 0xE) { outp = jit_cond(outp, cond, &skip); }
+      outp = (cls == 4) ? jit_bdt(outp, insword, pc) : jit_sdt(outp, insword, pc);
+      if(outp) {
+        if(skip) { L32(skip) }
+        outp = jit_check(outp, pc, !((insword >> 20) & 1));
+        continue;
+      }
+      outp = body;
+      skip = NULL;
+    }
+    //
+    // Interpreter's handler
+    //
+    {
+      uint8 *join, *ex1, *ex2, *cont, *synced;
+      C(0xC7) C(0x83) C32(REGOFS(15)) C32(pc)     // mov dword [rbx+<OFS32:r15>],pc
+      if(cond != 0xE) { outp = jit_cond(outp, cond, &skip); }
+      C(0xBE) C32(insword)                        // mov esi,insword
+      outp = jit_call(outp, (void*)(inscalltable[(insword >> 20) & 0xFF]));
+      // the handler may have left the flags lazy
+      C(0x80) C(0xBB) C32(STATEOFS(flag_mode)) C(FLAGS_CPSR) // cmp byte [rbx+<OFS32:flag_mode>],0
+      J8(0x74, synced)                            // je synced
+      outp = jit_call(outp, (void*)jit_flags);
+      L8(synced)
+      if(skip) {
+        J8(0xEB, join)                            // jmp join
+        L32(skip)
+        C(0xC7) C(0x83) C32(REGOFS(15)) C32(pc + 4) // mov dword [rbx+<OFS32:r15>],pc+4
+        L8(join)
+      }
+      C(0x83) C(0xAB) C32(STATEOFS(cycles_remaining)) C(2) // sub dword [rbx+<OFS32:cycles>],2
+      J8(0x7E, ex1)                               // jle exit
+      C(0x80) C(0xBB) C32(STATEOFS(code_stale)) C(0) // cmp byte [rbx+<OFS32:code_stale>],0
+      J8(0x75, ex2)                               // jne exit
+      C(0x81) C(0xBB) C32(REGOFS(15)) C32(pc + 4) // cmp dword [rbx+<OFS32:r15>],pc+4
+      J8(0x74, cont)                              // je cont
+      L8(ex1)
+      L8(ex2)
+      outp = jit_epilogue(outp);
+      L8(cont)
+    }
+  }
+  return jit_exit(outp, pc, pending);
+}
+
+//
+// Find or compile the block at the PC, or NULL to interpret
+//
+static struct JIT_BLOCK *jit_lookup(struct ARM_STATE *state, struct JITPOOL_SLOT *slot) {
+  uint32 pc = state->r[15];
+  struct JIT_BLOCK *b = slot->block + ((pc >> 2) & (ARM_JIT_BLOCKS - 1));
+  uint8 *page, *code, *outp;
+  const uint32 *ins;
+  struct ARM_BLOCK *d = state->block + ((pc >> 2) & (ARM_BLOCKS - 1));
+  uint32 n, max, a, lo, hi;
+  if(b->code && b->pc == pc) {
+    // not if any of it is on a page still open for writing
+    if((uint32)(b->code - slot->code) + b->size > slot->open) { return NULL; }
+    return b;
+  }
+  //
+  // Only compile code that's stayed put for a while.  Code that keeps
+  // getting stored over would otherwise be recompiled every time around.
+  //
+  if(!(d->n && d->pc == pc && d->runs >= ARM_JIT_RUNS)) { return NULL; }
+  page = PAGE_LOAD(pc);
+  if(!page) { return NULL; }
+  ins = (const uint32*)(page + (pc & ARM_PAGE_MASK));
+  max = (ARM_PAGE_SIZE - (pc & ARM_PAGE_MASK)) / 4;
+  if(max > ARM_JIT_BLOCK_MAX) { max = ARM_JIT_BLOCK_MAX; }
+  for(n = 0; n < max; ) {
+    if(jit_ends_block(ins[n++])) { break; }
+  }
+  jitpool_enter();
+  if(jitpool_failed) { jitpool_leave(); return NULL; }
+  if(slot->used + JITPOOL_HEADROOM > JITPOOL_SLOT_SIZE) { jitpool_flush(state, slot); }
+  jitpool_leave();
+  //
+  // Open the pages the block can land in for writing, unless this run
+  // already has.  jit_end makes the ones that got code executable again;
+  // pages past the end of it stay writable until later blocks fill them.
+  //
+  code = slot->code;
+  lo = slot->used & (~(JITPOOL_PAGE - 1));
+  hi = (slot->used + JITPOOL_HEADROOM + JITPOOL_PAGE - 1) & (~(JITPOOL_PAGE - 1));
+  if(lo < slot->open || hi > slot->open_end) {
+    if(mprotect(code + lo, hi - lo, PROT_READ | PROT_WRITE)) { return NULL; }
+    // below the window only when the slot was just emptied; what was open
+    // before has no code left in it and can stay as it is
+    if(lo < slot->open) { slot->open = lo; }
+    slot->open_end = hi;
+  }
+  outp = jit_emit(code + slot->used, ins, pc, n);
+  b->pc = pc;
+  b->n = n;
+  b->code = code + slot->used;
+  b->size = (uint32)(outp - b->code);
+  slot->used = ((uint32)(outp - code) + 15) & (~15);
+  for(a = pc & (~63); a < pc + 4 * n; a += 64) {
+    state->code_bits[a >> 11] |= 1 << ((a >> 6) & 31);
+  }
+  jitpool_enter();
+  jitpool_touch(state, slot);
+  jitpool_leave();
+  // runs from the next arm_execute on
+  return NULL;
+}
+
+#undef C
+#undef C32
+#undef C64
+#undef J8
+#undef L8
+#undef J32
+#undef L32
+
+#endif
+
+void EMU_CALL arm_enable_jit(void *state, uint8 enable) {
+#ifdef ARM_JIT
+  ARMSTATE->jit_enabled = (enable != 0);
+#endif
+}
+
+void EMU_CALL arm_memory_written(void *state, uint32 x, uint32 y) {
+  code_forget(ARMSTATE, x, y);
+}
+
+void EMU_CALL arm_jit_shutdown(void) {
+#ifdef ARM_JIT
+  jitpool_enter();
+  jitpool_release();
+  jitpool_leave();
+#endif
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Bring the hardware up to now, ask it for the FIQ line, take the FIQ if it's
+// unmasked, and run up to the next point where the line might change
+//
+static void interrupt_check(struct ARM_STATE *state) {
+  sint32 left;
+  uint32 until = 1;
+  uint8 fiq;
+  hw_sync(state);
+  left = state->cycles_remaining + state->cycles_deferred;
+  state->cycles_remaining_last_checkpoint = left;
+  state->cycles_remaining = left;
+  state->cycles_deferred = 0;
+  fiq = state->interrupt(state->hwstate, &until);
+  if(fiq && (state->cpsr & PSR_FIQMASK) == 0) {
+    exception(state, EXCEPTION_FIQ);
+    state->cycles_remaining -= 2;
+    pcchanged(state);
+  }
+  if(until < 1) { until = 1; }
+  if(state->cycles_remaining > 0 && ((uint32)(state->cycles_remaining)) > until) {
+    state->cycles_deferred = state->cycles_remaining - ((sint32)until);
+    state->cycles_remaining_last_checkpoint -= state->cycles_deferred;
+    state->cycles_remaining = (sint32)until;
+  }
+}
+
 /////////////////////////////////////////////////////////////////////////////
 //
 // Returns 0 or positive on success
@@ -955,6 +2492,10 @@ static inscallback inscalltable[256] = {
 //
 sint32 EMU_CALL arm_execute(void *state, sint32 cycles, uint8 fiq) {
   uint32 instruction;
+  struct ARM_BLOCK *block;
+#ifdef ARM_JIT
+  struct JITPOOL_SLOT *slot;
+#endif
 //cycles=1;
   //
   // a lot of checks are done here at the beginning.
@@ -971,12 +2512,14 @@ sint32 EMU_CALL arm_execute(void *state, sint32 cycles, uint8 fiq) {
 
   ARMSTATE->cycles_remaining_last_checkpoint = cycles;
   ARMSTATE->cycles_remaining = cycles;
+  ARMSTATE->cycles_deferred = 0;
 
   //
   // check for pending interrupts
   //
-  // if FIQ unmasked:
-  if((ARMSTATE->cpsr & PSR_FIQMASK) == 0) {
+  if(ARMSTATE->interrupt) {
+    interrupt_check(ARMSTATE);
+  } else if((ARMSTATE->cpsr & PSR_FIQMASK) == 0) {
     // if there's a FIQ set and we can enter it, do so
     if(fiq) {
       exception(ARMSTATE, EXCEPTION_FIQ);
@@ -989,7 +2532,43 @@ sint32 EMU_CALL arm_execute(void *state, sint32 cycles, uint8 fiq) {
   //
   ARMSTATE->maxpc = 0;
 
-  while(ARMSTATE->cycles_remaining > 0) {
+#ifdef ARM_JIT
+  slot = jit_begin(ARMSTATE);
+  ARMSTATE->jit_run = slot;
+#endif
+
+  for(;;) {
+    //
+    // At the end of a stretch, check interrupts if there's more of the slice
+    //
+    if(ARMSTATE->cycles_remaining <= 0) {
+      if(ARMSTATE->cycles_deferred <= 0) { break; }
+      interrupt_check(ARMSTATE);
+      continue;
+    }
+#ifdef ARM_JIT
+    //
+    // Run a compiled block if the interpreter would have run all of it.
+    // If not, we're near the end of the stretch and interpret the rest.
+    //
+    if(slot) {
+      struct JIT_BLOCK *b = jit_lookup(ARMSTATE, slot);
+      if(b && ARMSTATE->cycles_remaining > 2 * (((sint32)(b->n)) - 1)) {
+        ARMSTATE->code_stale = 0;
+        // compiled code keeps the flags in cpsr
+        flags_sync(ARMSTATE);
+        ((void (*)(struct ARM_STATE*))(b->code))(ARMSTATE);
+        ARMSTATE->maxpc = 0;
+        continue;
+      }
+    }
+#endif
+    block = block_lookup(ARMSTATE);
+    if(block) {
+      block_run(ARMSTATE, block);
+      ARMSTATE->maxpc = 0;
+      continue;
+    }
 //armsubtimeon();
    // hw_sync(state);
 
@@ -1003,7 +2582,7 @@ sint32 EMU_CALL arm_execute(void *state, sint32 cycles, uint8 fiq) {
 //printf("%08X: %08X\n",ARMSTATE->r[15], instruction);
 
     // instruction may be skipped due to condition
-    if(!condtable[(instruction >> 28) + ((ARMSTATE->cpsr) >> 24)]) {
+    if((instruction >> 28) != 0xE && !flags_cond(ARMSTATE, instruction >> 28)) {
       ARMSTATE->r[15] += 4;
       ARMSTATE->cycles_remaining -= 2;
       continue;
@@ -1015,9 +2594,15 @@ sint32 EMU_CALL arm_execute(void *state, sint32 cycles, uint8 fiq) {
     ARMSTATE->cycles_remaining -= 2;
   }
 
+#ifdef ARM_JIT
+  ARMSTATE->jit_run = NULL;
+  if(slot) { jit_end(ARMSTATE, slot); }
+#endif
+
   //
   // finishing sync
   //
+  flags_sync(ARMSTATE);
   hw_sync(state);
 
   if(ARMSTATE->badinsflag) { return -1; }
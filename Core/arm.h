@@ -20,6 +20,7 @@ void   EMU_CALL arm_clear_state(void *state);
 typedef uint32 (EMU_CALL * arm_load_callback_t   )(void *hwstate, uint32 a,           uint32 dmask);
 typedef void   (EMU_CALL * arm_store_callback_t  )(void *hwstate, uint32 a, uint32 d, uint32 dmask);
 typedef void   (EMU_CALL * arm_advance_callback_t)(void *hwstate, uint32 cycles);
+typedef uint8  (EMU_CALL * arm_interrupt_callback_t)(void *hwstate, uint32 *cycles);
 
 struct ARM_MEMORY_TYPE { uint32 mask, n; void *p; };
 struct ARM_MEMORY_MAP { uint32 x, y; struct ARM_MEMORY_TYPE type; };
@@ -31,11 +32,28 @@ void EMU_CALL arm_set_memory_maps(
   struct ARM_MEMORY_MAP *map_load,
   struct ARM_MEMORY_MAP *map_store
 );
+//
+// Call if any entries in the registered maps are changed in place, with the
+// range of addresses they covered before or cover now (inclusive)
+//
+void EMU_CALL arm_memory_maps_changed(void *state, uint32 x, uint32 y);
 void EMU_CALL arm_set_advance_callback(
   void *state,
   arm_advance_callback_t advance,
   void *hwstate
 );
+//
+// Optional.  The interrupt callback gets the same hwstate, already advanced
+// to the current cycle, and returns the FIQ line; it sets *cycles to how
+// long until the line might change by itself (at least 1).  It's asked
+// again after that many cycles, so one arm_execute can run a long slice and
+// still take each FIQ on time.  Call arm_interrupt_changed from a load or
+// store callback if the line or that deadline changed.
+//
+void EMU_CALL arm_set_interrupt_callback(
+  void *state,
+  arm_interrupt_callback_t interrupt
+);
 
 #define ARM_REG_GEN      ( 0)
 #define ARM_REG_CPSR     (16)
@@ -46,12 +64,38 @@ uint32 EMU_CALL arm_getreg(void *state, sint32 regnum);
 void   EMU_CALL arm_setreg(void *state, sint32 regnum, uint32 value);
 
 void   EMU_CALL arm_break(void *state);
+void   EMU_CALL arm_interrupt_changed(void *state);
+
+//
+// The x86-64 recompiler, where it's built, is on by default.  Call
+// arm_memory_written after writing guest memory from outside (inclusive
+// range) so code decoded or compiled from it is dropped; stores by the ARM
+// itself are tracked.
+//
+// Compiled code lives in a process-wide pool of 2MB slots, one per state,
+// made as states first run.  Past ARM_JIT_SLOTS of them (define it when
+// building arm.c to change it), the state whose code ran least recently
+// loses it to the new one; a state that finds every slot in use by a
+// running arm_execute interprets.  A state cleared at the same address
+// gets its old slot again.
+//
+// arm_jit_shutdown gives every slot back; call it only while no
+// arm_execute is running.  States keep working and make new slots as they
+// run again.
+//
+#ifndef ARM_JIT_SLOTS
+#define ARM_JIT_SLOTS (64)
+#endif
+void   EMU_CALL arm_enable_jit(void *state, uint8 enable);
+void   EMU_CALL arm_memory_written(void *state, uint32 x, uint32 y);
+void   EMU_CALL arm_jit_shutdown(void);
 
 //
 // Returns 0 or positive on success
 // Returns negative on error
 // (value is otherwise meaningless for now)
 // Performs all advance calls according to how many cycles it actually executed
+// fiq is only used when there's no interrupt callback
 //
 sint32 EMU_CALL arm_execute(void *state, sint32 cycles, uint8 fiq);
 
@@ -59,13 +59,16 @@ uint32 EMU_CALL dcsound_get_state_size(void) {
   offset += sizeof(struct ARM_MEMORY_MAP) * dcsound_map_load_entries;
   offset += sizeof(struct ARM_MEMORY_MAP) * dcsound_map_store_entries;
   offset += arm_get_state_size();
+  offset = EMU_STATE_ALIGN(offset);
   offset += yam_get_state_size(2);
   offset += 0x800000;
   return offset;
 }
 
 static void recompute_memory_maps(struct DCSOUND_STATE *state);
+static void update_ram_watch(struct DCSOUND_STATE *state);
 static void EMU_CALL dcsound_advance(void *state, uint32 elapse);
+static uint8 EMU_CALL dcsound_interrupt(void *state, uint32 *cycles);
 
 void EMU_CALL dcsound_clear_state(void *state) {
   uint32 offset;
@@ -78,6 +81,7 @@ void EMU_CALL dcsound_clear_state(void *state) {
   DCSOUNDSTATE->offset_to_map_load  = offset; offset += sizeof(struct ARM_MEMORY_MAP) * dcsound_map_load_entries;
   DCSOUNDSTATE->offset_to_map_store = offset; offset += sizeof(struct ARM_MEMORY_MAP) * dcsound_map_store_entries;
   DCSOUNDSTATE->offset_to_arm       = offset; offset += arm_get_state_size();
+  offset = EMU_STATE_ALIGN(offset);
   DCSOUNDSTATE->offset_to_yam       = offset; offset += yam_get_state_size(2);
   DCSOUNDSTATE->offset_to_ram       = offset; offset += 0x800000;
 
@@ -90,6 +94,7 @@ void EMU_CALL dcsound_clear_state(void *state) {
 
   arm_clear_state(ARMSTATE);
   arm_set_advance_callback(ARMSTATE, dcsound_advance, DCSOUNDSTATE);
+  arm_set_interrupt_callback(ARMSTATE, dcsound_interrupt);
   arm_set_memory_maps(ARMSTATE, MAPLOAD, MAPSTORE);
 
   yam_clear_state(YAMSTATE, 2);
@@ -102,6 +107,7 @@ void EMU_CALL dcsound_clear_state(void *state) {
   yam_aica_store_reg(YAMSTATE, 0x28A8, 0x0018, 0xFFFF, NULL);
   yam_aica_store_reg(YAMSTATE, 0x28AC, 0x0050, 0xFFFF, NULL);
   yam_aica_store_reg(YAMSTATE, 0x28B0, 0x0008, 0xFFFF, NULL);
+  update_ram_watch(DCSOUNDSTATE);
 
   DCSOUNDSTATE->myself = DCSOUNDSTATE;
   // Done
@@ -154,8 +160,10 @@ static void location_check(struct DCSOUND_STATE *state) {
   if(state->myself != state) {
     recompute_memory_maps(state);
     arm_set_advance_callback(ARMSTATE, dcsound_advance, DCSOUNDSTATE);
+    arm_set_interrupt_callback(ARMSTATE, dcsound_interrupt);
     arm_set_memory_maps(ARMSTATE, MAPLOAD, MAPSTORE);
     yam_setram(YAMSTATE, (uint32*)(RAMBYTEPTR), 0x800000, EMU_ENDIAN_XOR(3), EMU_ENDIAN_XOR(2));
+    update_ram_watch(state);
     state->myself = state;
   }
 }
@@ -184,8 +192,29 @@ static void EMU_CALL dcsound_yam_sw(void *state, uint32 a, uint32 d, uint32 mask
   uint8 b = 0;
   timeswitch(DCSOUNDSTATE, TIMEYAM);
   yam_aica_store_reg(YAMSTATE, a, d, mask, &b);
+  // a key-on may have cached more of RAM
+  update_ram_watch(DCSOUNDSTATE);
+  timeswitch(DCSOUNDSTATE, TIMEARM);
+  if(b) arm_interrupt_changed(ARMSTATE);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// RAM stores inside the Yamaha watch range
+// (CALLBACK)
+//
+// The watch range is left as it is here; it only grows on a key-on, which
+// updates it, and one that's wider than needed just costs extra callbacks
+// until the next register store or dcsound_execute narrows it
+//
+static void EMU_CALL dcsound_ram_sw(void *state, uint32 a, uint32 d, uint32 mask) {
+  uint32 *p;
+  a &= ~3;
+  p = (uint32*)(RAMBYTEPTR + a);
+  *p = ((*p) & (~mask)) | (d & mask);
+  timeswitch(DCSOUNDSTATE, TIMEYAM);
+  yam_invalidate_ram(YAMSTATE, a, 4);
   timeswitch(DCSOUNDSTATE, TIMEARM);
-  if(b) arm_break(ARMSTATE);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -235,7 +264,7 @@ static void EMU_CALL dcsound_advance(void *state, uint32 elapse) {
 //
 // Determine how many cycles until the next interrupt
 //
-// This is then used as an upper bound for how many cycles can be executed
+// This is then used as an upper bound for how many cycles the ARM can execute
 // before checking for futher interrupts
 //
 static uint32 cycles_until_next_interrupt(
@@ -252,6 +281,21 @@ static uint32 cycles_until_next_interrupt(
   return yamcycles - state->cycles_ahead_of_sound;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+//
+// Report the FIQ line and when to ask again
+// (CALLBACK)
+//
+static uint8 EMU_CALL dcsound_interrupt(void *state, uint32 *cycles) {
+  uint8 fiq;
+  timeswitch(DCSOUNDSTATE, TIMEDCSOUND);
+  *cycles = cycles_until_next_interrupt(DCSOUNDSTATE);
+  timeswitch(DCSOUNDSTATE, TIMEYAM);
+  fiq = (*(yam_get_interrupt_pending_ptr(YAMSTATE))) != 0;
+  timeswitch(DCSOUNDSTATE, TIMEARM);
+  return fiq;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 //
 // Invalid-address catchers
@@ -272,6 +316,7 @@ static const struct ARM_MEMORY_MAP dcsound_map_load[] = {
 };
 
 static const struct ARM_MEMORY_MAP dcsound_map_store[] = {
+  { 0xFFFFFFFF, 0x00000000, { 0x007FFFFF, ARM_MAP_TYPE_CALLBACK, dcsound_ram_sw               } },
   { 0x00000000, 0x007FFFFF, { 0x007FFFFF, ARM_MAP_TYPE_POINTER , NULL } },
   { 0x00800000, 0x0080FFFF, { 0x0000FFFF, ARM_MAP_TYPE_CALLBACK, dcsound_yam_sw               } },
   { 0x00000000, 0xFFFFFFFF, { 0xFFFFFFFF, ARM_MAP_TYPE_CALLBACK, catcher_sw                   } }
@@ -302,10 +347,34 @@ static void recompute_memory_maps(struct DCSOUND_STATE *state) {
   memcpy(mapload , dcsound_map_load , sizeof(dcsound_map_load ));
   memcpy(mapstore, dcsound_map_store, sizeof(dcsound_map_store));
   //
-  // Now perform state offsets on first entry in each map
+  // Now perform state offsets on the RAM entry in each map
+  // (the first store entry is the Yamaha watch range, empty for now)
   //
   mapload [0].type.p = RAMBYTEPTR;
-  mapstore[0].type.p = RAMBYTEPTR;
+  mapstore[1].type.p = RAMBYTEPTR;
+}
+
+//
+// Point the watch range entry in the store map at whatever part of RAM the
+// Yamaha currently has cached, so stores there go through dcsound_ram_sw
+//
+static void update_ram_watch(struct DCSOUND_STATE *state) {
+  struct ARM_MEMORY_MAP *mapstore = MAPSTORE;
+  uint32 start, end, oldx, oldy;
+  if(!yam_get_ram_watch(YAMSTATE, &start, &end)) {
+    start = 0xFFFFFFFF;
+    end   = 0x00000000;
+  }
+  oldx = mapstore[0].x;
+  oldy = mapstore[0].y;
+  if(start == oldx && end == oldy) return;
+  mapstore[0].x = start;
+  mapstore[0].y = end;
+  //
+  // The ARM page table has to follow
+  //
+  arm_memory_maps_changed(ARMSTATE, oldx, oldy);
+  arm_memory_maps_changed(ARMSTATE, start, end);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -328,7 +397,6 @@ sint32 EMU_CALL dcsound_execute(
   uint32 *sound_samples
 ) {
   sint32 error = 0;
-  uint8 *yamintptr;
   //
   // If we have a bogus cycle count, return error
   //
@@ -341,6 +409,7 @@ sint32 EMU_CALL dcsound_execute(
   // Ensure location invariance
   //
   location_check(DCSOUNDSTATE);
+  update_ram_watch(DCSOUNDSTATE);
   //
   // Cap to sane values to avoid overflow problems
   //
@@ -354,12 +423,6 @@ sint32 EMU_CALL dcsound_execute(
   timeswitch(DCSOUNDSTATE, TIMEDCSOUND);
   DCSOUNDSTATE->sound_samples_remaining = *sound_samples;
   //
-  // Get the interrupt pending pointer
-  //
-  timeswitch(DCSOUNDSTATE, TIMEYAM);
-  yamintptr = yam_get_interrupt_pending_ptr(YAMSTATE);
-  timeswitch(DCSOUNDSTATE, TIMEDCSOUND);
-  //
   // Zero out these counters
   //
   DCSOUNDSTATE->cycles_executed = 0;
@@ -377,15 +440,15 @@ sint32 EMU_CALL dcsound_execute(
   }
   //
   // Execution loop
+  // (the ARM asks dcsound_interrupt for the FIQ line as it goes, so this
+  // normally only goes around once)
   //
   while(DCSOUNDSTATE->cycles_executed < cycles) {
     sint32 r;
     uint32 remain = cycles - DCSOUNDSTATE->cycles_executed;
-    uint32 ci = cycles_until_next_interrupt(DCSOUNDSTATE);
-    if(remain > ci) { remain = ci; }
     if(remain > 0x1000000) { remain = 0x1000000; }
     timeswitch(DCSOUNDSTATE, TIMEARM);
-    r = arm_execute(ARMSTATE, remain, (*yamintptr) != 0);
+    r = arm_execute(ARMSTATE, remain, 0);
     timeswitch(DCSOUNDSTATE, TIMEDCSOUND);
     if(r < 0) { error = -1; break; }
   }
@@ -420,6 +483,9 @@ uint32 EMU_CALL dcsound_getword(void *state, uint32 a) {
 
 void EMU_CALL dcsound_setword(void *state, uint32 a, uint32 d) {
   *((uint32*)(RAMBYTEPTR+(a&0x7FFFFC))) = d;
+  yam_invalidate_ram(YAMSTATE, a & 0x7FFFFC, 4);
+  arm_memory_written(ARMSTATE, a & 0x7FFFFC, (a & 0x7FFFFC) + 3);
+  update_ram_watch(DCSOUNDSTATE);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -437,6 +503,16 @@ void EMU_CALL dcsound_upload_to_ram(
     (RAMBYTEPTR)[((address+i)^(EMU_ENDIAN_XOR(3)))&0x7FFFFF] =
       ((uint8*)src)[i];
   }
+  yam_invalidate_ram(YAMSTATE, address & 0x7FFFFF, len);
+  if(len) {
+    if((address & 0x7FFFFF) + len > 0x800000) {
+      // wrapped
+      arm_memory_written(ARMSTATE, 0, 0x7FFFFF);
+    } else {
+      arm_memory_written(ARMSTATE, address & 0x7FFFFF, (address & 0x7FFFFF) + len - 1);
+    }
+  }
+  update_ram_watch(DCSOUNDSTATE);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -96,6 +96,12 @@
 // deprecated
 #define EMU_ENDIAN_XOR(x) EMU_ENDIAN_XOR_L2H(x)
 
+//
+// Substates start on this boundary inside their parent, so a state the host
+// allocates 64-byte aligned keeps every substate aligned too
+//
+#define EMU_STATE_ALIGN(n) (((n) + 63) & ~63)
+
 /////////////////////////////////////////////////////////////////////////////
 
 #endif
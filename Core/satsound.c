@@ -85,6 +85,7 @@ uint32 EMU_CALL satsound_get_state_size(void) {
 #else
   offset += sizeof(c68k_struc);
 #endif
+  offset = EMU_STATE_ALIGN(offset);
   offset += yam_get_state_size(1);
   offset += 0x80000 + 2*RAMSLOP;
   return offset;
@@ -212,6 +213,7 @@ void EMU_CALL satsound_clear_state(void *state) {
   SATSOUNDSTATE->offset_to_maps      = offset;
   SATSOUNDSTATE->offset_to_scpu      = offset; offset += sizeof(c68k_struc);
 #endif
+  offset = EMU_STATE_ALIGN(offset);
   SATSOUNDSTATE->offset_to_yam       = offset; offset += yam_get_state_size(1);
   SATSOUNDSTATE->offset_to_ram       = offset; offset += 0x80000 + 2*RAMSLOP;
 
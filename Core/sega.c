@@ -137,6 +137,7 @@ uint32 EMU_CALL sega_get_state_size(uint8 version) {
   uint32 size = 0;
   if(version != 2) version = 1;
   size += sizeof(struct SEGA_STATE);
+  size = EMU_STATE_ALIGN(size);
 #ifndef DISABLE_SSF
   if(version == 1) size += satsound_get_state_size();
 #endif
@@ -156,7 +157,7 @@ void EMU_CALL sega_clear_state(void *state, uint8 version) {
   // Clear local struct
   memset(state, 0, sizeof(struct SEGA_STATE));
   // Set up offsets
-  offset = sizeof(struct SEGA_STATE);
+  offset = EMU_STATE_ALIGN(sizeof(struct SEGA_STATE));
 #ifndef DISABLE_SSF
   if(version == 1) { SEGASTATE->offset_to_satsound = offset; offset += satsound_get_state_size(); }
 #endif
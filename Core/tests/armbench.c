@@ -0,0 +1,163 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// armbench - Times the ARM core over a load/store-heavy guest loop
+//
+// The loop does word, byte and block loads and stores to RAM, with the
+// usual memory map around it: a watched store window ahead of RAM,
+// callback registers and a catch-all.  The "deep" scenarios put 16 more
+// regions ahead of RAM in both maps, as a machine with many of them
+// would.  Each scenario keeps the best of several runs and prints a hash
+// of the registers and RAM, which must match across builds.
+//
+// Only uses arm.h, so it builds against older trees; for ones from before
+// the recompiler, add -DNO_ARM_JIT to CFLAGS.
+//
+// Usage: armbench [scenario-prefix]
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#include "arm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define RAMSIZE (0x800000)
+#define SLICES  (1000)
+#define CYCLES  (100000)
+#define ROUNDS  (5)
+#define EXTRA   (16)
+
+struct SCENARIO {
+  const char *name;
+  uint8 jit;       // recompiler on
+  uint8 deep;      // EXTRA unused regions ahead of RAM
+};
+
+static const struct SCENARIO scenarios[] = {
+  { "ldst-interp",      0, 0 },
+  { "ldst-deep-interp", 0, 1 },
+#ifndef NO_ARM_JIT
+  { "ldst-jit",         1, 0 },
+  { "ldst-deep-jit",    1, 1 },
+#endif
+  { NULL }
+};
+
+//
+// Loaded at the reset vector
+//
+static const uint32 program[] = {
+  0xE3A00801, // 00: mov r0,#0x10000
+  0xE3A01401, // 04: mov r1,#0x1000000
+  0xE5902000, // 08: ldr r2,[r0]
+  0xE2822001, // 0C: add r2,r2,#1
+  0xE4802004, // 10: str r2,[r0],#4
+  0xE5D03001, // 14: ldrb r3,[r0,#1]
+  0xE5C03002, // 18: strb r3,[r0,#2]
+  0xE89000F0, // 1C: ldmia r0,{r4-r7}
+  0xE88000F0, // 20: stmia r0,{r4-r7}
+  0xE3C00A0F, // 24: bic r0,r0,#0xF000
+  0xE2511001, // 28: subs r1,r1,#1
+  0x1AFFFFF5, // 2C: bne 08
+  0xEAFFFFFE  // 30: b 30
+};
+
+static uint8 *ram;
+
+static struct ARM_MEMORY_MAP mapload[3 + EXTRA], mapstore[4 + EXTRA];
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Callbacks
+//
+static uint32 EMU_CALL reg_load(void *hw, uint32 a, uint32 mask) { return 0; }
+static void EMU_CALL reg_store(void *hw, uint32 a, uint32 d, uint32 mask) { }
+
+static void EMU_CALL watch_store(void *hw, uint32 a, uint32 d, uint32 mask) {
+  uint32 *p = (uint32*)(ram + a);
+  *p = ((*p) & ~mask) | (d & mask);
+}
+
+static void EMU_CALL advance(void *hw, uint32 cycles) { }
+
+/////////////////////////////////////////////////////////////////////////////
+
+static void map(struct ARM_MEMORY_MAP *m, uint32 x, uint32 y, uint32 mask, uint32 n, void *p) {
+  m->x = x; m->y = y; m->type.mask = mask; m->type.n = n; m->type.p = p;
+}
+
+static void setup_maps(uint8 deep) {
+  struct ARM_MEMORY_MAP *l = mapload, *s = mapstore;
+  uint32 i;
+  map(s++, 0x200000, 0x200FFF, RAMSIZE - 1, ARM_MAP_TYPE_CALLBACK, (void*)watch_store);
+  for(i = 0; deep && i < EXTRA; i++) {
+    uint32 x = 0x01000000 + i * 0x100000;
+    map(l++, x, x + 0xFFFF, 0xFFFF, ARM_MAP_TYPE_CALLBACK, (void*)reg_load);
+    map(s++, x, x + 0xFFFF, 0xFFFF, ARM_MAP_TYPE_CALLBACK, (void*)reg_store);
+  }
+  map(l++, 0, RAMSIZE - 1, RAMSIZE - 1, ARM_MAP_TYPE_POINTER, ram);
+  map(s++, 0, RAMSIZE - 1, RAMSIZE - 1, ARM_MAP_TYPE_POINTER, ram);
+  map(l++, 0x800000, 0x80FFFF, 0xFFFF, ARM_MAP_TYPE_CALLBACK, (void*)reg_load);
+  map(s++, 0x800000, 0x80FFFF, 0xFFFF, ARM_MAP_TYPE_CALLBACK, (void*)reg_store);
+  map(l++, 0, 0xFFFFFFFF, 0xFFFFFFFF, ARM_MAP_TYPE_CALLBACK, (void*)reg_load);
+  map(s++, 0, 0xFFFFFFFF, 0xFFFFFFFF, ARM_MAP_TYPE_CALLBACK, (void*)reg_store);
+}
+
+static void run(const struct SCENARIO *sc) {
+  void *state = malloc(arm_get_state_size());
+  double best = 0;
+  uint32 hash = 2166136261u;
+  uint32 i, round;
+
+  if(!state) { printf("%-22s out of memory\n", sc->name); exit(1); }
+  setup_maps(sc->deep);
+
+  for(round = 0; round < ROUNDS; round++) {
+    clock_t c;
+    double t;
+    memset(ram, 0, RAMSIZE);
+    memcpy(ram, program, sizeof(program));
+    arm_clear_state(state);
+    arm_set_advance_callback(state, advance, NULL);
+    arm_set_memory_maps(state, mapload, mapstore);
+#ifndef NO_ARM_JIT
+    arm_enable_jit(state, sc->jit);
+#endif
+    c = clock();
+    for(i = 0; i < SLICES; i++) { arm_execute(state, CYCLES, 0); }
+    t = (double)(clock() - c) / CLOCKS_PER_SEC;
+    if(round == 0 || t < best) { best = t; }
+  }
+
+  for(i = 0; i < ARM_REG_MAX; i++) { hash = (hash ^ arm_getreg(state, i)) * 16777619; }
+  for(i = 0; i < RAMSIZE; i++) { hash = (hash ^ ram[i]) * 16777619; }
+  printf("%-22s %7.3f s %7.1f Mcycles/s  hash %08lX\n",
+    sc->name, best, best > 0 ? (SLICES * (double)CYCLES) / (1e6 * best) : 0.0,
+    (unsigned long)hash
+  );
+
+  free(state);
+}
+
+int main(int argc, char **argv) {
+  const struct SCENARIO *sc;
+  const char *prefix = (argc > 1) ? argv[1] : "";
+  ram = malloc(RAMSIZE);
+  if(!ram) { printf("out of memory\n"); return 1; }
+  if(arm_init()) { printf("arm_init failed\n"); return 1; }
+  for(sc = scenarios; sc->name; sc++) {
+    if(strncmp(sc->name, prefix, strlen(prefix))) { continue; }
+    run(sc);
+  }
+#ifndef NO_ARM_JIT
+  arm_jit_shutdown();
+#endif
+  free(ram);
+  return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,297 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// armdiff - Checks the ARM recompiler against the interpreter
+//
+// Each round writes a random guest program (data processing, multiplies,
+// single and block transfers, branches, MRS/MSR) and runs it on two
+// machines in lock step, one with the recompiler and one without, over
+// slices of random length with the FIQ line raised now and then.  Guest
+// stores land on the program itself, on a watched window of RAM that moves
+// between slices, and on callback registers that sometimes break out of
+// arm_execute.  Registers, CPSR and the callback trace are compared after
+// every slice and RAM at the end of each round.  The recompiled machine's
+// state is also moved to a new address every few slices, and now and then
+// all compiled code is given back with arm_jit_shutdown.
+//
+// Every eighth round instead starts in a loop that keeps storing next to
+// its own code, over long slices, so the loop is compiled again and again
+// and fills the recompiler's pool (made small here) many times over.
+//
+// Builds arm.c in to set up registers.  On hosts without the recompiler
+// both machines interpret, and it passes trivially.
+//
+// Usage: armdiff [rounds]
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#define JITPOOL_SLOT_SIZE (0x40000)
+#include "arm.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define RAMSIZE (0x800000)
+#define PROGEND (0x8000)
+#define SLICES  (200)
+
+//
+// Counts in r1 and stores it into its own 64-byte chunk every 16 times
+// around, which drops the loop's code
+//
+static const uint32 smcloop[] = {
+  0xE3A00901, // 4000: mov r0,#0x4000
+  0xE3A01000, // 4004: mov r1,#0
+  0xE2811001, // 4008: add r1,r1,#1
+  0xE311000F, // 400C: tst r1,#15
+  0x0580103C, // 4010: streq r1,[r0,#0x3C]
+  0xE0822001, // 4014: add r2,r2,r1
+  0xEAFFFFFA  // 4018: b 4008
+};
+
+struct MACHINE {
+  void *state;
+  uint8 *ram;
+  uint32 trace;    // hash of every callback and its arguments
+  uint32 calls;
+  uint32 breakevery;
+  struct ARM_MEMORY_MAP load[3], store[4];
+};
+
+static uint32 rndstate;
+
+static uint32 rnd(void) {
+  rndstate ^= rndstate << 13;
+  rndstate ^= rndstate >> 17;
+  rndstate ^= rndstate << 5;
+  return rndstate;
+}
+
+static void mix(struct MACHINE *m, uint32 v) { m->trace = (m->trace ^ v) * 16777619; }
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Callbacks
+//
+static uint32 EMU_CALL reg_load(void *hw, uint32 a, uint32 mask) {
+  struct MACHINE *m = hw;
+  mix(m, 0x1000 | a); mix(m, mask); m->calls++;
+  return (a * 2654435761u) ^ m->calls;
+}
+
+static void EMU_CALL reg_store(void *hw, uint32 a, uint32 d, uint32 mask) {
+  struct MACHINE *m = hw;
+  mix(m, 0x2000 | a); mix(m, d & mask); mix(m, mask); m->calls++;
+  if(m->breakevery && (m->calls % m->breakevery) == 0) { arm_break(m->state); }
+}
+
+static void EMU_CALL watch_store(void *hw, uint32 a, uint32 d, uint32 mask) {
+  struct MACHINE *m = hw;
+  uint32 *p = (uint32*)(m->ram + a);
+  *p = ((*p) & ~mask) | (d & mask);
+  mix(m, 0x3000 | a); mix(m, d & mask); m->calls++;
+}
+
+static uint32 EMU_CALL stray_load(void *hw, uint32 a, uint32 mask) {
+  mix(hw, 0x4000 | a);
+  return 0xE1A00000; // NOP, in case it's fetched
+}
+
+static void EMU_CALL stray_store(void *hw, uint32 a, uint32 d, uint32 mask) {
+  mix(hw, 0x5000 | a); mix(hw, d & mask);
+}
+
+static void EMU_CALL advance(void *hw, uint32 cycles) { mix(hw, 0x6000 + cycles); }
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Random instruction at pc
+// r9-r12 are kept as pointers: r9 into the program, r10 into data RAM, r11
+// at the callback registers and r12 past the end of RAM.
+//
+static uint32 gen(uint32 pc) {
+  uint32 cond = (rnd() % 3) ? 0xE : (rnd() % 15);
+  uint32 k = rnd() % 100;
+  if(k < 35) { // data processing, with immediate and register shifts
+    uint32 op = rnd() & 0xF, s = rnd() & 1, i = rnd() & 1;
+    uint32 rd = rnd() % 9, rn = rnd() % 13, op2;
+    if(op >= 8 && op <= 11) { s = 1; }
+    if(i) {
+      op2 = rnd() & 0xFFF;
+    } else {
+      op2 = (rnd() & 0xFF0) | (rnd() % 13);
+      if(op2 & 0x10) { op2 &= ~0x80; }
+    }
+    if((rnd() % 16) == 0) { rn = 15; }
+    if(!i && (rnd() % 16) == 0) { op2 = (op2 & ~0xF) | 15; }
+    return (cond << 28) | (i << 25) | (op << 21) | (s << 20) | (rn << 16) | (rd << 12) | op2;
+  }
+  if(k < 40) { // MUL/MLA
+    return (cond << 28) | ((rnd() & 3) << 20) | ((rnd() % 9) << 16) |
+      ((rnd() % 13) << 12) | ((rnd() % 13) << 8) | 0x90 | (rnd() % 13);
+  }
+  if(k < 45) { // reseed or step a pointer
+    static const uint32 imms[4] = { 0x000, 0x801, 0x880, 0x401 };
+    uint32 p = 9 + (rnd() & 3);
+    if(rnd() & 1) {
+      return 0xE2800000 | (p << 16) | (p << 12) | (rnd() & 0xFF) | ((rnd() % 3) ? 0xE00 : 0xC00);
+    }
+    return 0xE3A00000 | (p << 12) | imms[p - 9];
+  }
+  if(k < 70) { // LDR/STR
+    uint32 i = (rnd() % 4) == 0, p = rnd() & 1, u = rnd() & 1, b = rnd() & 1;
+    uint32 w = (rnd() % 4) == 0, l = rnd() & 1;
+    uint32 rn = 9 + (rnd() % 4), rd = rnd() % 9, off;
+    if(rn == 12 && (rnd() & 1)) { rn = 9 + (rnd() % 3); }
+    if(i) { off = ((rnd() & 3) << 7) | (rnd() % 9); }
+    else  { off = (rnd() % 3) ? (rnd() & 0xFFF) : (rnd() & 0x3C); }
+    if(!p) { w = 0; }
+    if(l && !w && p && (rnd() % 8) == 0) { rn = 15; }
+    return (cond << 28) | (1 << 26) | (i << 25) | (p << 24) | (u << 23) | (b << 22) |
+      (w << 21) | (l << 20) | (rn << 16) | (rd << 12) | off;
+  }
+  if(k < 82) { // LDM/STM
+    uint32 p = rnd() & 1, u = rnd() & 1, w = rnd() & 1, l = rnd() & 1;
+    uint32 rn = 9 + (rnd() % 4), list = rnd() & 0x01FF;
+    if(!l && (rnd() % 4) == 0) { list |= 0x4000; }
+    if(!list) { list = 1; }
+    return (cond << 28) | (4 << 25) | (p << 24) | (u << 23) | (w << 21) | (l << 20) | (rn << 16) | list;
+  }
+  if(k < 92) { // B/BL within the program
+    sint32 off = (sint32)(rnd() % 64) - 40;
+    uint32 link = (rnd() % 4) == 0;
+    if(pc + 8 + off * 4 >= PROGEND) { off = -40; }
+    return (cond << 28) | (5 << 25) | (link << 24) | (off & 0xFFFFFF);
+  }
+  if(k < 94) { return (cond << 28) | 0x01A0F00E; } // MOV pc,lr
+  if(k < 96) { return (cond << 28) | 0x010F0000 | ((rnd() % 9) << 12); } // MRS
+  if(k < 98) { return (cond << 28) | 0x0128F000 | (rnd() % 9); } // MSR flags
+  return 0xE3A0EC00 | (rnd() & 0x7F); // MOV lr,#n (inside the program)
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+static struct ARM_STATE *cpu(struct MACHINE *m) { return (struct ARM_STATE*)(m->state); }
+
+static void setup(struct MACHINE *m, uint8 jit, uint32 pc) {
+  struct ARM_MEMORY_MAP *l = m->load, *s = m->store;
+  l[0].x = 0;        l[0].y = RAMSIZE - 1; l[0].type.mask = RAMSIZE - 1; l[0].type.n = ARM_MAP_TYPE_POINTER;  l[0].type.p = m->ram;
+  l[1].x = 0x800000; l[1].y = 0x80FFFF;    l[1].type.mask = 0xFFFF;      l[1].type.n = ARM_MAP_TYPE_CALLBACK; l[1].type.p = (void*)reg_load;
+  l[2].x = 0;        l[2].y = 0xFFFFFFFF;  l[2].type.mask = 0xFFFFFFFF;  l[2].type.n = ARM_MAP_TYPE_CALLBACK; l[2].type.p = (void*)stray_load;
+  s[0].x = 0xFFFFFFFF; s[0].y = 0;         s[0].type.mask = RAMSIZE - 1; s[0].type.n = ARM_MAP_TYPE_CALLBACK; s[0].type.p = (void*)watch_store;
+  s[1].x = 0;        s[1].y = RAMSIZE - 1; s[1].type.mask = RAMSIZE - 1; s[1].type.n = ARM_MAP_TYPE_POINTER;  s[1].type.p = m->ram;
+  s[2].x = 0x800000; s[2].y = 0x80FFFF;    s[2].type.mask = 0xFFFF;      s[2].type.n = ARM_MAP_TYPE_CALLBACK; s[2].type.p = (void*)reg_store;
+  s[3].x = 0;        s[3].y = 0xFFFFFFFF;  s[3].type.mask = 0xFFFFFFFF;  s[3].type.n = ARM_MAP_TYPE_CALLBACK; s[3].type.p = (void*)stray_store;
+  m->trace = 2166136261u;
+  m->calls = 0;
+  arm_clear_state(m->state);
+  arm_set_advance_callback(m->state, advance, m);
+  arm_set_memory_maps(m->state, l, s);
+  arm_enable_jit(m->state, jit);
+  cpu(m)->cpsr = 0x1F | 0x80; // system mode, IRQ masked
+  cpu(m)->r[9] = 0x1000;
+  cpu(m)->r[10] = 0x10000;
+  cpu(m)->r[11] = 0x800000;
+  cpu(m)->r[12] = 0x1000000;
+  cpu(m)->r[14] = 0x200;
+  cpu(m)->r[15] = pc;
+}
+
+//
+// Returns nonzero if the machines differ
+//
+static int compare(struct MACHINE *a, struct MACHINE *b, int ram) {
+  sint32 i;
+  if(a->trace != b->trace) { return 1; }
+  for(i = 0; i < ARM_REG_MAX; i++) {
+    if(arm_getreg(a->state, i) != arm_getreg(b->state, i)) { return 1; }
+  }
+  if(ram && memcmp(a->ram, b->ram, RAMSIZE)) { return 1; }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  uint32 rounds = (argc > 1) ? atoi(argv[1]) : 300;
+  uint32 size = arm_get_state_size();
+  struct MACHINE a, b;
+  void *spare = malloc(size);
+  uint32 round, i, fails = 0;
+  uint8 loop;
+
+  a.state = malloc(size); a.ram = malloc(RAMSIZE);
+  b.state = malloc(size); b.ram = malloc(RAMSIZE);
+  if(!spare || !a.state || !a.ram || !b.state || !b.ram) { printf("out of memory\n"); return 1; }
+  if(arm_init()) { printf("arm_init failed\n"); return 1; }
+
+  for(round = 0; round < rounds; round++) {
+    rndstate = round * 2654435761u + 12345; rnd(); rnd();
+    memset(a.ram, 0, RAMSIZE);
+    for(i = 0; i < PROGEND; i += 4) { *(uint32*)(a.ram + i) = gen(i); }
+    // FIQ vector branches into the program
+    *(uint32*)(a.ram + 0x1C) = 0xEA000000 | ((0x2000 - 0x1C - 8) / 4);
+    for(i = PROGEND; i < 0x20000; i += 4) { *(uint32*)(a.ram + i) = rnd(); }
+    loop = (round % 8) == 7;
+    if(loop) { memcpy(a.ram + 0x4000, smcloop, sizeof(smcloop)); }
+    memcpy(b.ram, a.ram, RAMSIZE);
+    a.breakevery = b.breakevery = (round & 3) ? 0 : 7;
+    setup(&a, 1, loop ? 0x4000 : 0x100);
+    setup(&b, 0, loop ? 0x4000 : 0x100);
+
+    for(i = 0; i < SLICES; i++) {
+      uint8 fiq = !loop && (rnd() % 8) == 0;
+      sint32 cycles = loop ? 100000 : 1 + (rnd() % 3000);
+      sint32 ra, rb;
+      // Move the watched window
+      if((rnd() % 4) == 0) {
+        uint32 ox = a.store[0].x, oy = a.store[0].y, x = 0xFFFFFFFF, y = 0;
+        if(rnd() % 3) {
+          x = (rnd() % 0x20000) & ~3;
+          y = x + ((rnd() % 0x18000) | 3);
+        }
+        a.store[0].x = b.store[0].x = x;
+        a.store[0].y = b.store[0].y = y;
+        arm_memory_maps_changed(a.state, ox, oy); arm_memory_maps_changed(a.state, x, y);
+        arm_memory_maps_changed(b.state, ox, oy); arm_memory_maps_changed(b.state, x, y);
+      }
+      // Rewrite an instruction from outside
+      if(!loop && (rnd() % 16) == 0) {
+        uint32 x = (rnd() % PROGEND) & ~3;
+        uint32 w = gen(x);
+        *(uint32*)(a.ram + x) = w; arm_memory_written(a.state, x, x + 3);
+        *(uint32*)(b.ram + x) = w; arm_memory_written(b.state, x, x + 3);
+      }
+      // Give back all compiled code
+      if((rnd() % 64) == 0) { arm_jit_shutdown(); }
+      // Move the recompiled machine's state
+      if((rnd() % 3) == 0) {
+        void *t = a.state;
+        memcpy(spare, a.state, size);
+        a.state = spare;
+        spare = t;
+      }
+      ra = arm_execute(a.state, cycles, fiq);
+      rb = arm_execute(b.state, cycles, fiq);
+      mix(&a, ra); mix(&b, rb);
+      if(compare(&a, &b, 0)) { break; }
+      if(ra < 0) { break; }
+    }
+    if(compare(&a, &b, 1)) {
+      if(fails < 10) {
+        printf("round %u: differs after slice %u, pc %08X vs %08X\n", round, i,
+          arm_getreg(a.state, 15), arm_getreg(b.state, 15));
+      }
+      fails++;
+    }
+  }
+
+  arm_jit_shutdown();
+  free(spare);
+  free(a.state); free(a.ram);
+  free(b.state); free(b.ram);
+  printf("armdiff: %u/%u rounds differ\n", fails, rounds);
+  return fails != 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
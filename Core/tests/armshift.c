@@ -0,0 +1,144 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// armshift - Checks ARM shifter results against known answers
+//
+// Runs MOVS with each shift type by register counts around 32 (and by 0,
+// 256 and the immediate LSR/ASR #32 forms), and LDR with an LSR/ASR #32
+// scaled offset, and checks the value and the carry flag each one leaves.
+// The answers are the ARM's: counts of 32 and up shift everything out of
+// LSL and LSR, fill with the sign on ASR, and rotate ROR by the count mod
+// 32.  Each case runs once on the interpreter, and on the recompiler often
+// enough to be compiled and then run from compiled code.
+//
+// Builds arm.c in to set up registers.
+//
+// Usage: armshift
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#include "arm.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define RAMSIZE (0x10000)
+
+struct CASE {
+  const char *name;
+  uint32 insword;  // writes r0 from r1, r2 and r3
+  uint32 r1, r2, r3;
+  uint32 cin;      // carry going in
+  uint32 r0, c;    // expected r0 and carry
+};
+
+#define MOVS_LSL (0xE1B00211) // movs r0,r1,lsl r2
+#define MOVS_LSR (0xE1B00231) // movs r0,r1,lsr r2
+#define MOVS_ASR (0xE1B00251) // movs r0,r1,asr r2
+#define MOVS_ROR (0xE1B00271) // movs r0,r1,ror r2
+
+static const struct CASE cases[] = {
+  { "lsl 0",    MOVS_LSL, 0x00000003,   0, 0, 1, 0x00000003, 1 },
+  { "lsl 31",   MOVS_LSL, 0x00000003,  31, 0, 0, 0x80000000, 1 },
+  { "lsl 32",   MOVS_LSL, 0x80000001,  32, 0, 0, 0x00000000, 1 },
+  { "lsl 33",   MOVS_LSL, 0x80000001,  33, 0, 1, 0x00000000, 0 },
+  { "lsl 255",  MOVS_LSL, 0xFFFFFFFF, 255, 0, 1, 0x00000000, 0 },
+  { "lsl 256",  MOVS_LSL, 0x00000005, 256, 0, 1, 0x00000005, 1 },
+  { "lsr 4",    MOVS_LSR, 0x000000F8,   4, 0, 1, 0x0000000F, 1 },
+  { "lsr 32",   MOVS_LSR, 0x80000001,  32, 0, 0, 0x00000000, 1 },
+  { "lsr 33",   MOVS_LSR, 0x80000001,  33, 0, 1, 0x00000000, 0 },
+  { "lsr 64",   MOVS_LSR, 0xFFFFFFFF,  64, 0, 1, 0x00000000, 0 },
+  { "asr 4",    MOVS_ASR, 0x80000000,   4, 0, 1, 0xF8000000, 0 },
+  { "asr 32",   MOVS_ASR, 0x80000000,  32, 0, 0, 0xFFFFFFFF, 1 },
+  { "asr 40",   MOVS_ASR, 0x7FFFFFFF,  40, 0, 1, 0x00000000, 0 },
+  { "asr 200",  MOVS_ASR, 0x80000000, 200, 0, 0, 0xFFFFFFFF, 1 },
+  { "ror 8",    MOVS_ROR, 0x12345678,   8, 0, 1, 0x78123456, 0 },
+  { "ror 32",   MOVS_ROR, 0x80000001,  32, 0, 0, 0x80000001, 1 },
+  { "ror 33",   MOVS_ROR, 0x80000001,  33, 0, 0, 0xC0000000, 1 },
+  { "ror 64",   MOVS_ROR, 0x00000001,  64, 0, 1, 0x00000001, 0 },
+  { "lsr #32",  0xE1B00021, 0x80000001, 0, 0, 0, 0x00000000, 1 }, // movs r0,r1,lsr #32
+  { "asr #32",  0xE1B00041, 0x80000000, 0, 0, 0, 0xFFFFFFFF, 1 }, // movs r0,r1,asr #32
+  // Loads read the word at their own address, so r0 is the address used
+  { "ldr lsr #32", 0xE7930021, 0x80001000, 0, 0x2000, 0, 0x00002000, 0 }, // ldr r0,[r3,r1,lsr #32]
+  { "ldr asr #32", 0xE7930041, 0x80001000, 0, 0x2001, 0, 0x00002000, 0 }, // ldr r0,[r3,r1,asr #32]
+  { NULL }
+};
+
+static uint8 *ram;
+
+static struct ARM_MEMORY_MAP loadmap[1], storemap[1];
+
+static void EMU_CALL advance(void *hw, uint32 cycles) { }
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// Runs one case from pc, returns nonzero if it went wrong
+//
+static int run(void *state, const struct CASE *t, uint32 pc) {
+  struct ARM_STATE *s = (struct ARM_STATE*)state;
+  s->r[0] = 0xDEADBEEF;
+  s->r[1] = t->r1;
+  s->r[2] = t->r2;
+  s->r[3] = t->r3;
+  s->r[15] = pc;
+  s->cpsr = 0x1F | 0x80 | (t->cin << 29); // system mode, IRQ masked
+  s->flag_mode = FLAGS_CPSR;
+  arm_execute(state, 32, 0);
+  if(s->r[0] != t->r0) { return 1; }
+  if(((arm_getreg(state, ARM_REG_CPSR) >> 29) & 1) != t->c) { return 1; }
+  return 0;
+}
+
+int main(void) {
+  void *state = malloc(arm_get_state_size());
+  uint32 i, n, fails = 0;
+  uint8 jit;
+
+  ram = malloc(RAMSIZE);
+  if(!state || !ram) { printf("out of memory\n"); return 1; }
+  if(arm_init()) { printf("arm_init failed\n"); return 1; }
+
+  for(i = 0; i < RAMSIZE; i += 4) { *(uint32*)(ram + i) = i; }
+  // Each case at its own address, followed by a branch to itself
+  for(n = 0; cases[n].name; n++) {
+    *(uint32*)(ram + 0x100 + 8 * n) = cases[n].insword;
+    *(uint32*)(ram + 0x104 + 8 * n) = 0xEAFFFFFE;
+  }
+
+  loadmap[0].x = 0; loadmap[0].y = 0xFFFFFFFF; loadmap[0].type.mask = RAMSIZE - 1;
+  loadmap[0].type.n = ARM_MAP_TYPE_POINTER; loadmap[0].type.p = ram;
+  storemap[0] = loadmap[0];
+
+  for(jit = 0; jit < 2; jit++) {
+    arm_clear_state(state);
+    arm_set_advance_callback(state, advance, NULL);
+    arm_set_memory_maps(state, loadmap, storemap);
+    arm_enable_jit(state, jit);
+    for(n = 0; cases[n].name; n++) {
+      const struct CASE *t = cases + n;
+      int bad = 0;
+      for(i = 0; i < (jit ? (ARM_JIT_RUNS + 2) : 1); i++) {
+        bad |= run(state, t, 0x100 + 8 * n);
+      }
+      if(bad) {
+        printf("%s%s: r0 %08X c %u, expected %08X c %u\n",
+          t->name, jit ? " (recompiled)" : "",
+          arm_getreg(state, 0), (arm_getreg(state, ARM_REG_CPSR) >> 29) & 1,
+          t->r0, t->c
+        );
+        fails++;
+      }
+    }
+  }
+
+  arm_jit_shutdown();
+  free(ram);
+  free(state);
+  printf("armshift: %u/%u cases wrong\n", fails, 2 * n);
+  return fails != 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
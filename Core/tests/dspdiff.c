@@ -0,0 +1,166 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// dspdiff - Checks the DSP dynarec against the interpreter
+//
+// Each round fills a state with a random MPRO program, coefficients,
+// addresses, temps, inputs and sound RAM, copies it, and runs 64 samples
+// through the interpreter on one copy and through compiled code on the
+// other, recompiling every 16 samples.  COEF and MADRS registers are
+// rewritten every few samples without a recompile, as drivers sweeping
+// them do.  Everything the DSP can write must come out the same.
+// Alternate rounds run with liveness pruning on.
+//
+// Builds yam.c in so it can reach the DSP internals.
+//
+// Usage: dspdiff [rounds]
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#include "yam.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define RAMSIZE (0x80000)
+#define SAMPLES (64)
+
+#ifdef ENABLE_DYNAREC
+
+static uint32 rndstate;
+
+static uint32 rnd(void) {
+  rndstate = rndstate * 1664525 + 1013904223;
+  return rndstate >> 8;
+}
+
+static uint64 rnd64(void) {
+  return (((uint64)rnd()) << 40) ^ (((uint64)rnd()) << 20) ^ rnd();
+}
+
+static sint32 rnd24(void) { return ((sint32)(rnd() << 8)) >> 8; }
+
+//
+// Random DSP state; one MPRO step in five is a NOP, and one in three
+// leaves out the memory access bits so the rest aren't all RAM traffic.
+// About half the EFREG outputs are mixed, so liveness pruning has work to do.
+//
+static void randomize(struct YAM_STATE *state, uint8 *ram, uint8 version) {
+  uint32 i;
+  state->rbp = (rnd() & 0x3F) << 13;
+  state->rbl = rnd() & 3;
+  for(i = 0; i < 128; i++) {
+    uint64 v = (rnd() % 5) ? rnd64() : 0;
+    if(!(rnd() % 3)) { v &= ~(((uint64)0xC0) << 23); }
+    if(version == 2) { mpro_aica_write(state->mpro + i, v); }
+    else             { mpro_scsp_write(state->mpro + i, v); }
+    state->coef[i] = ((sint32)(rnd() << 19)) >> 19;
+    state->temp[i] = rnd24();
+  }
+  for(i = 0; i < 64; i++) { state->madrs[i] = rnd() & 0xFFFF; }
+  for(i = 0; i < 0x40; i++) { state->inputs[i] = rnd24(); }
+  for(i = 0; i < 4; i++) { state->mem_in_data[i] = rnd24(); }
+  state->yychoice[0] = rnd() & 0xFFF;
+  state->yychoice[2] = rnd() & 0x1FFF;
+  state->yychoice[3] = rnd() & 0xFFF;
+  state->xzbchoice[XZBCHOICE_ACC] = ((sint32)(rnd() << 6)) >> 6;
+  state->adrs_reg = rnd() & 0xFFF;
+  state->mdec_ct = rnd();
+  for(i = 0; i < 16; i++) { state->efsdl[i] = (rnd() & 1) ? (rnd() & 0xF) : 0; }
+  for(i = 0; i < RAMSIZE; i++) { ram[i] = (uint8)rnd(); }
+  // Analyze and decode the new program, as a block render would
+  state->dsp_analysis_valid = 0;
+  state->dsp_uop_valid = 0;
+  dsp_analyze(state);
+  dsp_decode(state);
+}
+
+//
+// Returns a bitmask of what differs, or 0
+//
+static uint32 compare(
+  struct YAM_STATE *a, uint8 *ra,
+  struct YAM_STATE *b, uint8 *rb
+) {
+  uint32 bad = 0;
+  if(memcmp(a->temp, b->temp, sizeof(a->temp))) { bad |= 0x01; }
+  if(memcmp(a->efreg, b->efreg, 16 * sizeof(a->efreg[0]))) { bad |= 0x02; }
+  if(a->xzbchoice[XZBCHOICE_ACC] != b->xzbchoice[XZBCHOICE_ACC]) { bad |= 0x04; }
+  if(a->adrs_reg != b->adrs_reg) { bad |= 0x08; }
+  if(
+    a->yychoice[0] != b->yychoice[0] ||
+    a->yychoice[2] != b->yychoice[2] ||
+    a->yychoice[3] != b->yychoice[3]
+  ) { bad |= 0x10; }
+  if(memcmp(a->mem_in_data, b->mem_in_data, sizeof(a->mem_in_data))) { bad |= 0x20; }
+  if(memcmp(a->inputs, b->inputs, 0x40 * sizeof(a->inputs[0]))) { bad |= 0x40; }
+  if(memcmp(ra, rb, RAMSIZE)) { bad |= 0x80; }
+  return bad;
+}
+
+int main(int argc, char **argv) {
+  uint32 rounds = (argc > 1) ? atoi(argv[1]) : 2000;
+  uint32 size = yam_get_state_size(2);
+  struct YAM_STATE *a = malloc(size);
+  struct YAM_STATE *b = malloc(size);
+  uint8 *ra = malloc(RAMSIZE);
+  uint8 *rb = malloc(RAMSIZE);
+  uint32 round, n, fails = 0;
+
+  if(!a || !b || !ra || !rb) { printf("out of memory\n"); return 1; }
+  if(yam_init()) { printf("yam_init failed\n"); return 1; }
+
+  for(round = 0; round < rounds; round++) {
+    uint8 version = 1 + (round & 1);
+    uint32 bad;
+    rndstate = 12345 + round * 7919;
+    yam_clear_state(a, version);
+    // word XOR 0 or 2, as little- and big-endian hosts set it
+    yam_setram(a, (uint32*)ra, RAMSIZE, (version == 2) ? 0 : 1, (round & 2));
+    yam_enable_dsp_liveness(a, (round >> 2) & 1);
+    randomize(a, ra, version);
+    memcpy(b, a, size);
+    memcpy(rb, ra, RAMSIZE);
+    b->ram_ptr = rb;
+    b->dsp_dyna_valid = 0;
+    b->dyna_serial = 0;
+    for(n = 0; n < SAMPLES; n++) {
+      uint8 *code;
+      if((n % 4) == 3) {
+        uint32 c = rnd() & 0x7F, cd = rnd() & 0xFFF8;
+        uint32 m = rnd() & 0x3F, md = rnd() & 0xFFFF;
+        coef_write(a, c, cd, 0xFFFF); coef_write(b, c, cd, 0xFFFF);
+        madrs_write(a, m, md, 0xFFFF); madrs_write(b, m, md, 0xFFFF);
+      }
+      dsp_sample_interpret(a);
+      a->mdec_ct--;
+      if(!(b->dsp_dyna_valid)) { dynacompile(b); }
+      code = dynapool_acquire(b);
+      if(!code) { printf("round %u: no compiled code\n", round); return 1; }
+      ((dsp_sample_t)code)(b);
+      dynapool_release(b);
+      b->mdec_ct--;
+      if((n % 16) == 15) { b->dsp_dyna_valid = 0; }
+    }
+    bad = compare(a, ra, b, rb);
+    if(bad) {
+      if(fails < 10) { printf("round %u (version %u): mismatch %02X\n", round, version, bad); }
+      fails++;
+    }
+  }
+
+  printf("dspdiff: %u/%u rounds differ\n", fails, rounds);
+  return fails != 0;
+}
+
+#else
+
+int main(void) {
+  printf("dspdiff: no DSP dynarec in this build\n");
+  return 0;
+}
+
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,181 @@
+/////////////////////////////////////////////////////////////////////////////
+//
+// yambench - Times the yam renderer over fixed voice setups
+//
+// Each scenario keys on a set of voices, renders a few seconds of output
+// several times, and reports the best time and a hash of the output.  The
+// hash must not change between builds unless the output is meant to.
+//
+// Usage: yambench [scenario-prefix]
+//
+/////////////////////////////////////////////////////////////////////////////
+
+#include "yam.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/////////////////////////////////////////////////////////////////////////////
+
+#define SECONDS (10)
+#define ROUNDS  (5)
+
+struct SCENARIO {
+  const char *name;
+  uint8 version;   // 1 = SCSP, 2 = AICA
+  uint32 voices;   // channels keyed on
+  uint32 block;    // samples per yam_advance/yam_flush
+  uint32 render;   // render block size, or 0 for the default
+  uint8 filter;    // voices run through the LPF
+  uint8 simd;      // lane renderer enabled
+  uint8 fm;        // SCSP: odd voices ring-modulated by the voice before
+};
+
+static const struct SCENARIO scenarios[] = {
+  // Voice shapes: plain, filtered, and with pitch/amp LFO mixed in
+  { "aica64-scalar",      2, 64,  200,   0, 0, 0, 0 },
+  { "aica64-scalar-lpf",  2, 64,  200,   0, 1, 0, 0 },
+  { "aica64-simd",        2, 64,  200,   0, 0, 1, 0 },
+  { "aica64-simd-lpf",    2, 64,  200,   0, 1, 1, 0 },
+  // Few live voices, flushed in small blocks as register traffic would
+  { "aica8-block1",       2,  8,    1,   0, 1, 1, 0 },
+  { "aica8-block4",       2,  8,    4,   0, 1, 1, 0 },
+  { "aica8-block16",      2,  8,   16,   0, 1, 1, 0 },
+  { "aica8-block64",      2,  8,   64,   0, 1, 1, 0 },
+  // Render block size, flushed in large steps
+  { "render16",           2, 64, 4410,  16, 1, 1, 0 },
+  { "render64",           2, 64, 4410,  64, 1, 1, 0 },
+  { "render200",          2, 64, 4410, 200, 1, 1, 0 },
+  { "render512",          2, 64, 4410, 512, 1, 1, 0 },
+  // SCSP, plain and with FM patches
+  { "scsp32",             1, 32,  200,   0, 0, 1, 0 },
+  { "scsp32-fm",          1, 32,  200,   0, 0, 1, 1 },
+  { NULL }
+};
+
+/////////////////////////////////////////////////////////////////////////////
+
+static uint32 rndstate;
+
+static uint32 rnd(void) {
+  rndstate = rndstate * 1664525 + 1013904223;
+  return rndstate >> 8;
+}
+
+static void reg(const struct SCENARIO *sc, void *state, uint32 a, uint32 d) {
+  if(sc->version == 2) {
+    yam_aica_store_reg(state, a, d, 0xFFFF, NULL);
+  } else {
+    yam_scsp_store_reg(state, a, d, 0xFFFF, NULL);
+  }
+}
+
+//
+// Key on the scenario's voices
+// Every third voice is 8-bit, the rest 16-bit; on the AICA every fourth
+// has pitch LFO and the one after it amplitude LFO, so all shapes without
+// ring modulation get used.  SCSP FM scenarios modulate each odd voice by
+// the even one before it at MDL 0xA.
+//
+static void setup(const struct SCENARIO *sc, void *state, uint8 *ram, uint32 ramsize) {
+  uint32 i;
+  rndstate = 5;
+  for(i = 0; i < ramsize; i++) { ram[i] = (uint8)rnd(); }
+  if(sc->version == 2) {
+    reg(sc, state, 0x2800, 0xF);
+    for(i = 0; i < sc->voices; i++) {
+      uint32 b = i * 0x80;
+      uint32 lfo = 0;
+      if((i & 3) == 1) { lfo = (0x10 << 10) | (2 << 8) | (5 << 5); }
+      if((i & 3) == 2) { lfo = (0x10 << 10) | (1 << 3) | 5; }
+      reg(sc, state, b + 0x04, i * 0x1000);
+      reg(sc, state, b + 0x08, 0x10);
+      reg(sc, state, b + 0x0C, 0x8000);
+      reg(sc, state, b + 0x10, 0x001F);
+      reg(sc, state, b + 0x14, 0x0000);
+      reg(sc, state, b + 0x18, (((i % 3) == 0 ? 0 : (0x10 - (i % 3))) << 11) | (i * 13));
+      reg(sc, state, b + 0x1C, lfo);
+      reg(sc, state, b + 0x24, 0xF00 | (i & 0x1F));
+      reg(sc, state, b + 0x28, 0x0800 | (sc->filter ? 0 : 0x20));
+      reg(sc, state, b + 0x2C, 0x1FF0);
+      reg(sc, state, b + 0x30, 0x1C00);
+      reg(sc, state, b + 0x40, 0x0808);
+      reg(sc, state, b + 0x44, 0x0808);
+      reg(sc, state, b + 0x00, 0x4000 | (((i % 3) == 2 ? 0 : (i % 3)) << 7) | 0x200);
+    }
+    reg(sc, state, 0x0000, 0xC000 | 0x200);
+  } else {
+    reg(sc, state, 0x400, 0xF);
+    for(i = 0; i < sc->voices; i++) {
+      uint32 b = i * 0x20;
+      reg(sc, state, b + 0x02, i * 0x800);
+      reg(sc, state, b + 0x04, 0x10);
+      reg(sc, state, b + 0x06, 0x8000);
+      reg(sc, state, b + 0x08, 0x001F);
+      reg(sc, state, b + 0x0A, 0x0000);
+      reg(sc, state, b + 0x0C, 0x10);
+      reg(sc, state, b + 0x0E, (sc->fm && (i & 1)) ? ((0xA << 12) | (31 << 6) | 31) : 0);
+      reg(sc, state, b + 0x10, (((i % 3) == 0 ? 0 : (0x10 - (i % 3))) << 11) | (i * 13));
+      reg(sc, state, b + 0x16, 0xE000 | ((i & 0x1F) << 8));
+      reg(sc, state, b + 0x00, 0x0800 | 0x20 | ((i & 1) << 4));
+    }
+    reg(sc, state, 0x0000, 0x1800 | 0x20);
+  }
+}
+
+static void run(const struct SCENARIO *sc) {
+  uint32 ramsize = (sc->version == 2) ? 0x200000 : 0x80000;
+  uint32 total = ((44100 * SECONDS) / sc->block) * sc->block;
+  uint32 render = sc->render ? sc->render : 200;
+  void *state = malloc(yam_get_state_size_ex(sc->version, render, 0));
+  uint8 *ram = malloc(ramsize);
+  sint16 *out = malloc(4 * total);
+  double best = 0;
+  uint64 hash = 0;
+  uint32 i, round;
+
+  if(!state || !ram || !out) { printf("%-22s out of memory\n", sc->name); exit(1); }
+
+  for(round = 0; round < ROUNDS; round++) {
+    clock_t c;
+    double t;
+    yam_clear_state_ex(state, sc->version, render, 0);
+    yam_set_render_block(state, render);
+    yam_setram(state, (uint32*)ram, ramsize, (sc->version == 2) ? 0 : 1, 0);
+    yam_enable_simd(state, sc->simd);
+    setup(sc, state, ram, ramsize);
+    yam_beginbuffer(state, out);
+    c = clock();
+    for(i = 0; i < total; i += sc->block) {
+      yam_advance(state, sc->block);
+      yam_flush(state);
+    }
+    t = (double)(clock() - c) / CLOCKS_PER_SEC;
+    if(round == 0 || t < best) { best = t; }
+  }
+
+  for(i = 0; i < 2 * total; i++) { hash = hash * 31 + (uint16)out[i]; }
+  printf("%-22s %7.3f s %7.1fx realtime  hash %08lX%08lX\n",
+    sc->name, best, best > 0 ? total / (44100.0 * best) : 0.0,
+    (unsigned long)(hash >> 32), (unsigned long)(hash & 0xFFFFFFFF)
+  );
+
+  free(out);
+  free(ram);
+  free(state);
+}
+
+int main(int argc, char **argv) {
+  const struct SCENARIO *sc;
+  const char *prefix = (argc > 1) ? argv[1] : "";
+  if(yam_init()) { printf("yam_init failed\n"); return 1; }
+  for(sc = scenarios; sc->name; sc++) {
+    if(strncmp(sc->name, prefix, strlen(prefix))) { continue; }
+    run(sc);
+  }
+  return 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
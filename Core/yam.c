@@ -24,24 +24,69 @@
 
 #ifndef _WIN32
 #define __cdecl
+#if defined(__i386__)
+/* same as MSVC: the dynarec takes the state in ECX */
+#define __fastcall __attribute__((fastcall))
+#else
 #define __fastcall __attribute__((regparm(3)))
 #endif
+#endif
 
-/* No dynarec for x86_64 yet */
-#if defined(_WIN32) || defined(__i386__)
+/* 32-bit x86 dynarec, or the x86-64 one (SysV ABI); both need a way to
+   make pages executable (VirtualProtect or mprotect) */
+#if defined(_WIN32) || (defined(__i386__) && defined(HAVE_MPROTECT))
 #define ENABLE_DYNAREC
 #endif
 #if defined(_WIN64) || defined(__amd64__)
 #undef ENABLE_DYNAREC
 #endif
+#if defined(__amd64__) && !defined(_WIN64) && defined(HAVE_MPROTECT)
+#define ENABLE_DYNAREC
+#define DYNAREC_X64
+#endif
+
+/* Threaded dispatch for the DSP interpreter (GNU C computed goto) */
+#if defined(__GNUC__)
+#define DSP_COMPUTED_GOTO
+#endif
+
+/* SIMD voice renderer: SSE2 baseline, AVX2 selected at runtime */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define ENABLE_SIMD
+#include <emmintrin.h>
+#if defined(__GNUC__) || defined(_MSC_VER)
+#define ENABLE_SIMD_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SIMD_TARGET_AVX2
+#else
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 // no 'conversion from _blah_ possible loss of data' warnings
 #pragma warning (disable: 4244)
 
 /////////////////////////////////////////////////////////////////////////////
 
-#define RENDERMAX (200)
-#define RINGMAX   (256) // should be nearest power of two that's at least one greater than RENDERMAX
+#define RENDERMAX (512) // largest render block a state can be sized for
+#define RINGMIN   (256) // fewest ring buffer samples; 32 words each
+#define RENDERDEFAULT (200)
+
+//
+// Decoded ADPCM cache (AICA only)
+// Each entry holds the decoded sample and predictor step for every play
+// position of a 4-bit region, as decoded from the key-on predictor state
+// The sample arena follows the YAM_STATE structure
+//
+#define ADPCMCACHE_ENTRIES (32)
+#define ADPCMCACHE_SAMPLES (0x40000)
 
 /////////////////////////////////////////////////////////////////////////////
 
@@ -147,8 +192,67 @@ static void convert_stereo_send_level(
 }
 
 /////////////////////////////////////////////////////////////////////////////
+//
+// Bit helpers
+//
+
+//
+// Index of the lowest set bit; x must be nonzero
+//
+static EMU_INLINE uint32 yam_ctz32(uint32 x) {
+#if defined(_MSC_VER)
+  unsigned long r;
+  _BitScanForward(&r, x);
+  return r;
+#elif defined(__GNUC__)
+  return __builtin_ctz(x);
+#else
+  uint32 r = 0;
+  while(!(x & 1)) { x >>= 1; r++; }
+  return r;
+#endif
+}
+
+static uint32 yam_popcount32(uint32 x) {
+  uint32 n = 0;
+  while(x) { x &= x - 1; n++; }
+  return n;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+//
+// SIMD level detected at init time
+// 0 = scalar only, 1 = SSE2, 2 = AVX2
+//
+static uint8 yam_simd_level = 0;
+
+#ifdef ENABLE_SIMD_AVX2
+static int detect_avx2(void) {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  if(info[0] < 7) { return 0; }
+  __cpuid(info, 1);
+  // need OSXSAVE and AVX, and the OS must save YMM state
+  if((info[2] & 0x18000000) != 0x18000000) { return 0; }
+  if((_xgetbv(0) & 6) != 6) { return 0; }
+  __cpuidex(info, 7, 0);
+  return (info[1] & 0x20) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+#endif
 
 sint32 EMU_CALL yam_init(void) {
+#ifdef ENABLE_SIMD
+  yam_simd_level = 1;
+#ifdef ENABLE_SIMD_AVX2
+  if(detect_avx2()) { yam_simd_level = 2; }
+#endif
+#endif
   return 0;
 }
 
@@ -222,6 +326,10 @@ struct YAM_CHAN {
   uint16 lpflevel;
   uint8 envstate;
   uint8 lpfstate;
+  uint8 envrate; // effective amplitude envelope rate
+  uint8 lpfrate; // effective filter envelope rate
+  uint32 envnext; // odometer of the next amplitude envelope step
+  uint32 lpfnext; // odometer of the next filter envelope step
   uint8 lp;
   uint32 playpos;
   uint32 frcphase;
@@ -235,8 +343,23 @@ struct YAM_CHAN {
   sint32 adpcmprev;
   sint32 adpcmprev_loopstart;
   uint8 adpcminloop;
+  uint8 adpcmcache_slot; // decoded ADPCM cache entry + 1, or 0 if none
+};
+
+struct YAM_ADPCMCACHE_ENTRY {
+  uint32 sampleaddr; // masked RAM address of play position 0
+  uint32 length;     // play positions reserved; 0 if the entry is free
+  uint32 decoded;    // play positions decoded so far
+  uint32 base;       // offset into the sample arena
+};
+
+struct YAM_ADPCMCACHE_SAMPLE {
+  sint16 s;
+  uint16 step;
 };
 
+#define CHANNUM(state,chan) ((uint32)((chan) - ((state)->chan)))
+
 struct MPRO {
   uint8 c_0rrrrrrr; // CRA (up to 7 bits)
   uint8 t_0rrrrrrr; // TRA
@@ -355,8 +478,63 @@ static uint64 mpro_aica_read(struct MPRO *mpro) {
   return value;
 }
 
-#define DYNACODE_MAX_SIZE (0x6000)
-#define DYNACODE_SLOP_SIZE (0x80)
+#ifdef ENABLE_SIMD
+//
+// Parameter buffers for the SIMD lane renderer
+//
+#define LANES_MAX (8)
+
+struct YAM_LANEBUF {
+  // Per-sample parameters, laid out [sample][lane]; point into the scratch
+  sint16 *cur;
+  sint16 *nxt;
+  sint16 *frc;
+  sint16 *vol; // linear volume, 0-128
+  sint16 *mul; // 1 << (14 - attenuation shift)
+  sint16 *flt; // lowpass coefficient (0x2000 = bypass)
+  sint32 *out;
+  // Per-lane state
+  sint32 count[LANES_MAX];
+  sint32 fltmask[LANES_MAX]; // -1 if the filter state should be kept
+  sint32 q[LANES_MAX];
+  sint32 lpp1[LANES_MAX];
+  sint32 lpp2[LANES_MAX];
+};
+#endif
+
+//
+// One pre-decoded DSP step; built from MPRO/RBL by dsp_decode.
+// Operand pointers point into the state they were decoded for, so COEF and
+// MADRS changes need no rebuild.
+//
+#define DSPUOP_END      (0)
+#define DSPUOP_SKIP     (1)
+#define DSPUOP_STEP     (2)
+#define DSPUOP_STEP_MEM (3)
+#define DSPUOP_COUNT    (4)
+
+struct YAM_DSPUOP {
+  uint8 op;         // DSPUOP_*
+  uint8 tra;        // TRA
+  uint8 twa;        // !TWT, TWA
+  uint8 kis;        // MPRO __kisxzbon
+  uint8 wraf;       // MPRO m_wrAFyyYh
+  uint8 step;       // original step number
+  sint32 xtemp;     // -1 if X is TEMP, 0 if INPUTS
+  sint32 btemp;     // -1 if B is TEMP
+  sint32 bacc;      // -1 if B is ACC
+  sint32 negb;      // -1 if negb
+  const uint16 *madrsp; // MADRS (NXADR is in kis)
+  sint32 adrmask;   // -1 if adreb=1
+  sint32 mdecmask;  // 0 if table, -1 otherwise
+  uint32 amask;     // ring buffer or table mask
+  const sint32 *yp; // Y source
+  const sint32 *ip; // INPUTS read
+  sint32 *iwp;      // INPUTS write (slop area if !IWT)
+  const sint32 *mip; // MEMS data written by IWT
+  sint32 *mrdp;     // MEMS data latched by MRD
+  sint16 *ewp;      // EFREG write (slop area if !EWT)
+};
 
 struct YAM_STATE {
   //
@@ -367,13 +545,47 @@ struct YAM_STATE {
   uint32 ram_mask;
   sint16 *out_buf; // EXTERNALLY-REGISTERED pointer
   uint32 out_pending;
+  uint32 render_block; // samples per render() call, 1 to render_max
+  uint32 render_max; // largest render_block the state was sized for
+  uint32 ring_mask; // SCSP ring buffer index mask
+  //
+  // Byte offsets of what follows the struct, sized by render_max; each is
+  // 64-byte aligned relative to the state
+  //
+  uint32 offset_to_outbuf;
+  uint32 offset_to_fxbus;
+  uint32 offset_to_localbuf;
+  uint32 offset_to_efout;
+  uint32 offset_to_lanebuf;
+  uint32 offset_to_ringbuf;
+  uint32 offset_to_adpcmcache;
   uint32 odometer;
   uint8 dry_out_enabled;
   uint8 dsp_emulation_enabled;
+  uint8 dsp_uop_valid;
+  uint8 dsp_analysis_valid;
+  uint8 dsp_liveness_enabled;
+  uint8 dsp_idle_skip_enabled;
 #ifdef ENABLE_DYNAREC
   uint8 dsp_dyna_enabled;
   uint8 dsp_dyna_valid;
+  uint32 dyna_slot;   // executable pool slot holding our code
+  uint32 dyna_serial; // slot serial when we got it (0 = none)
 #endif
+  uint8 simd_enabled;
+  uint8 adpcmcache_enabled;
+  uint8 adpcmcache_room; // state was sized with the decoded ADPCM arena
+  uint8 status_sync_enabled; // status reads catch up one channel only
+  uint32 shape_hits[YAM_SHAPE_COUNT]; // channel-blocks rendered per voice shape
+  uint32 active_voices[2]; // bit set for each channel whose envelope is live
+  uint8 render_order[32]; // SCSP channel render order, modulators first
+  uint8 render_order_valid; // cleared when MDXSL/MDYSL change
+  uint8 ringmod_active; // some SCSP channel has MDL/MDXSL/MDYSL set
+  uint16 voice_done[64]; // samples of the open block each voice has rendered
+  uint32 sync_odometer; // odometer at the last yam_flush or chan_sync
+  uint8 block_open; // outbuf/fxbus hold a partly rendered block
+  uint8 block_dry; // output choices made when the block was opened
+  uint8 block_reverb;
   uint32 randseed;
   uint32 mem_word_address_xor;
   uint32 mem_byte_address_xor;
@@ -398,7 +610,7 @@ struct YAM_STATE {
   //
   // DSP regs
   //
-  sint16 coef[128]; // stored as 13-bit
+  sint32 coef[128]; // stored as 13-bit
   uint16 madrs[64];
   struct MPRO mpro[128];
   sint32 temp[128];
@@ -431,8 +643,17 @@ struct YAM_STATE {
 
   sint32 mem_in_data[4];
 
-  // SCSP modulation data
-  sint16 ringbuf[32*RINGMAX];
+  // DSP program analysis (see dsp_analyze)
+  struct MPRO dsp_prog[128]; // MPRO with dead writes turned off
+  uint8 dsp_step_live[128];
+  uint32 dsp_cutoff; // no live steps at or past this one
+  uint32 dsp_info[YAM_DSPINFO_COUNT];
+
+  // Pre-decoded DSP program, END-terminated
+  struct YAM_DSPUOP dsp_uop[129];
+  void *dsp_uop_owner; // state the operand pointers were resolved against
+
+  // SCSP modulation data; the buffer itself is at offset_to_ringbuf
   uint32 bufptr;
   // DMA registers
   uint32 dmea;
@@ -443,28 +664,113 @@ struct YAM_STATE {
   //
   struct YAM_CHAN chan[64];
   //
-  // Buffer for dynarec code
+  // Decoded ADPCM cache
   //
-#ifdef ENABLE_DYNAREC
-  uint8 dynacode[DYNACODE_MAX_SIZE];
-#endif
+  struct YAM_ADPCMCACHE_ENTRY adpcmcache[ADPCMCACHE_ENTRIES];
+  uint32 adpcmcache_used;  // arena samples allocated
+  uint32 adpcmcache_start; // RAM byte range covered by live entries
+  uint32 adpcmcache_end;   // (inclusive; empty if start > end)
 };
 
 //
 // Get size
 //
+// Scratch buffer length for a render_max, so every buffer is a whole number
+// of 64-byte lines
+#define SCRATCH_SAMPLES(render_max) (((render_max) + 15) & ~15)
+
+static uint32 clamp_render_max(uint32 max_block) {
+  if(max_block < 1) { max_block = 1; }
+  if(max_block > RENDERMAX) { max_block = RENDERMAX; }
+  return max_block;
+}
+
+//
+// Lays out the buffers past the end of the struct and returns the total
+// size; fills in the offsets too if given a state
+//
+static uint32 state_layout(
+  struct YAM_STATE *state,
+  uint8 version,
+  uint32 render_max,
+  uint8 adpcm_cache
+) {
+  uint32 n = SCRATCH_SAMPLES(render_max);
+  uint32 ringsize = RINGMIN;
+  uint32 size = EMU_STATE_ALIGN(sizeof(struct YAM_STATE));
+  uint32 outbuf, fxbus, localbuf, efout, lanebuf, ringbuf;
+  // Ring buffer holds at least one more sample than a block
+  while(ringsize <= render_max) { ringsize <<= 1; }
+  outbuf   = size; size += 4 * 2 * n;
+  fxbus    = size; size += 4 * 16 * n;
+  localbuf = size; size += 4 * n;
+  efout    = size; size += 4 * 16 * n;
+  lanebuf  = size;
+#ifdef ENABLE_SIMD
+  size += (2 * 6 + 4) * LANES_MAX * n;
+#endif
+  ringbuf  = size; size += 2 * 32 * ringsize;
+  if(state) {
+    state->render_max = render_max;
+    state->ring_mask = 32 * ringsize - 1;
+    state->offset_to_outbuf = outbuf;
+    state->offset_to_fxbus = fxbus;
+    state->offset_to_localbuf = localbuf;
+    state->offset_to_efout = efout;
+    state->offset_to_lanebuf = lanebuf;
+    state->offset_to_ringbuf = ringbuf;
+    state->offset_to_adpcmcache = size;
+  }
+  if(version == 2 && adpcm_cache) { size += sizeof(struct YAM_ADPCMCACHE_SAMPLE) * ADPCMCACHE_SAMPLES; }
+  return size;
+}
+
+uint32 EMU_CALL yam_get_state_size_ex(uint8 version, uint32 max_block, uint8 adpcm_cache) {
+  return state_layout(NULL, version, clamp_render_max(max_block), adpcm_cache);
+}
+
 uint32 EMU_CALL yam_get_state_size(uint8 version) {
-  return sizeof(struct YAM_STATE);
+  return yam_get_state_size_ex(version, RENDERDEFAULT, 0);
+}
+
+#define STATE_BUFFER(state,type,name) ((type*)(((uint8*)(state)) + (state)->offset_to_##name))
+#define OUTBUF(state)   STATE_BUFFER(state, sint32, outbuf)
+#define FXBUS(state)    STATE_BUFFER(state, sint32, fxbus)
+#define LOCALBUF(state) STATE_BUFFER(state, sint32, localbuf)
+#define EFOUT(state)    STATE_BUFFER(state, sint32, efout) // [slot][sample], render_max apart
+#define RINGBUF(state)  STATE_BUFFER(state, sint16, ringbuf)
+#define ADPCMCACHE_ARENA(state) STATE_BUFFER(state, struct YAM_ADPCMCACHE_SAMPLE, adpcmcache)
+
+//
+// Drop anything derived from the DSP program (decoded steps, dynacode)
+//
+static void dsp_program_changed(struct YAM_STATE *state) {
+  state->dsp_uop_valid = 0;
+#ifdef ENABLE_DYNAREC
+  state->dsp_dyna_valid = 0;
+#endif
+}
+
+//
+// The host reading DSP registers needs every value kept current
+//
+static void dsp_regs_observed(struct YAM_STATE *state) {
+  if(state->dsp_liveness_enabled) {
+    state->dsp_liveness_enabled = 0;
+    state->dsp_analysis_valid = 0;
+  }
 }
 
 //
 // Initialize DSP state
 //
-void EMU_CALL yam_clear_state(void *state, uint8 version) {
+void EMU_CALL yam_clear_state_ex(void *state, uint8 version, uint32 max_block, uint8 adpcm_cache) {
   int i;
   if(version != 2) { version = 1; }
   // Clear to zero
   memset(state, 0, sizeof(struct YAM_STATE));
+  state_layout(YAMSTATE, version, clamp_render_max(max_block), adpcm_cache);
+  memset(RINGBUF(YAMSTATE), 0, 2 * (YAMSTATE->ring_mask + 1));
   // Set version
   YAMSTATE->version = version;
   // Clear channel regs
@@ -502,6 +808,33 @@ void EMU_CALL yam_clear_state(void *state, uint8 version) {
 #ifdef ENABLE_DYNAREC
   YAMSTATE->dsp_dyna_enabled = 1;
 #endif
+
+  // Keep DSP values that are dead across samples; dropping them is only
+  // exact while the program never changes
+  YAMSTATE->dsp_liveness_enabled = 0;
+
+  // Skip the DSP while it has nothing to do
+  YAMSTATE->dsp_idle_skip_enabled = 1;
+
+  // Enable SIMD voice rendering
+  YAMSTATE->simd_enabled = 1;
+
+  // Default render block size
+  YAMSTATE->render_block = RENDERDEFAULT;
+  if(YAMSTATE->render_block > YAMSTATE->render_max) { YAMSTATE->render_block = YAMSTATE->render_max; }
+
+  // Let status reads catch up just the selected channel
+  YAMSTATE->status_sync_enabled = 1;
+
+  // Enable the decoded ADPCM cache if the state has room for it
+  YAMSTATE->adpcmcache_room = (version == 2 && adpcm_cache);
+  YAMSTATE->adpcmcache_enabled = YAMSTATE->adpcmcache_room;
+  YAMSTATE->adpcmcache_start = 0xFFFFFFFF;
+  YAMSTATE->adpcmcache_end = 0;
+}
+
+void EMU_CALL yam_clear_state(void *state, uint8 version) {
+  yam_clear_state_ex(state, version, RENDERDEFAULT, 0);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -556,6 +889,12 @@ static void dumpch(struct YAM_STATE *state, struct YAM_CHAN *chan) {
 //
 // Set RAM pointer and size (must be a power of 2)
 //
+static void adpcmcache_flush(struct YAM_STATE *state);
+static void chan_sync(struct YAM_STATE *state, struct YAM_CHAN *chan);
+static void chan_catch_up(struct YAM_STATE *state, struct YAM_CHAN *chan, uint32 upto);
+static void status_sync(struct YAM_STATE *state, struct YAM_CHAN *chan);
+static void flush_to_sync(struct YAM_STATE *state);
+
 void EMU_CALL yam_setram(void *state, uint32 *ram, uint32 size, uint8 mbx, uint8 mwx) {
   YAMSTATE->ram_ptr = ram;
   if((size & (size-1)) == 0) {
@@ -566,11 +905,13 @@ void EMU_CALL yam_setram(void *state, uint32 *ram, uint32 size, uint8 mbx, uint8
   YAMSTATE->mem_byte_address_xor = mbx;
   YAMSTATE->mem_word_address_xor = mwx;
   //
-  // Invalidate dynarec code
+  // Drop anything decoded from the old RAM
   //
-#ifdef ENABLE_DYNAREC
-  YAMSTATE->dsp_dyna_valid = 0;
-#endif
+  adpcmcache_flush(YAMSTATE);
+  //
+  // Invalidate decoded DSP program
+  //
+  dsp_program_changed(YAMSTATE);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -578,8 +919,9 @@ void EMU_CALL yam_setram(void *state, uint32 *ram, uint32 size, uint8 mbx, uint8
 // Set output buffer pointer and begin new execution run
 //
 void EMU_CALL yam_beginbuffer(void *state, sint16 *buf) {
+  // Samples still pending belong to the previous buffer
+  yam_flush(YAMSTATE);
   YAMSTATE->out_buf = buf;
-  YAMSTATE->out_pending = 0;
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -587,10 +929,12 @@ void EMU_CALL yam_beginbuffer(void *state, sint16 *buf) {
 // Enable or disable various things
 //
 void EMU_CALL yam_enable_dry(void *state, uint8 enable) {
+  flush_to_sync(YAMSTATE);
   YAMSTATE->dry_out_enabled = (enable != 0);
 }
 
 void EMU_CALL yam_enable_dsp(void *state, uint8 enable) {
+  flush_to_sync(YAMSTATE);
   YAMSTATE->dsp_emulation_enabled = (enable != 0);
 #ifdef ENABLE_DYNAREC
   if(enable == 0) { YAMSTATE->dsp_dyna_valid = 0; }
@@ -604,6 +948,59 @@ void EMU_CALL yam_enable_dsp_dynarec(void *state, uint8 enable) {
 #endif
 }
 
+void EMU_CALL yam_enable_dsp_liveness(void *state, uint8 enable) {
+  YAMSTATE->dsp_liveness_enabled = (enable != 0);
+  YAMSTATE->dsp_analysis_valid = 0;
+}
+
+void EMU_CALL yam_enable_dsp_idle_skip(void *state, uint8 enable) {
+  YAMSTATE->dsp_idle_skip_enabled = (enable != 0);
+}
+
+void EMU_CALL yam_enable_simd(void *state, uint8 enable) {
+  YAMSTATE->simd_enabled = (enable != 0);
+}
+
+void EMU_CALL yam_set_render_block(void *state, uint32 samples) {
+  if(samples < 1) { samples = 1; }
+  if(samples > YAMSTATE->render_max) { samples = YAMSTATE->render_max; }
+  yam_flush(state);
+  YAMSTATE->render_block = samples;
+}
+
+void EMU_CALL yam_enable_adpcm_cache(void *state, uint8 enable) {
+  if(!(YAMSTATE->adpcmcache_room)) { return; }
+  YAMSTATE->adpcmcache_enabled = (enable != 0);
+  if(!enable) { adpcmcache_flush(YAMSTATE); }
+}
+
+void EMU_CALL yam_enable_status_sync(void *state, uint8 enable) {
+  YAMSTATE->status_sync_enabled = (enable != 0);
+}
+
+uint32 EMU_CALL yam_get_active_voice_count(void *state) {
+  return
+    yam_popcount32(YAMSTATE->active_voices[0]) +
+    yam_popcount32(YAMSTATE->active_voices[1]);
+}
+
+uint32 EMU_CALL yam_get_shape_hits(void *state, uint32 shape) {
+  if(shape >= YAM_SHAPE_COUNT) { return 0; }
+  return YAMSTATE->shape_hits[shape];
+}
+
+void EMU_CALL yam_clear_shape_hits(void *state) {
+  memset(YAMSTATE->shape_hits, 0, sizeof(YAMSTATE->shape_hits));
+}
+
+static void dsp_analyze(struct YAM_STATE *state);
+
+uint32 EMU_CALL yam_get_dsp_info(void *state, uint32 what) {
+  if(what >= YAM_DSPINFO_COUNT) { return 0; }
+  if(!(YAMSTATE->dsp_analysis_valid)) { dsp_analyze(YAMSTATE); }
+  return YAMSTATE->dsp_info[what];
+}
+
 /////////////////////////////////////////////////////////////////////////////
 //
 // Timers / interrupts
@@ -685,11 +1082,225 @@ void EMU_CALL yam_advance(void *state, uint32 samples) {
   YAMSTATE->odometer += samples;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+//
+// Envelope-related calculations
+//
+
+//
+// Adjust actual rate to get effective rate
+//
+static uint32 env_adjustrate(struct YAM_CHAN *chan, uint32 rate) {
+  sint32 effrate = rate * 2;
+  if(chan->krs < 0xF) {
+    effrate += (chan->fns >> 9) & 1;
+    effrate += chan->krs * 2;
+    effrate = (effrate - 8) + (chan->oct ^ 8);
+  }
+  // Clipping is important because of the table lookups
+  if(effrate <= 0) return 0;
+  if(effrate >= 0x3C) return 0x3C;
+  return effrate;
+}
+
+//
+// Determine whether a step is going to occur here
+//
+static int env_needstep(uint32 effrate, uint32 odometer) {
+  uint32 shift;
+  uint32 pattern;
+  uint32 bitplace;
+  if(effrate <= 0x01) return 0;
+  if(effrate >= 0x30) return ((odometer & 1) == 0);
+  shift = 12 - ((effrate - 1) >> 2);
+  pattern = (effrate - 1) & 3;
+  if(odometer & ((1<<shift)-1)) return 0;
+  bitplace = (odometer >> shift) & 7;
+  return (0xFFFDDDD5 >> (pattern * 8 + bitplace)) & 1;
+  // 11010101 0x01 each bit is 4096 samples
+  // 11011101 0x02
+  // 11111101 0x03
+  // 11111111 0x04
+}
+
+//
+// Find the first odometer value at or after the given one where
+// env_needstep() is true for this rate
+// A rate that never steps gets the farthest odometer value instead, where
+// it's simply checked and rescheduled again
+//
+static uint32 env_nextstep(uint32 effrate, uint32 odometer) {
+  uint32 shift;
+  uint32 pattern;
+  if(effrate <= 0x01) return odometer - 1;
+  if(effrate >= 0x30) return (odometer + 1) & (~1);
+  shift = 12 - ((effrate - 1) >> 2);
+  pattern = (effrate - 1) & 3;
+  odometer += (1<<shift)-1;
+  odometer &= ~((1<<shift)-1);
+  while(!((0xFFFDDDD5 >> (pattern * 8 + ((odometer >> shift) & 7))) & 1)) {
+    odometer += 1<<shift;
+  }
+  return odometer;
+}
+
+//
+// Recompute the effective rate and the next step for the amplitude or
+// filter envelope, starting at the given odometer value
+// Must be called whenever the envelope state or any of the rate, KRS, OCT
+// or FNS registers change
+//
+static void env_schedule(struct YAM_STATE *state, struct YAM_CHAN *chan, uint32 odometer) {
+  chan->envrate = env_adjustrate(chan, chan->ar[chan->envstate]);
+  chan->envnext = env_nextstep(chan->envrate, odometer);
+}
+
+static void lpf_schedule(struct YAM_STATE *state, struct YAM_CHAN *chan, uint32 odometer) {
+  chan->lpfrate = env_adjustrate(chan, chan->fr[chan->lpfstate]);
+  chan->lpfnext = env_nextstep(chan->lpfrate, odometer);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Decoded ADPCM cache
+//
+// A voice is bound to an entry at key-on and reads decoded samples from it
+// for as long as its predictor state follows the entry, i.e. it plays
+// forwards from position 0 over unchanged RAM.  The first voice to reach a
+// position decodes it as usual and appends it.  Anything that could take a
+// voice off that path unbinds it, and it carries on decoding from RAM with
+// the same predictor state it would have had anyway.
+//
+
+static void adpcmcache_recompute_range(struct YAM_STATE *state) {
+  uint32 i;
+  state->adpcmcache_start = 0xFFFFFFFF;
+  state->adpcmcache_end = 0;
+  for(i = 0; i < ADPCMCACHE_ENTRIES; i++) {
+    struct YAM_ADPCMCACHE_ENTRY *e = state->adpcmcache + i;
+    uint32 start, end;
+    if(!(e->length)) { continue; }
+    start = e->sampleaddr & (~3);
+    end = (e->sampleaddr + ((e->length + 1) >> 1) - 1) | 3;
+    if(start < state->adpcmcache_start) { state->adpcmcache_start = start; }
+    if(end > state->adpcmcache_end) { state->adpcmcache_end = end; }
+  }
+}
+
+static void adpcmcache_drop(struct YAM_STATE *state, uint32 slot) {
+  uint32 i;
+  state->adpcmcache[slot].length = 0;
+  for(i = 0; i < 64; i++) {
+    if(state->chan[i].adpcmcache_slot == slot + 1) { state->chan[i].adpcmcache_slot = 0; }
+  }
+}
+
+static void adpcmcache_flush(struct YAM_STATE *state) {
+  uint32 i;
+  for(i = 0; i < ADPCMCACHE_ENTRIES; i++) { state->adpcmcache[i].length = 0; }
+  for(i = 0; i < 64; i++) { state->chan[i].adpcmcache_slot = 0; }
+  state->adpcmcache_used = 0;
+  state->adpcmcache_start = 0xFFFFFFFF;
+  state->adpcmcache_end = 0;
+}
+
+//
+// Returns nonzero if the DSP could write to the given RAM byte range
+// MWT with the table bit set may reach 64K words past RBP regardless of RBL
+//
+static int dsp_ram_overlap(struct YAM_STATE *state, uint32 start, uint32 end) {
+  uint32 rbstart = state->rbp & state->ram_mask;
+  uint32 rbend = rbstart + 0x1FFFF;
+  if(start <= rbend && end >= rbstart) { return 1; }
+  // ring buffer wrapping past the end of RAM
+  if(rbend > state->ram_mask && start <= (rbend & state->ram_mask)) { return 1; }
+  return 0;
+}
+
+//
+// Bind a channel which was just keyed on
+//
+static void adpcmcache_bind(struct YAM_STATE *state, struct YAM_CHAN *chan) {
+  uint32 addr = chan->sampleaddr & state->ram_mask;
+  uint32 length = chan->loopend;
+  uint32 end = addr + ((length + 1) >> 1) - 1;
+  uint32 i, slot;
+  chan->adpcmcache_slot = 0;
+  if(!(state->adpcmcache_enabled) || chan->pcms != 2) { return; }
+  if(length == 0 || end > state->ram_mask) { return; }
+  if(dsp_ram_overlap(state, addr, end)) { return; }
+  // Reuse an entry if one covers this region
+  for(i = 0; i < ADPCMCACHE_ENTRIES; i++) {
+    struct YAM_ADPCMCACHE_ENTRY *e = state->adpcmcache + i;
+    if(e->length >= length && e->sampleaddr == addr) {
+      chan->adpcmcache_slot = i + 1;
+      return;
+    }
+  }
+  // Otherwise allocate one, starting over if we're out of room
+  for(slot = 0; slot < ADPCMCACHE_ENTRIES; slot++) {
+    if(!(state->adpcmcache[slot].length)) { break; }
+  }
+  if(slot == ADPCMCACHE_ENTRIES || (state->adpcmcache_used + length) > ADPCMCACHE_SAMPLES) {
+    adpcmcache_flush(state);
+    slot = 0;
+  }
+  state->adpcmcache[slot].sampleaddr = addr;
+  state->adpcmcache[slot].length = length;
+  state->adpcmcache[slot].decoded = 0;
+  state->adpcmcache[slot].base = state->adpcmcache_used;
+  state->adpcmcache_used += length;
+  adpcmcache_recompute_range(state);
+  chan->adpcmcache_slot = slot + 1;
+}
+
+//
+// Append the sample a bound channel just decoded at its play position
+//
+static void adpcmcache_store(struct YAM_STATE *state, struct YAM_CHAN *chan) {
+  struct YAM_ADPCMCACHE_ENTRY *e = state->adpcmcache + (chan->adpcmcache_slot - 1);
+  uint32 p = chan->playpos;
+  if(p == e->decoded && p < e->length) {
+    struct YAM_ADPCMCACHE_SAMPLE *c = ADPCMCACHE_ARENA(state) + e->base + p;
+    c->s = chan->adpcmprev;
+    c->step = chan->adpcmstep;
+    e->decoded++;
+  } else {
+    chan->adpcmcache_slot = 0;
+  }
+}
+
+void EMU_CALL yam_invalidate_ram(void *state, uint32 address, uint32 len) {
+  uint32 start, end, i;
+  if(!len) { return; }
+  start = address & YAMSTATE->ram_mask;
+  end = start + len - 1;
+  // range wrapping past the end of RAM; just take all of it
+  if(end > YAMSTATE->ram_mask || end < start) { start = 0; end = YAMSTATE->ram_mask; }
+  if(end < YAMSTATE->adpcmcache_start || start > YAMSTATE->adpcmcache_end) { return; }
+  for(i = 0; i < ADPCMCACHE_ENTRIES; i++) {
+    struct YAM_ADPCMCACHE_ENTRY *e = YAMSTATE->adpcmcache + i;
+    if(!(e->length)) { continue; }
+    if(end < (e->sampleaddr & (~3))) { continue; }
+    if(start > ((e->sampleaddr + ((e->length + 1) >> 1) - 1) | 3)) { continue; }
+    adpcmcache_drop(YAMSTATE, i);
+  }
+  adpcmcache_recompute_range(YAMSTATE);
+}
+
+uint8 EMU_CALL yam_get_ram_watch(void *state, uint32 *start, uint32 *end) {
+  if(YAMSTATE->adpcmcache_start > YAMSTATE->adpcmcache_end) { return 0; }
+  *start = YAMSTATE->adpcmcache_start;
+  *end = YAMSTATE->adpcmcache_end;
+  return 1;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 //
 // Key on/off
 //
-static void keyon(struct YAM_CHAN *chan) {
+static void keyon(struct YAM_STATE *state, struct YAM_CHAN *chan) {
+  uint32 cn = CHANNUM(state, chan);
 //printf("keyon %08X\n",chan);
   // Ignore redundant key-ons
   if(chan->envstate != 3) return;
@@ -707,12 +1318,19 @@ static void keyon(struct YAM_CHAN *chan) {
   chan->samplebufcur = 0;
   chan->samplebufnext = 0;
   chan->lp = 0;
+  env_schedule(state, chan, state->odometer);
+  lpf_schedule(state, chan, state->odometer);
+  adpcmcache_bind(state, chan);
+  // Channel is now live; render() clears this once the envelope dies
+  state->active_voices[cn >> 5] |= ((uint32)1) << (cn & 31);
 //printf("keyon %08X passed\n",chan);
 }
 
-static void keyoff(struct YAM_CHAN *chan) {
+static void keyoff(struct YAM_STATE *state, struct YAM_CHAN *chan) {
   chan->envstate = 3;
   chan->lpfstate = 3;
+  env_schedule(state, chan, state->odometer);
+  lpf_schedule(state, chan, state->odometer);
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -730,11 +1348,27 @@ static uint32 calculate_playpos(
   struct YAM_STATE *state,
   struct YAM_CHAN *chan
 ) {
+  uint32 pending;
   sint32 p, deltap, loopsize;
 
+  //
+  // Start from the last flush or channel catch-up, which is where the
+  // channel would be if every store had flushed, and extrapolate from there
+  //
+  pending = state->odometer - state->sync_odometer;
+  if(pending > state->out_pending) { pending = state->out_pending; }
+  chan_catch_up(state, chan, state->out_pending - pending);
+
   if(!(chan->sampler_dir)) return 0;
 
-  if(state->out_pending > 100) yam_flush(state);
+  if(pending > 100) {
+    if(state->status_sync_enabled) {
+      chan_sync(state, chan);
+    } else {
+      yam_flush(state);
+    }
+    pending = 0;
+  }
 
   loopsize = chan->loopend - chan->loopstart;
   if(loopsize < 1) { loopsize = 1; }
@@ -744,7 +1378,7 @@ static uint32 calculate_playpos(
     uint32 base_phaseinc = fns << oct;
     // weird ADPCM thing mentioned in official doc
     if(chan->pcms == 2 && oct >= 0xA) { base_phaseinc <<= 1; }
-    deltap = base_phaseinc * ((uint32)(state->out_pending));
+    deltap = base_phaseinc * pending;
     deltap &= 0x7FFFFFFF;
     deltap >>= 18;
   }
@@ -879,7 +1513,17 @@ static void chan_scsp_store_reg(struct YAM_STATE *state, uint8 ch, uint8 a, uint
   struct YAM_CHAN *chan;
   a &= 0x1E;
   if(a >= 0x18) return;
-  yam_flush(YAMSTATE);
+  // Key on/off, the render order and the effect send levels affect more
+  // than this channel; anything else only needs the channel caught up
+  if(
+    (a == 0x00 && (mask & 0xFF00) && (d & 0x1000)) ||
+    (a == 0x0E) ||
+    (a == 0x16 && (mask & 0x00FF) && ch < 18)
+  ) {
+    yam_flush(YAMSTATE);
+  } else {
+    chan_sync(state, state->chan + (((uint32)ch) & 0x1F));
+  }
   chan = state->chan + (((uint32)ch) & 0x1F);
   switch(a & 0x1E) {
   case 0x00: // PlayControl
@@ -904,10 +1548,10 @@ static void chan_scsp_store_reg(struct YAM_STATE *state, uint8 ch, uint8 a, uint
         for(ch = 0; ch < 32; ch++) {
           if(state->chan[ch].kyonb) {
 //printf("*");
-            keyon(state->chan + ch);
+            keyon(state, state->chan + ch);
           } else {
 //printf(".");
-            keyoff(state->chan + ch);
+            keyoff(state, state->chan + ch);
           }
         }
 //printf("\n");
@@ -940,6 +1584,7 @@ static void chan_scsp_store_reg(struct YAM_STATE *state, uint8 ch, uint8 a, uint
       chan->ar[1] |= (d >> 6) & 0x1C;
       chan->ar[2] = (d >> 11) & 0x1F;
     }
+    env_schedule(state, chan, state->odometer);
     break;
   case 0x0A: // AmpEnv2
     if(mask & 0x00FF) {
@@ -953,6 +1598,8 @@ static void chan_scsp_store_reg(struct YAM_STATE *state, uint8 ch, uint8 a, uint
       chan->krs = (d >> 10) & 0xF;
       chan->link = (d >> 14) & 1;
     }
+    env_schedule(state, chan, state->odometer);
+    lpf_schedule(state, chan, state->odometer);
     break;
   case 0x0C: // TotalLevel
     if(mask & 0x00FF) {
@@ -974,6 +1621,7 @@ static void chan_scsp_store_reg(struct YAM_STATE *state, uint8 ch, uint8 a, uint
       chan->mdxsl |= (d >> 6) & 0x3C;
       chan->mdl = (d >> 12) & 0xF;
     }
+    state->render_order_valid = 0;
     break;
   case 0x10: // SampleRatePitch
     if(mask & 0x00FF) {
@@ -985,6 +1633,8 @@ static void chan_scsp_store_reg(struct YAM_STATE *state, uint8 ch, uint8 a, uint
       chan->fns |= d & 0x700;
       chan->oct = (d >> 11) & 0xF;
     }
+    env_schedule(state, chan, state->odometer);
+    lpf_schedule(state, chan, state->odometer);
     break;
   case 0x12: // LFOControl
     if(mask & 0x00FF) {
@@ -1008,9 +1658,11 @@ static void chan_scsp_store_reg(struct YAM_STATE *state, uint8 ch, uint8 a, uint
   case 0x16: // SendLevels
     if(mask & 0x00FF) {
       if(ch < 18) {
+        uint8 oldsdl = state->efsdl[ch];
         state->efpan[ch] = d & 0x1F;
         state->efsdl[ch] = (d >> 4) & 0xE;
         if(state->efsdl[ch]) state->efsdl[ch] |= 1;
+        if((!oldsdl) != (!(state->efsdl[ch]))) { state->dsp_analysis_valid = 0; }
       }
     }
     if(mask & 0xFF00) {
@@ -1111,38 +1763,56 @@ static void chan_aica_store_reg(struct YAM_STATE *state, uint8 ch, uint8 a, uint
   struct YAM_CHAN *chan;
   a &= 0x7C;
   if(a >= 0x48) return;
-  yam_flush(YAMSTATE);
+  // Key on/off affects every channel; anything else only needs this one
+  if(a == 0x00 && (mask & 0xFF00) && (d & 0x8000)) {
+    yam_flush(YAMSTATE);
+  } else {
+    chan_sync(state, state->chan + (((uint32)ch) & 0x3F));
+  }
   chan = state->chan + (((uint32)ch) & 0x3F);
   switch(a) {
   case 0x00: // PlayControl
-    if(mask & 0x00FF) {
-      chan->sampleaddr &= 0xFFFF;
-      chan->sampleaddr |= (((uint32)d) & 0x7F) << 16;
-      chan->pcms &= 2;
-      chan->pcms |= (d >> 7) & 1;
+    { uint32 oldsampleaddr = chan->sampleaddr;
+      uint8 oldpcms = chan->pcms;
+      if(mask & 0x00FF) {
+        chan->sampleaddr &= 0xFFFF;
+        chan->sampleaddr |= (((uint32)d) & 0x7F) << 16;
+        chan->pcms &= 2;
+        chan->pcms |= (d >> 7) & 1;
+      }
+      if(mask & 0xFF00) {
+        chan->pcms &= 1;
+        chan->pcms |= (d >> 7) & 2;
+      }
+      if(chan->sampleaddr != oldsampleaddr || chan->pcms != oldpcms) { chan->adpcmcache_slot = 0; }
     }
     if(mask & 0xFF00) {
-      chan->pcms &= 1;
-      chan->pcms |= (d >> 7) & 2;
       chan->sampler_looptype = (d >> 9) & 1;
       chan->ssctl = (d >> 10) & 1;
       chan->kyonb = (d >> 14) & 1;
       if(d & 0x8000) { // kyonex
         int ch;
         for(ch = 0; ch < 64; ch++) {
-          if(state->chan[ch].kyonb) { keyon(state->chan + ch); }
-          else { keyoff(state->chan + ch); }
+          if(state->chan[ch].kyonb) { keyon(state, state->chan + ch); }
+          else { keyoff(state, state->chan + ch); }
         }
       }
     }
     break;
   case 0x04: // SampleAddrLow
-    chan->sampleaddr &= (0x7FFFFF ^ mask);
-    chan->sampleaddr |= (d & mask);
+    { uint32 oldsampleaddr = chan->sampleaddr;
+      chan->sampleaddr &= (0x7FFFFF ^ mask);
+      chan->sampleaddr |= (d & mask);
+      if(chan->sampleaddr != oldsampleaddr) { chan->adpcmcache_slot = 0; }
+    }
     break;
   case 0x08: // LoopStart
-    chan->loopstart &= (0xFFFF ^ mask);
-    chan->loopstart |= (d & mask);
+    { sint32 oldloopstart = chan->loopstart;
+      chan->loopstart &= (0xFFFF ^ mask);
+      chan->loopstart |= (d & mask);
+      // saved loop-start predictor state would no longer match the entry
+      if(chan->loopstart != oldloopstart) { chan->adpcmcache_slot = 0; }
+    }
     break;
   case 0x0C: // LoopEnd
     chan->loopend &= (0xFFFF ^ mask);
@@ -1159,6 +1829,7 @@ static void chan_aica_store_reg(struct YAM_STATE *state, uint8 ch, uint8 a, uint
       chan->ar[1] |= (d >> 6) & 0x1C;
       chan->ar[2] = (d >> 11) & 0x1F;
     }
+    env_schedule(state, chan, state->odometer);
     break;
   case 0x14: // AmpEnv2
     if(mask & 0x00FF) {
@@ -1172,6 +1843,8 @@ static void chan_aica_store_reg(struct YAM_STATE *state, uint8 ch, uint8 a, uint
       chan->krs = (d >> 10) & 0xF;
       chan->link = (d >> 14) & 1;
     }
+    env_schedule(state, chan, state->odometer);
+    lpf_schedule(state, chan, state->odometer);
     break;
   case 0x18: // SampleRatePitch
     if(mask & 0x00FF) {
@@ -1183,6 +1856,8 @@ static void chan_aica_store_reg(struct YAM_STATE *state, uint8 ch, uint8 a, uint
       chan->fns |= d & 0x700;
       chan->oct = (d >> 11) & 0xF;
     }
+    env_schedule(state, chan, state->odometer);
+    lpf_schedule(state, chan, state->odometer);
     break;
   case 0x1C: // LFOControl
     if(mask & 0x00FF) {
@@ -1234,10 +1909,12 @@ static void chan_aica_store_reg(struct YAM_STATE *state, uint8 ch, uint8 a, uint
   case 0x40: // LPF7
     if(mask & 0x00FF) { chan->fr[1] = (d >> 0) & 0x1F; }
     if(mask & 0xFF00) { chan->fr[0] = (d >> 8) & 0x1F; }
+    lpf_schedule(state, chan, state->odometer);
     break;
   case 0x44: // LPF8
     if(mask & 0x00FF) { chan->fr[3] = (d >> 0) & 0x1F; }
     if(mask & 0xFF00) { chan->fr[2] = (d >> 8) & 0x1F; }
+    lpf_schedule(state, chan, state->odometer);
     break;
   }
 }
@@ -1247,35 +1924,29 @@ static void chan_aica_store_reg(struct YAM_STATE *state, uint8 ch, uint8 a, uint
 // DSP registers
 //
 static void coef_write(struct YAM_STATE *state, uint32 n, uint32 d, uint32 mask) {
-#ifdef ENABLE_DYNAREC
-  sint16 old = state->coef[n];
-#endif
+  sint32 old = state->coef[n];
   yam_flush(state);
   n &= 0x7F;
   state->coef[n] <<= 3;
   state->coef[n] &= ~mask;
   state->coef[n] |= d & mask;
   state->coef[n] = ((sint16)(state->coef[n])) >> 3;
-#ifdef ENABLE_DYNAREC
-  if(old != state->coef[n]) { state->dsp_dyna_valid = 0; }
-#endif
+  // read straight from here by all DSP code, nothing to rebuild
+  if(old != state->coef[n]) { state->dsp_info[YAM_DSPINFO_PATCHES]++; }
 }
 
 static void madrs_write(struct YAM_STATE *state, uint32 n, uint32 d, uint32 mask) {
-#ifdef ENABLE_DYNAREC
   uint16 old = state->madrs[n];
-#endif
   yam_flush(state);
   n &= 0x3F;
   state->madrs[n] &= ~mask;
   state->madrs[n] |= d & mask;
-#ifdef ENABLE_DYNAREC
-  if(old != state->madrs[n]) { state->dsp_dyna_valid = 0; }
-#endif
+  if(old != state->madrs[n]) { state->dsp_info[YAM_DSPINFO_PATCHES]++; }
 }
 
 static uint32 temp_read(struct YAM_STATE *state, uint32 n) {
   yam_flush(state);
+  dsp_regs_observed(state);
   if((n & 1) == 0) { return ((state->temp[(n/2)&0x7F]) >> 0) & 0x00FF; }
   else             { return ((state->temp[(n/2)&0x7F]) >> 8) & 0xFFFF; }
 }
@@ -1296,6 +1967,7 @@ static void temp_write(struct YAM_STATE *state, uint32 n, uint32 d, uint32 mask)
 
 static uint32 mems_read(struct YAM_STATE *state, uint32 n) {
   yam_flush(state);
+  dsp_regs_observed(state);
   if((n & 1) == 0) { return ((state->inputs[(n/2)&0x1F]) >> 0) & 0x00FF; }
   else             { return ((state->inputs[(n/2)&0x1F]) >> 8) & 0xFFFF; }
 }
@@ -1323,6 +1995,7 @@ static uint32 mixs_read(struct YAM_STATE *state, uint32 n) {
 
 static uint32 efreg_read(struct YAM_STATE *state, uint32 n) {
   yam_flush(state);
+  dsp_regs_observed(state);
   return ((uint32)(state->efreg[n & 0xF])) & 0xFFFF;
 }
 
@@ -1384,9 +2057,8 @@ static void dsp_scsp_store_reg(
     if(newvalue != oldvalue) {
       yam_flush(state);
       mpro_scsp_write(state->mpro + index64, newvalue);
-#ifdef ENABLE_DYNAREC
-      state->dsp_dyna_valid = 0;
-#endif
+      state->dsp_analysis_valid = 0;
+      dsp_program_changed(state);
     }
     return;
   }
@@ -1437,9 +2109,8 @@ static void dsp_aica_store_reg(
     if(newvalue != oldvalue) {
       yam_flush(state);
       mpro_aica_write(state->mpro + index64, newvalue);
-#ifdef ENABLE_DYNAREC
-      state->dsp_dyna_valid = 0;
-#endif
+      state->dsp_analysis_valid = 0;
+      dsp_program_changed(state);
     }
     return;
   }
@@ -1461,7 +2132,7 @@ uint32 EMU_CALL yam_scsp_load_reg(void *state, uint32 a, uint32 mask) {
   a &= 0xFFE;
   if(a <  0x400) return chan_scsp_load_reg(YAMSTATE, a>>5, a&0x1E) & mask;
   if(a >= 0x700) return dsp_scsp_load_reg(YAMSTATE, a) & mask;
-  if(a >= 0x600) return YAMSTATE->ringbuf[(YAMSTATE->bufptr-64+(a-0x600)/2)&(32*RINGMAX-1)] & mask;
+  if(a >= 0x600) return RINGBUF(YAMSTATE)[(YAMSTATE->bufptr-64+(a-0x600)/2)&YAMSTATE->ring_mask] & mask;
   switch(a) {
   case 0x400: d = 0x0010; break; // MasterVolume (actually returns the LSI version)
   case 0x402: // RingBufferAddress
@@ -1473,7 +2144,7 @@ uint32 EMU_CALL yam_scsp_load_reg(void *state, uint32 a, uint32 mask) {
   case 0x408: // CallAddress (playpos in increments of 4K)
     { int c = (YAMSTATE->mslc) & 0x1F;
 
-      if(YAMSTATE->out_pending > 0) yam_flush(YAMSTATE);
+      status_sync(YAMSTATE, YAMSTATE->chan + c);
 
       d = calculate_playpos(YAMSTATE, YAMSTATE->chan + c);
       d &= 0xF000; d >>= 5;
@@ -1615,7 +2286,7 @@ void EMU_CALL yam_scsp_store_reg(void *state, uint32 a, uint32 d, uint32 mask, u
   mask &= 0xFFFF;
   if(a <  0x400) { chan_scsp_store_reg(YAMSTATE, a>>5, a&0x1E, d, mask); return; }
   if(a >= 0x700) { dsp_scsp_store_reg(YAMSTATE, a, d, mask); return; }
-  if(a >= 0x600) { uint32 offset = (YAMSTATE->bufptr-64+(a-0x600)/2)&(32*RINGMAX-1); YAMSTATE->ringbuf[offset] = (d & mask) | (YAMSTATE->ringbuf[offset] & ~mask); return; }
+  if(a >= 0x600) { uint32 offset = (YAMSTATE->bufptr-64+(a-0x600)/2)&YAMSTATE->ring_mask; RINGBUF(YAMSTATE)[offset] = (d & mask) | (RINGBUF(YAMSTATE)[offset] & ~mask); return; }
   switch(a) {
   case 0x400: // MasterVolume
     yam_flush(YAMSTATE);
@@ -1641,9 +2312,7 @@ void EMU_CALL yam_scsp_store_reg(void *state, uint32 a, uint32 d, uint32 mask, u
         YAMSTATE->rbp = oldrbp;
         YAMSTATE->rbl = oldrbl;
         yam_flush(YAMSTATE);
-#ifdef ENABLE_DYNAREC
-        YAMSTATE->dsp_dyna_valid = 0;
-#endif
+        dsp_program_changed(YAMSTATE);
         YAMSTATE->rbp = newrbp;
         YAMSTATE->rbl = newrbl;
       }
@@ -1737,7 +2406,7 @@ uint32 EMU_CALL yam_aica_load_reg(void *state, uint32 a, uint32 mask) {
   case 0x280C: d = 0; break; // ChnInfoReq, always seems to return 0 when read
   case 0x2810: // PlayStatus
 //    if(YAMSTATE->out_pending > 100) yam_flush(YAMSTATE);
-    if(YAMSTATE->out_pending > 0) yam_flush(YAMSTATE);
+    status_sync(YAMSTATE, YAMSTATE->chan + ((YAMSTATE->mslc) & 0x3F));
     { int c = (YAMSTATE->mslc) & 0x3F;
       d  = (((uint32)(YAMSTATE->chan[c].lp      )) & 1) << 15;
       if(YAMSTATE->afsel == 0) {
@@ -1791,9 +2460,15 @@ void EMU_CALL yam_aica_store_reg(void *state, uint32 a, uint32 d, uint32 mask, u
   if(a <  0x2000) { chan_aica_store_reg(YAMSTATE, a>>7, a&0x7C, d, mask); return; }
   if(a >= 0x3000) { dsp_aica_store_reg(YAMSTATE, a, d, mask); return; }
   if(a <  0x2048) {
+    flush_to_sync(YAMSTATE);
     if(mask & 0x00FF) { YAMSTATE->efpan[(a - 0x2000) / 4] = d & 0x1F; }
-    if(mask & 0xFF00) { YAMSTATE->efsdl[(a - 0x2000) / 4] = (d >> 8) & 0x0F; }
-    return;
+    if(mask & 0xFF00) {
+      uint8 *efsdl = YAMSTATE->efsdl + (a - 0x2000) / 4;
+      uint8 newsdl = (d >> 8) & 0x0F;
+      if((!(*efsdl)) != (!newsdl)) { YAMSTATE->dsp_analysis_valid = 0; }
+      *efsdl = newsdl;
+    }
+    return;
   }
   switch(a) {
   case 0x2800: // MasterVolume
@@ -1827,9 +2502,9 @@ void EMU_CALL yam_aica_store_reg(void *state, uint32 a, uint32 d, uint32 mask, u
         YAMSTATE->rbp = oldrbp;
         YAMSTATE->rbl = oldrbl;
         yam_flush(YAMSTATE);
-#ifdef ENABLE_DYNAREC
-        YAMSTATE->dsp_dyna_valid = 0;
-#endif
+        // cached regions were only checked against the old ring buffer
+        adpcmcache_flush(YAMSTATE);
+        dsp_program_changed(YAMSTATE);
         YAMSTATE->rbp = newrbp;
         YAMSTATE->rbl = newrbl;
       }
@@ -1927,47 +2602,6 @@ static uint32 yamrand16(struct YAM_STATE *state) {
   return state->randseed >> 16;
 }
 
-/////////////////////////////////////////////////////////////////////////////
-//
-// Envelope-related calculations
-//
-
-//
-// Adjust actual rate to get effective rate
-//
-static uint32 env_adjustrate(struct YAM_CHAN *chan, uint32 rate) {
-  sint32 effrate = rate * 2;
-  if(chan->krs < 0xF) {
-    effrate += (chan->fns >> 9) & 1;
-    effrate += chan->krs * 2;
-    effrate = (effrate - 8) + (chan->oct ^ 8);
-  }
-  // Clipping is important because of the table lookups
-  if(effrate <= 0) return 0;
-  if(effrate >= 0x3C) return 0x3C;
-  return effrate;
-}
-
-//
-// Determine whether a step is going to occur here
-//
-static int env_needstep(uint32 effrate, uint32 odometer) {
-  uint32 shift;
-  uint32 pattern;
-  uint32 bitplace;
-  if(effrate <= 0x01) return 0;
-  if(effrate >= 0x30) return ((odometer & 1) == 0);
-  shift = 12 - ((effrate - 1) >> 2);
-  pattern = (effrate - 1) & 3;
-  if(odometer & ((1<<shift)-1)) return 0;
-  bitplace = (odometer >> shift) & 7;
-  return (0xFFFDDDD5 >> (pattern * 8 + bitplace)) & 1;
-  // 11010101 0x01 each bit is 4096 samples
-  // 11011101 0x02
-  // 11111101 0x03
-  // 11111111 0x04
-}
-
 /////////////////////////////////////////////////////////////////////////////
 //
 // Read next sample
@@ -2024,6 +2658,17 @@ static void readnextsample(
     s <<= 8;
     break;
   case 2: // 4-bit ADPCM
+    if(chan->adpcmcache_slot) {
+      struct YAM_ADPCMCACHE_ENTRY *e = state->adpcmcache + (chan->adpcmcache_slot - 1);
+      uint32 p = chan->playpos;
+      if(p < e->decoded) {
+        struct YAM_ADPCMCACHE_SAMPLE *c = ADPCMCACHE_ARENA(state) + e->base + p;
+        chan->adpcmstep = c->step;
+        chan->adpcmprev = c->s;
+        s = c->s;
+        break;
+      }
+    }
     s = *(uint8*)(((uint8*)(state->ram_ptr)) + (((chan->sampleaddr + (chan->playpos >> 1)) ^ (state->mem_byte_address_xor)) & (state->ram_mask)));
     s >>= 4 * ((chan->playpos & 1) ^ 0);
     s &= 0xF;
@@ -2039,6 +2684,7 @@ static void readnextsample(
       chan->adpcmprev = out;
       s = out;
     }
+    if(chan->adpcmcache_slot) { adpcmcache_store(state, chan); }
     break;
   }
   switch(chan->ssctl) {
@@ -2086,211 +2732,419 @@ done:
 
 /////////////////////////////////////////////////////////////////////////////
 //
-// Generate samples
-// Samples are returned in 20-bit format
-// Returns the number of samples actually generated
+// SCSP FM: modulated sample fetch
 //
-static uint32 generate_samples(
+// Loads the two samples around the modulated play position straight into
+// the interpolation pair.  Same result as readnextsample(..., smp, 0)
+// followed by readnextsample(..., smp+1, 0), without going through the
+// loop/ADPCM/advance logic each time.  Noise-sourced channels keep using
+// readnextsample so they draw from the generator in the same order.
+//
+static EMU_INLINE void chan_ring_fetch(
   struct YAM_STATE *state,
   struct YAM_CHAN *chan,
-  sint32 *buf,
-  uint32 odometer,
-  uint32 samples
+  sint32 smp
 ) {
-  uint32 g;
-  uint32 base_phaseinc;
-  uint32 lfophaseinc = lfophaseinctable[chan->lfof];
-  uint32 bufptrsave = state->bufptr;
-
-//gfreq[samples]++;
-
-//printf("generate_samples(%08X,%08X,%u)\n",chan,buf,samples);
-
-  { uint32 oct = chan->oct^8;
-    uint32 fns = chan->fns^0x400;
-    base_phaseinc = fns << oct;
-    // weird ADPCM thing mentioned in official doc
-    if(chan->pcms == 2 && oct >= 0xA) { base_phaseinc <<= 1; }
+  sint32 s0, s1;
+  if(chan->ssctl != 0) {
+    readnextsample(state, chan, smp, 0);
+    readnextsample(state, chan, smp+1, 0);
+    return;
+  }
+  if(!(chan->sampler_dir)) {
+    s0 = 0;
+    s1 = 0;
+  } else if(chan->pcms == 0) { // 16-bit signed LSB-first
+    uint32 a = chan->sampleaddr + 2 * (chan->playpos + smp);
+    s0 = *(sint16*)(((sint8*)(state->ram_ptr)) + (((a    ) ^ (state->mem_word_address_xor)) & (state->ram_mask)));
+    s1 = *(sint16*)(((sint8*)(state->ram_ptr)) + (((a + 2) ^ (state->mem_word_address_xor)) & (state->ram_mask)));
+    s0 ^= chan->sampler_invert;
+    s1 ^= chan->sampler_invert;
+  } else { // 8-bit signed
+    uint32 a = chan->sampleaddr + chan->playpos + smp;
+    s0 = *(sint8*)(((sint8*)(state->ram_ptr)) + (((a    ) ^ (state->mem_byte_address_xor)) & (state->ram_mask)));
+    s1 = *(sint8*)(((sint8*)(state->ram_ptr)) + (((a + 1) ^ (state->mem_byte_address_xor)) & (state->ram_mask)));
+    s0 ^= chan->sampler_invert >> 8;
+    s1 ^= chan->sampler_invert >> 8;
+    s0 <<= 8;
+    s1 <<= 8;
   }
+  chan->samplebufcur = s0;
+  chan->samplebufnext = s1;
+}
 
-  for(g = 0; g < samples; g++) {
-//buf[g]=g*100;continue;
-    //
-    // If the amp envelope is inactive, quit
-    //
-    if(chan->envlevel >= 0x3C0) {
-      chan->envlevel = 0x1FFF;
+/////////////////////////////////////////////////////////////////////////////
+//
+// Per-sample channel helpers
+// Shared by the scalar reference renderer and the SIMD lane renderer
+//
+
+//
+// Compute the log attenuation for the current sample (amp envelope + TL +
+// amplitude LFO).  Values >= 0x3C0 mean silence.
+//
+static EMU_INLINE uint32 chan_attenuation(
+  struct YAM_STATE *state,
+  struct YAM_CHAN *chan,
+  uint32 shape
+) {
+  uint32 attenuation;
+  attenuation = ((uint32)(chan->tl)) << 2;
+  attenuation += ((uint32)(chan->envlevel)) & ((uint32)(chan->envlevelmask[chan->envstate]));
+  // LFO amplitude modulation
+  if(shape & YAM_SHAPE_ALFO) {
+    uint32 att_wave_y = 0;
+    switch(chan->alfows) {
+    case 0: // sawtooth
+      att_wave_y = ((uint32)(chan->lfophase)) >> 24;
+      break;
+    case 1: // square
+      att_wave_y = (((sint32)(chan->lfophase)) >> 31) & 0xFF;
+      break;
+    case 2: // triangle
+      att_wave_y = (chan->lfophase >> 23) & 0xFF;
+      if(chan->lfophase & 0x80000000) { att_wave_y ^= 0xFF; }
+      break;
+    case 3: // noise
+      att_wave_y = yamrand16(state) & 0xFF;
       break;
     }
-    //
-    // If we must generate a sample, generate it
-    //
-    if(buf) {
-      sint32 s, s_cur, s_next, f;
-      // Apply SCSP ring modulation, if necessary
-      if(state->version==1 && (chan->mdl!=0 || chan->mdxsl!=0 || chan->mdysl!=0)) {
-        sint32 smp=(state->ringbuf[(state->bufptr-64+chan->mdxsl)&(32*RINGMAX-1)]+state->ringbuf[(state->bufptr-64+chan->mdysl)&(32*RINGMAX-1)])/2;
-        smp<<=0xA; // associate cycle with 1024
-        smp>>=0x1A-chan->mdl; // ex. for MDL=0xF, sample range corresponds to +/- 64 pi (32=2^5 cycles) so shift by 11 (16-5 == 0x1A-0xF)
-        readnextsample(state, chan, smp, 0);
-        readnextsample(state, chan, smp+1, 0);
-      }
-      // Generate interpolated sample
-      s_cur  = chan->samplebufcur;
-      s_next = chan->samplebufnext;
-      f = ((chan->frcphase) >> 4) & 0x3FFF;
-      s = (s_next * f) + (s_cur * (0x4000-f));
-      s >>= 14; // s is 16-bit
-      // Apply attenuation, if we want it
-      if(!(chan->voff)) {
-        uint32 attenuation;
-        sint32 linearvol;
-        attenuation = ((uint32)(chan->tl)) << 2;
-        attenuation += ((uint32)(chan->envlevel)) & ((uint32)(chan->envlevelmask[chan->envstate]));
-        // LFO amplitude modulation
-        if(chan->alfos) {
-          uint32 att_wave_y = 0;
-          switch(chan->alfows) {
-          case 0: // sawtooth
-            att_wave_y = ((uint32)(chan->lfophase)) >> 24;
-            break;
-          case 1: // square
-            att_wave_y = (((sint32)(chan->lfophase)) >> 31) & 0xFF;
-            break;
-          case 2: // triangle
-            att_wave_y = (chan->lfophase >> 23) & 0xFF;
-            if(chan->lfophase & 0x80000000) { att_wave_y ^= 0xFF; }
-            break;
-          case 3: // noise
-            att_wave_y = yamrand16(state) & 0xFF;
-            break;
-          }
-          attenuation += (att_wave_y >> (7 - (chan->alfos)));
-        }
-        if(attenuation >= 0x3C0) {
-          s = 0;
-        } else {
-          // Convert log attenuation to linear volume
-          linearvol = ((attenuation & 0x3F) ^ 0x7F) + 1;
-          s *= linearvol; s >>= 7 + (attenuation >> 6);
-        }
-      }
-      // Store in ring modulation buffer, if we're SCSP and it's enabled
-      if(state->version == 1 && !chan->stwinh) {
-        state->ringbuf[state->bufptr] = s;
-      }
-      // Apply filter, if we want it
-      if(!(chan->lpoff)) {
-        uint32 fv = chan->lpflevel;
-        uint32 qv = chan->q & 0x1F;
-        sint32 f = (((fv & 0xFF) | 0x100) << 4) >> ((fv >> 8) ^ 0x1F);
-        sint32 q = qtable[qv];
-        s = f * s + (0x2000 - f + q) * (chan->lpp1) - q * (chan->lpp2);
-        s >>= 13;
-        chan->lpp2 = chan->lpp1;
-        chan->lpp1 = s;
+    attenuation += (att_wave_y >> (7 - (chan->alfos)));
+  }
+  return attenuation;
+}
+
+//
+// Lowpass filter coefficient for the current filter envelope level
+//
+static EMU_INLINE sint32 chan_lpf_coef(struct YAM_STATE *state, struct YAM_CHAN *chan) {
+  uint32 fv = chan->lpflevel;
+  return (((fv & 0xFF) | 0x100) << 4) >> ((fv >> 8) ^ 0x1F);
+}
+
+//
+// Advance the channel's LFO phase, and step the amplitude and filter
+// envelopes if a step is due
+//
+static EMU_INLINE void chan_advance_env(
+  struct YAM_STATE *state,
+  struct YAM_CHAN *chan,
+  uint32 odometer,
+  uint32 lfophaseinc
+) {
+  //
+  // Advance LFO phase
+  //
+  chan->lfophase += lfophaseinc;
+  //
+  // Advance amplitude envelope, if a step is due
+  //
+  if(odometer == chan->envnext) {
+    uint32 effectiverate = chan->envrate;
+    if(env_needstep(effectiverate, odometer)) {
+      switch(chan->envstate) {
+      case 0: // attack
+        chan->envlevel -= (chan->envlevel >> envattackshift[effectiverate][odometer&3]) + 1;
+        if(chan->envlevel == 0) { chan->envstate = 1; }
+        break;
+      case 1: // decay
+        chan->envlevel += envdecayvalue[effectiverate][odometer&3];
+        if((chan->envlevel >> 5) >= chan->dl) { chan->envstate = 2; }
+        break;
+      case 2: // sustain
+      case 3: // release
+        chan->envlevel += envdecayvalue[effectiverate][odometer&3];
+        break;
       }
-      // Write output
-      s <<= 4;
-      buf[g] = s;
     }
-    state->bufptr = (state->bufptr + 32) & (32*RINGMAX-1);
-    //
-    // Now we need to advance the channel state machine, regardless of
-    // whether we're generating output or not
-    //
-    //
-    // Advance LFO phase
-    //
-    chan->lfophase += lfophaseinc;
-    //
-    // Advance amplitude envelope
-    //
-    { uint32 effectiverate = env_adjustrate(chan, chan->ar[chan->envstate]);
-      if(env_needstep(effectiverate, odometer)) {
-        switch(chan->envstate) {
-        case 0: // attack
-          chan->envlevel -= (chan->envlevel >> envattackshift[effectiverate][odometer&3]) + 1;
-          if(chan->envlevel == 0) { chan->envstate = 1; }
-          break;
-        case 1: // decay
-          chan->envlevel += envdecayvalue[effectiverate][odometer&3];
-          if((chan->envlevel >> 5) >= chan->dl) { chan->envstate = 2; }
-          break;
-        case 2: // sustain
-        case 3: // release
-          chan->envlevel += envdecayvalue[effectiverate][odometer&3];
-          break;
-        }
+    env_schedule(state, chan, odometer + 1);
+  }
+  //
+  // Advance filter envelope, if a step is due
+  //
+  if(odometer == chan->lpfnext) {
+    uint32 effectiverate = chan->lpfrate;
+    if(env_needstep(effectiverate, odometer)) {
+      uint32 d = envdecayvalue[effectiverate][odometer&3];
+      uint32 target = chan->flv[chan->lpfstate+1];
+      if(chan->lpflevel < target) {
+        uint32 maxd = target - chan->lpflevel;
+        if(d > maxd) { d = maxd; }
+        chan->lpflevel += d;
+      } else if(chan->lpflevel > target) {
+        uint32 maxd = chan->lpflevel - target;
+        if(d > maxd) { d = maxd; }
+        chan->lpflevel -= d;
+      } else {
+        if(chan->lpfstate < 3) { chan->lpfstate++; }
       }
     }
-    //
-    // Advance filter envelope
-    //
-    { uint32 effectiverate = env_adjustrate(chan, chan->fr[chan->lpfstate]);
-      if(env_needstep(effectiverate, odometer)) {
-        uint32 d = envdecayvalue[effectiverate][odometer&3];
-        uint32 target = chan->flv[chan->lpfstate+1];
-        if(chan->lpflevel < target) {
-          uint32 maxd = target - chan->lpflevel;
-          if(d > maxd) { d = maxd; }
-          chan->lpflevel += d;
-        } else if(chan->lpflevel > target) {
-          uint32 maxd = chan->lpflevel - target;
-          if(d > maxd) { d = maxd; }
-          chan->lpflevel -= d;
-        } else {
-          if(chan->lpfstate < 3) { chan->lpfstate++; }
-        }
-      }
+    lpf_schedule(state, chan, odometer + 1);
+  }
+}
+
+//
+// Phase increment with LFO pitch shifting applied
+// Must be called after the LFO phase has been advanced for this sample
+//
+static EMU_INLINE uint32 chan_pitch_lfo(
+  struct YAM_STATE *state,
+  struct YAM_CHAN *chan,
+  uint32 base_phaseinc
+) {
+  uint32 pitch_wave_y = 0;
+  uint32 maxvary, scaled_pitch_wave_y;
+  switch(chan->plfows) {
+  case 0: // sawtooth
+    pitch_wave_y = chan->lfophase ^ 0x80000000;
+    break;
+  case 1: // square
+    pitch_wave_y = (chan->lfophase & 0x80000000) ? 0 : 0xFFFFFFFF;
+    break;
+  case 2: // triangle
+    pitch_wave_y = (chan->lfophase << 1) + 0x80000000;
+    if(chan->lfophase >= 0x40000000 && chan->lfophase < 0xC0000000) {
+      pitch_wave_y = ~pitch_wave_y;
     }
-    //
-    // Advance the sample phase
-    //
-    { uint32 realphaseinc = base_phaseinc;
-      //
-      // LFO pitch shifting
-      //
-      if(chan->plfos) {
-        uint32 pitch_wave_y = 0;
-        switch(chan->plfows) {
-        case 0: // sawtooth
-          pitch_wave_y = chan->lfophase ^ 0x80000000;
-          break;
-        case 1: // square
-          pitch_wave_y = (chan->lfophase & 0x80000000) ? 0 : 0xFFFFFFFF;
-          break;
-        case 2: // triangle
-          pitch_wave_y = (chan->lfophase << 1) + 0x80000000;
-          if(chan->lfophase >= 0x40000000 && chan->lfophase < 0xC0000000) {
-            pitch_wave_y = ~pitch_wave_y;
-          }
-          break;
-        case 3: // noise
-          pitch_wave_y = yamrand16(state) << 16;
-          break;
-        }
-        { uint32 maxvary = base_phaseinc >> (10-(chan->plfos));
-          uint32 scaled_pitch_wave_y =
-            (((uint64)(maxvary*2)) * ((uint64)pitch_wave_y)) >> 32;
-          realphaseinc = base_phaseinc + scaled_pitch_wave_y - maxvary;
-        }
-      }
-      //
-      // Advance phase, and read new sample data if necessary
-      //
-      chan->frcphase += realphaseinc;
-      while(chan->frcphase >= 0x40000) {
-        chan->frcphase -= 0x40000;
-        readnextsample(state, chan, 0, 1);
-      }
+    break;
+  case 3: // noise
+    pitch_wave_y = yamrand16(state) << 16;
+    break;
+  }
+  maxvary = base_phaseinc >> (10-(chan->plfos));
+  scaled_pitch_wave_y = (((uint64)(maxvary*2)) * ((uint64)pitch_wave_y)) >> 32;
+  return base_phaseinc + scaled_pitch_wave_y - maxvary;
+}
+
+//
+// Advance the sample phase, and read new sample data if necessary
+//
+static EMU_INLINE void chan_advance_phase(
+  struct YAM_STATE *state,
+  struct YAM_CHAN *chan,
+  uint32 odometer,
+  uint32 realphaseinc
+) {
+  chan->frcphase += realphaseinc;
+  if(chan->frcphase >= 0x40000) {
+    uint8 envstate = chan->envstate;
+    do {
+      chan->frcphase -= 0x40000;
+      readnextsample(state, chan, 0, 1);
+    } while(chan->frcphase >= 0x40000);
+    // Envelope link may have ended the attack
+    if(chan->envstate != envstate) { env_schedule(state, chan, odometer + 1); }
+  }
+}
+
+//
+// Advance the channel state machine by one sample: LFO, amplitude and
+// filter envelopes, and sample phase
+// The pitch LFO test folds away when the shape is a constant
+//
+static EMU_INLINE void chan_advance(
+  struct YAM_STATE *state,
+  struct YAM_CHAN *chan,
+  uint32 shape,
+  uint32 odometer,
+  uint32 base_phaseinc,
+  uint32 lfophaseinc
+) {
+  chan_advance_env(state, chan, odometer, lfophaseinc);
+  chan_advance_phase(state, chan, odometer,
+    (shape & YAM_SHAPE_PLFO) ? chan_pitch_lfo(state, chan, base_phaseinc) : base_phaseinc
+  );
+}
+
+//
+// Voice shape: the configuration bits that select a specialized inner loop
+// Computed once per channel per render block
+//
+static EMU_INLINE uint32 chan_shape(struct YAM_STATE *state, struct YAM_CHAN *chan) {
+  uint32 shape = 0;
+  if(chan->voff) { shape |= YAM_SHAPE_VOFF; }
+  if(chan->alfos) { shape |= YAM_SHAPE_ALFO; }
+  if(chan->plfos) { shape |= YAM_SHAPE_PLFO; }
+  if(!(chan->lpoff)) { shape |= YAM_SHAPE_LPF; }
+  if(state->version == 1 && (chan->mdl != 0 || chan->mdxsl != 0 || chan->mdysl != 0)) {
+    shape |= YAM_SHAPE_RING;
+  }
+  return shape;
+}
+
+//
+// Base phase increment from OCT/FNS
+//
+static EMU_INLINE uint32 chan_base_phaseinc(struct YAM_CHAN *chan) {
+  uint32 oct = chan->oct^8;
+  uint32 fns = chan->fns^0x400;
+  uint32 base_phaseinc = fns << oct;
+  // weird ADPCM thing mentioned in official doc
+  if(chan->pcms == 2 && oct >= 0xA) { base_phaseinc <<= 1; }
+  return base_phaseinc;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Generate samples
+// Samples are returned in 20-bit format
+// Returns the number of samples actually generated
+//
+// This is the scalar reference renderer; the SIMD lane renderer below must
+// produce bit-identical output.
+//
+// One copy is instantiated per voice shape (N), so the per-sample
+// configuration tests fold away at compile time.
+//
+typedef uint32 (*generate_samples_t)(
+  struct YAM_STATE *state,
+  struct YAM_CHAN *chan,
+  sint32 *buf,
+  uint32 odometer,
+  uint32 samples
+);
+
+#define GENSAMPLES(N) \
+static uint32 generate_samples##N( \
+  struct YAM_STATE *state, \
+  struct YAM_CHAN *chan, \
+  sint32 *buf, \
+  uint32 odometer, \
+  uint32 samples \
+) { \
+  uint32 g; \
+  uint32 base_phaseinc = chan_base_phaseinc(chan); \
+  uint32 lfophaseinc = lfophaseinctable[chan->lfof]; \
+  uint32 bufptrsave = state->bufptr; \
+  uint8 ringstore = (state->version == 1 && !chan->stwinh); \
+  uint32 ringx = chan->mdxsl - 64; \
+  uint32 ringy = chan->mdysl - 64; \
+  uint32 mdshift = 0x1A - chan->mdl; \
+  for(g = 0; g < samples; g++) { \
+    /* If the amp envelope is inactive, quit */ \
+    if(chan->envlevel >= 0x3C0) { \
+      chan->envlevel = 0x1FFF; \
+      chan->lp = 1; \
+      break; \
+    } \
+    /* If we must generate a sample, generate it */ \
+    if(buf) { \
+      sint32 s, s_cur, s_next, f; \
+      /* Apply SCSP ring modulation, if necessary */ \
+      if((N) & YAM_SHAPE_RING) { \
+        sint32 smp=(RINGBUF(state)[(state->bufptr+ringx)&state->ring_mask]+RINGBUF(state)[(state->bufptr+ringy)&state->ring_mask])/2; \
+        smp<<=0xA; /* associate cycle with 1024 */ \
+        smp>>=mdshift; /* ex. for MDL=0xF, sample range corresponds to +/- 64 pi (32=2^5 cycles) so shift by 11 (16-5 == 0x1A-0xF) */ \
+        chan_ring_fetch(state, chan, smp); \
+      } \
+      /* Generate interpolated sample */ \
+      s_cur  = chan->samplebufcur; \
+      s_next = chan->samplebufnext; \
+      f = ((chan->frcphase) >> 4) & 0x3FFF; \
+      s = (s_next * f) + (s_cur * (0x4000-f)); \
+      s >>= 14; /* s is 16-bit */ \
+      /* Apply attenuation, if we want it */ \
+      if(!((N) & YAM_SHAPE_VOFF)) { \
+        uint32 attenuation = chan_attenuation(state, chan, (N)); \
+        if(attenuation >= 0x3C0) { \
+          s = 0; \
+        } else { \
+          /* Convert log attenuation to linear volume */ \
+          sint32 linearvol = ((attenuation & 0x3F) ^ 0x7F) + 1; \
+          s *= linearvol; s >>= 7 + (attenuation >> 6); \
+        } \
+      } \
+      /* Store in ring modulation buffer, if we're SCSP and it's enabled */ \
+      if(ringstore) { \
+        RINGBUF(state)[state->bufptr] = s; \
+      } \
+      /* Apply filter, if we want it */ \
+      if((N) & YAM_SHAPE_LPF) { \
+        sint32 f = chan_lpf_coef(state, chan); \
+        sint32 q = qtable[chan->q & 0x1F]; \
+        s = f * s + (0x2000 - f + q) * (chan->lpp1) - q * (chan->lpp2); \
+        s >>= 13; \
+        chan->lpp2 = chan->lpp1; \
+        chan->lpp1 = s; \
+      } \
+      /* Write output */ \
+      s <<= 4; \
+      buf[g] = s; \
+    } \
+    state->bufptr = (state->bufptr + 32) & state->ring_mask; \
+    /* Now we need to advance the channel state machine, regardless of */ \
+    /* whether we're generating output or not */ \
+    chan_advance(state, chan, (N), odometer, base_phaseinc, lfophaseinc); \
+    odometer++; \
+  } \
+  state->bufptr = bufptrsave; \
+  return g; \
+}
+
+GENSAMPLES(0x00) GENSAMPLES(0x01) GENSAMPLES(0x02) GENSAMPLES(0x03)
+GENSAMPLES(0x04) GENSAMPLES(0x05) GENSAMPLES(0x06) GENSAMPLES(0x07)
+GENSAMPLES(0x08) GENSAMPLES(0x09) GENSAMPLES(0x0A) GENSAMPLES(0x0B)
+GENSAMPLES(0x0C) GENSAMPLES(0x0D) GENSAMPLES(0x0E) GENSAMPLES(0x0F)
+GENSAMPLES(0x10) GENSAMPLES(0x11) GENSAMPLES(0x12) GENSAMPLES(0x13)
+GENSAMPLES(0x14) GENSAMPLES(0x15) GENSAMPLES(0x16) GENSAMPLES(0x17)
+GENSAMPLES(0x18) GENSAMPLES(0x19) GENSAMPLES(0x1A) GENSAMPLES(0x1B)
+GENSAMPLES(0x1C) GENSAMPLES(0x1D) GENSAMPLES(0x1E) GENSAMPLES(0x1F)
+
+static const generate_samples_t generate_samples_table[YAM_SHAPE_COUNT] = {
+  generate_samples0x00, generate_samples0x01, generate_samples0x02, generate_samples0x03,
+  generate_samples0x04, generate_samples0x05, generate_samples0x06, generate_samples0x07,
+  generate_samples0x08, generate_samples0x09, generate_samples0x0A, generate_samples0x0B,
+  generate_samples0x0C, generate_samples0x0D, generate_samples0x0E, generate_samples0x0F,
+  generate_samples0x10, generate_samples0x11, generate_samples0x12, generate_samples0x13,
+  generate_samples0x14, generate_samples0x15, generate_samples0x16, generate_samples0x17,
+  generate_samples0x18, generate_samples0x19, generate_samples0x1A, generate_samples0x1B,
+  generate_samples0x1C, generate_samples0x1D, generate_samples0x1E, generate_samples0x1F
+};
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Mix a channel's generated samples into the given outputs
+//
+// directout or fxout may be NULL
+// src samples are spaced stride apart
+//
+static void mix_channel_output(
+  struct YAM_STATE *state,
+  struct YAM_CHAN *chan,
+  const sint32 *src,
+  uint32 stride,
+  sint32 *directout,
+  sint32 *fxout,
+  uint32 samples
+) {
+  uint32 i;
+  if(directout) {
+    uint8 att_l, att_r;
+    sint32 lin_l, lin_r;
+    const sint32 *p = src;
+    convert_stereo_send_level(
+      chan->disdl,
+      (state->mono) ? 0 : (chan->dipan),
+      &att_l, &att_r, &lin_l, &lin_r
+    );
+    for(i = 0; i < samples; i++) {
+      directout[0] += ((*p)*lin_l) >> att_l;
+      directout[1] += ((*p)*lin_r) >> att_r;
+      directout += 2;
+      p += stride;
+    }
+  }
+  if(fxout) {
+    uint32 att = (chan->dsplevel) ^ 0xF;
+    sint32 lin = 4 - (att & 1);
+    const sint32 *p = src;
+    att >>= 1; att += 2;
+    for(i = 0; i < samples; i++) {
+      fxout[0] += ((*p)*lin) >> att;
+      fxout += 16;
+      p += stride;
     }
-    // Advance our temporary odometer copy
-    odometer++;
-    // Done with this sample!
   }
-  state->bufptr = bufptrsave;
-  return g;
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -2307,19 +3161,24 @@ static void render_and_add_channel(
   uint32 odometer,
   uint32 samples
 ) {
-  uint32 i;
-  sint32 localbuf[RENDERMAX];
+  sint32 *localbuf = LOCALBUF(state);
   uint32 rendersamples;
+  uint32 shape;
 
   // Channel does nothing if attenuation >= 0x3C0
   if(chan->envlevel == 0x1FFF) { return; }
   if(chan->envlevel >= 0x3C0) { chan->envlevel = 0x1FFF; chan->lp = 1; return; }
+  // Nothing left in the block (already caught up by chan_sync)
+  if(!samples) { return; }
 
   if(!chan->disdl) { directout = NULL; }
   if(!chan->dsplevel) { fxout = NULL; }
 
+  shape = chan_shape(state, chan);
+  state->shape_hits[shape]++;
+
   // Generate samples
-  rendersamples = generate_samples(
+  rendersamples = (generate_samples_table[shape])(
     state,
     chan,
     (directout || fxout || (state->version == 1 && !chan->stwinh)) ? localbuf : NULL,
@@ -2328,43 +3187,329 @@ static void render_and_add_channel(
   );
 
   // Add to output
-  if(directout) {
-    uint8 att_l, att_r;
-    sint32 lin_l, lin_r;
-    convert_stereo_send_level(
-      chan->disdl,
-      (state->mono) ? 0 : (chan->dipan),
-      &att_l, &att_r, &lin_l, &lin_r
-    );
-    for(i = 0; i < rendersamples; i++) {
-      directout[0] += (localbuf[i]*lin_l) >> att_l;
-      directout[1] += (localbuf[i]*lin_r) >> att_r;
-      directout += 2;
-    }
-  }
-  if(fxout) {
-    uint32 att = (chan->dsplevel) ^ 0xF;
-    sint32 lin = 4 - (att & 1);
-    att >>= 1; att += 2;
-    for(i = 0; i < rendersamples; i++) {
-      fxout[0] += (localbuf[i]*lin) >> att;
-      fxout += 16;
-    }
-  }
-
+  mix_channel_output(state, chan, localbuf, 1, directout, fxout, rendersamples);
 }
 
+#ifdef ENABLE_SIMD
 /////////////////////////////////////////////////////////////////////////////
 //
-// Floating-point conversion
+// SIMD lane renderer
 //
-static uint32 __fastcall float16_to_int24(uint32 f) {
-  uint32 exponent = (f >> 11) & 0xF;
-  sint32 result;
-  result = (f & 0x8000) << 16; // take the sign in bit 31
-  result >>= 1; // duplicate the sign in bit 30
-  if(exponent >= 12) { exponent = 11; } // cap exponent to 11 for denormals
-  else { result ^= 0x40000000; } // reverse bit 30 for normals
+// Renders up to LANES_MAX channels at once, one channel per vector lane.
+// The per-sample envelope/LFO/phase state machine is still stepped in scalar
+// code (it's branchy and per-channel), producing small per-sample parameter
+// arrays; the interpolation, attenuation, lowpass filter and output stages
+// then run across all lanes in a single pass.
+//
+// Output is bit-identical to generate_samples().  Channels which draw from
+// the shared noise generator, or SCSP blocks that use ring modulation, are
+// left to the scalar path since their result depends on render order.  So
+// are channels already part rendered by chan_sync, which start mid-block,
+// and SCSP channels that feed the ring buffer with the filter on, since the
+// ring takes the unfiltered sample.
+//
+// This falls well short of a 3-5x speedup and can't get there as it stands:
+// with 64 filtered AICA voices the scalar lane setup takes about 90% of the
+// lane path's cycles and the kernel about 10%, so vectorizing the rest of
+// the output stage buys at most the kernel's share.  Going further means
+// running the state machine across lanes too, which needs a vector sample
+// fetch (PCM8/PCM16/ADPCM, loop modes, per-lane phase wrap) and the
+// envelope/LFO steps as lane masks.
+//
+//
+// Returns nonzero if a channel may be rendered in a SIMD lane
+//
+static int chan_lane_eligible(
+  struct YAM_STATE *state,
+  struct YAM_CHAN *chan,
+  sint32 *directout,
+  sint32 *fxout
+) {
+  if(chan->envlevel >= 0x3C0) { return 0; }
+  // Must actually be producing output
+  if(!((directout && chan->disdl) || (fxout && chan->dsplevel) ||
+    (state->version == 1 && !chan->stwinh))) { return 0; }
+  // Noise generator users must stay in order on the scalar path
+  if(chan->ssctl == 1) { return 0; }
+  if(chan->alfos && chan->alfows == 3) { return 0; }
+  if(chan->plfos && chan->plfows == 3) { return 0; }
+  // SCSP ring buffer is stored pre-filter
+  if(state->version == 1 && !chan->stwinh && !chan->lpoff) { return 0; }
+  return 1;
+}
+
+//
+// Point the per-sample arrays at the state's scratch
+//
+static void lanebuf_init(struct YAM_STATE *state, struct YAM_LANEBUF *lb) {
+  uint32 n = SCRATCH_SAMPLES(state->render_max) * LANES_MAX;
+  sint16 *p = STATE_BUFFER(state, sint16, lanebuf);
+  lb->cur = p; p += n;
+  lb->nxt = p; p += n;
+  lb->frc = p; p += n;
+  lb->vol = p; p += n;
+  lb->mul = p; p += n;
+  lb->flt = p; p += n;
+  lb->out = (sint32*)p;
+}
+
+//
+// Step one channel through the block, filling in lane parameters
+// Returns the number of samples generated
+//
+// Instantiated per voice shape like generate_samples; ring modulation never
+// reaches the lane renderer, so only the low shape bits apply.
+//
+typedef uint32 (*lane_setup_t)(
+  struct YAM_STATE *state,
+  struct YAM_CHAN *chan,
+  struct YAM_LANEBUF *lb,
+  uint32 lane,
+  uint32 lanes,
+  uint32 odometer,
+  uint32 samples
+);
+
+#define LANESETUP(N) \
+static uint32 lane_setup##N( \
+  struct YAM_STATE *state, \
+  struct YAM_CHAN *chan, \
+  struct YAM_LANEBUF *lb, \
+  uint32 lane, \
+  uint32 lanes, \
+  uint32 odometer, \
+  uint32 samples \
+) { \
+  uint32 g; \
+  uint32 base_phaseinc = chan_base_phaseinc(chan); \
+  uint32 lfophaseinc = lfophaseinctable[chan->lfof]; \
+  uint32 n = lane; \
+  for(g = 0; g < samples; g++, n += lanes) { \
+    if(chan->envlevel >= 0x3C0) { \
+      chan->envlevel = 0x1FFF; \
+      chan->lp = 1; \
+      break; \
+    } \
+    lb->cur[n] = chan->samplebufcur; \
+    lb->nxt[n] = chan->samplebufnext; \
+    lb->frc[n] = ((chan->frcphase) >> 4) & 0x3FFF; \
+    if((N) & YAM_SHAPE_VOFF) { \
+      lb->vol[n] = 128; \
+      lb->mul[n] = 1 << 14; \
+    } else { \
+      uint32 attenuation = chan_attenuation(state, chan, (N)); \
+      if(attenuation >= 0x3C0) { \
+        lb->vol[n] = 0; \
+        lb->mul[n] = 1 << 14; \
+      } else { \
+        lb->vol[n] = ((attenuation & 0x3F) ^ 0x7F) + 1; \
+        lb->mul[n] = 1 << (14 - (attenuation >> 6)); \
+      } \
+    } \
+    lb->flt[n] = ((N) & YAM_SHAPE_LPF) ? chan_lpf_coef(state, chan) : 0x2000; \
+    chan_advance(state, chan, (N), odometer, base_phaseinc, lfophaseinc); \
+    odometer++; \
+  } \
+  return g; \
+}
+
+LANESETUP(0x00) LANESETUP(0x01) LANESETUP(0x02) LANESETUP(0x03)
+LANESETUP(0x04) LANESETUP(0x05) LANESETUP(0x06) LANESETUP(0x07)
+LANESETUP(0x08) LANESETUP(0x09) LANESETUP(0x0A) LANESETUP(0x0B)
+LANESETUP(0x0C) LANESETUP(0x0D) LANESETUP(0x0E) LANESETUP(0x0F)
+
+static const lane_setup_t lane_setup_table[YAM_SHAPE_RING] = {
+  lane_setup0x00, lane_setup0x01, lane_setup0x02, lane_setup0x03,
+  lane_setup0x04, lane_setup0x05, lane_setup0x06, lane_setup0x07,
+  lane_setup0x08, lane_setup0x09, lane_setup0x0A, lane_setup0x0B,
+  lane_setup0x0C, lane_setup0x0D, lane_setup0x0E, lane_setup0x0F
+};
+
+//
+// SSE2 kernel, 4 lanes
+//
+static EMU_INLINE __m128i mullo_epi32_sse2(__m128i a, __m128i b) {
+  __m128i even = _mm_mul_epu32(a, b);
+  __m128i odd  = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+  return _mm_unpacklo_epi32(
+    _mm_shuffle_epi32(even, _MM_SHUFFLE(0,0,2,0)),
+    _mm_shuffle_epi32(odd , _MM_SHUFFLE(0,0,2,0))
+  );
+}
+
+static void lane_kernel_sse2(struct YAM_LANEBUF *lb, uint32 samples) {
+  uint32 g;
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one14 = _mm_set1_epi16(0x4000);
+  const __m128i one13 = _mm_set1_epi32(0x2000);
+  const __m128i count = _mm_loadu_si128((const __m128i*)(lb->count));
+  const __m128i fltmask = _mm_loadu_si128((const __m128i*)(lb->fltmask));
+  const __m128i q = _mm_loadu_si128((const __m128i*)(lb->q));
+  __m128i lpp1 = _mm_loadu_si128((const __m128i*)(lb->lpp1));
+  __m128i lpp2 = _mm_loadu_si128((const __m128i*)(lb->lpp2));
+  for(g = 0; g < samples; g++) {
+    uint32 n = 4 * g;
+    __m128i c = _mm_loadl_epi64((const __m128i*)(lb->cur + n));
+    __m128i x = _mm_loadl_epi64((const __m128i*)(lb->nxt + n));
+    __m128i f = _mm_loadl_epi64((const __m128i*)(lb->frc + n));
+    __m128i v = _mm_loadl_epi64((const __m128i*)(lb->vol + n));
+    __m128i m = _mm_loadl_epi64((const __m128i*)(lb->mul + n));
+    __m128i lf = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(lb->flt + n)), zero);
+    __m128i s, t, keep;
+    // interpolate: (next * f + cur * (0x4000 - f)) >> 14
+    s = _mm_madd_epi16(_mm_unpacklo_epi16(x, c), _mm_unpacklo_epi16(f, _mm_sub_epi16(one14, f)));
+    s = _mm_srai_epi32(s, 14);
+    s = _mm_packs_epi32(s, s);
+    // attenuate: ((s * vol) >> 7) >> shift
+    s = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(s, zero), _mm_unpacklo_epi16(v, zero)), 7);
+    s = _mm_packs_epi32(s, s);
+    s = _mm_srai_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(s, zero), _mm_unpacklo_epi16(m, zero)), 14);
+    // lowpass: (f * s + (0x2000 - f + q) * lpp1 - q * lpp2) >> 13
+    t = _mm_madd_epi16(_mm_unpacklo_epi16(_mm_packs_epi32(s, s), zero), lf);
+    t = _mm_add_epi32(t, mullo_epi32_sse2(_mm_add_epi32(_mm_sub_epi32(one13, lf), q), lpp1));
+    t = _mm_sub_epi32(t, mullo_epi32_sse2(q, lpp2));
+    t = _mm_srai_epi32(t, 13);
+    _mm_storeu_si128((__m128i*)(lb->out + n), _mm_slli_epi32(t, 4));
+    // keep filter history only for live, filtered lanes
+    keep = _mm_and_si128(fltmask, _mm_cmpgt_epi32(count, _mm_set1_epi32(g)));
+    lpp2 = _mm_or_si128(_mm_and_si128(keep, lpp1), _mm_andnot_si128(keep, lpp2));
+    lpp1 = _mm_or_si128(_mm_and_si128(keep, t), _mm_andnot_si128(keep, lpp1));
+  }
+  _mm_storeu_si128((__m128i*)(lb->lpp1), lpp1);
+  _mm_storeu_si128((__m128i*)(lb->lpp2), lpp2);
+}
+
+#ifdef ENABLE_SIMD_AVX2
+//
+// AVX2 kernel, 8 lanes
+//
+SIMD_TARGET_AVX2
+static void lane_kernel_avx2(struct YAM_LANEBUF *lb, uint32 samples) {
+  uint32 g;
+  const __m256i one14 = _mm256_set1_epi32(0x4000);
+  const __m256i one13 = _mm256_set1_epi32(0x2000);
+  const __m256i count = _mm256_loadu_si256((const __m256i*)(lb->count));
+  const __m256i fltmask = _mm256_loadu_si256((const __m256i*)(lb->fltmask));
+  const __m256i q = _mm256_loadu_si256((const __m256i*)(lb->q));
+  __m256i lpp1 = _mm256_loadu_si256((const __m256i*)(lb->lpp1));
+  __m256i lpp2 = _mm256_loadu_si256((const __m256i*)(lb->lpp2));
+  for(g = 0; g < samples; g++) {
+    uint32 n = 8 * g;
+    __m256i c = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(lb->cur + n)));
+    __m256i x = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(lb->nxt + n)));
+    __m256i f = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(lb->frc + n)));
+    __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(lb->vol + n)));
+    __m256i m = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(lb->mul + n)));
+    __m256i lf = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(lb->flt + n)));
+    __m256i s, t, keep;
+    s = _mm256_add_epi32(_mm256_mullo_epi32(x, f), _mm256_mullo_epi32(c, _mm256_sub_epi32(one14, f)));
+    s = _mm256_srai_epi32(s, 14);
+    s = _mm256_srai_epi32(_mm256_mullo_epi32(s, v), 7);
+    s = _mm256_srai_epi32(_mm256_mullo_epi32(s, m), 14);
+    t = _mm256_mullo_epi32(lf, s);
+    t = _mm256_add_epi32(t, _mm256_mullo_epi32(_mm256_add_epi32(_mm256_sub_epi32(one13, lf), q), lpp1));
+    t = _mm256_sub_epi32(t, _mm256_mullo_epi32(q, lpp2));
+    t = _mm256_srai_epi32(t, 13);
+    _mm256_storeu_si256((__m256i*)(lb->out + n), _mm256_slli_epi32(t, 4));
+    keep = _mm256_and_si256(fltmask, _mm256_cmpgt_epi32(count, _mm256_set1_epi32(g)));
+    lpp2 = _mm256_blendv_epi8(lpp2, lpp1, keep);
+    lpp1 = _mm256_blendv_epi8(lpp1, t, keep);
+  }
+  _mm256_storeu_si256((__m256i*)(lb->lpp1), lpp1);
+  _mm256_storeu_si256((__m256i*)(lb->lpp2), lpp2);
+}
+#endif
+
+//
+// Render a group of channels, one per lane, and add them to the outputs
+// bufptrs holds each channel's ring buffer slot
+//
+static void render_and_add_lanes(
+  struct YAM_STATE *state,
+  struct YAM_CHAN **chans,
+  uint32 *bufptrs,
+  uint32 nchans,
+  uint32 lanes,
+  sint32 *directout,
+  sint32 *fxbus,
+  uint32 odometer,
+  uint32 samples
+) {
+  struct YAM_LANEBUF lanebuf;
+  struct YAM_LANEBUF *lb = &lanebuf;
+  uint32 k, g;
+  uint32 maxcount = 0;
+
+  lanebuf_init(state, lb);
+
+  for(k = 0; k < lanes; k++) {
+    uint32 count = 0;
+    if(k < nchans) {
+      struct YAM_CHAN *chan = chans[k];
+      uint32 shape = chan_shape(state, chan);
+      state->shape_hits[shape]++;
+      count = (lane_setup_table[shape])(state, chan, lb, k, lanes, odometer, samples);
+      lb->fltmask[k] = (chan->lpoff) ? 0 : -1;
+      lb->q[k] = (chan->lpoff) ? 0 : qtable[chan->q & 0x1F];
+      lb->lpp1[k] = chan->lpp1;
+      lb->lpp2[k] = chan->lpp2;
+    } else {
+      lb->fltmask[k] = 0;
+      lb->q[k] = 0;
+      lb->lpp1[k] = 0;
+      lb->lpp2[k] = 0;
+    }
+    lb->count[k] = count;
+    if(count > maxcount) { maxcount = count; }
+  }
+  // Pad out lanes which ended early
+  for(k = 0; k < lanes; k++) {
+    for(g = lb->count[k]; g < maxcount; g++) {
+      uint32 n = g * lanes + k;
+      lb->cur[n] = 0; lb->nxt[n] = 0; lb->frc[n] = 0;
+      lb->vol[n] = 0; lb->mul[n] = 0; lb->flt[n] = 0x2000;
+    }
+  }
+  if(!maxcount) { return; }
+
+#ifdef ENABLE_SIMD_AVX2
+  if(lanes == 8) { lane_kernel_avx2(lb, maxcount); } else
+#endif
+  { lane_kernel_sse2(lb, maxcount); }
+
+  for(k = 0; k < nchans; k++) {
+    struct YAM_CHAN *chan = chans[k];
+    uint32 count = lb->count[k];
+    if(!(chan->lpoff)) {
+      chan->lpp1 = lb->lpp1[k];
+      chan->lpp2 = lb->lpp2[k];
+    }
+    // Store in ring modulation buffer, if we're SCSP and it's enabled
+    if(state->version == 1 && !chan->stwinh) {
+      for(g = 0; g < count; g++) {
+        RINGBUF(state)[(bufptrs[k] + 32 * g) & state->ring_mask] = lb->out[g * lanes + k] >> 4;
+      }
+    }
+    mix_channel_output(state, chan, lb->out + k, lanes,
+      (chan->disdl) ? directout : NULL,
+      (fxbus && chan->dsplevel) ? (fxbus + chan->dspchan) : NULL,
+      count
+    );
+  }
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Floating-point conversion
+//
+static uint32 __fastcall float16_to_int24(uint32 f) {
+  uint32 exponent = (f >> 11) & 0xF;
+  sint32 result;
+  result = (f & 0x8000) << 16; // take the sign in bit 31
+  result >>= 1; // duplicate the sign in bit 30
+  if(exponent >= 12) { exponent = 11; } // cap exponent to 11 for denormals
+  else { result ^= 0x40000000; } // reverse bit 30 for normals
   result |= (f & 0x7FF) << 19; // set bits 29-0 to the mantissa
   result >>= exponent + 8; // shift right by the exponent + 8
   return result;
@@ -2393,183 +3538,1019 @@ static uint32 __fastcall int24_to_float16(uint32 i) {
 
 /////////////////////////////////////////////////////////////////////////////
 //
-// Execute one sample on the effects DSP
+// DSP program decoding
+//
+
+static int instruction_uses_shifted(struct MPRO *mpro) {
+  // uses SHIFTED if:
+  // - ADRL and INTERP
+  if((mpro->m_wrAFyyYh & 0x20) != 0) {
+    if((mpro->__kisxzbon & 0x40) != 0) return 1;
+  }
+  // - FRCL
+  if((mpro->m_wrAFyyYh & 0x10) != 0) return 1;
+  // - EWT
+  if((mpro->e_000Twwww & 0x10) == 0) return 1;
+  // - TWT
+  if((mpro->t_Twwwwwww & 0x80) == 0) return 1;
+  // - MWT
+  if((mpro->m_wrAFyyYh & 0x80) != 0) return 1;
+  // otherwise not
+  return 0;
+}
+
+//
+// DSP program analysis
+//
+// Works out which steps, and which writes within steps, can reach anything
+// observable: sound RAM, the EFREG outputs that are mixed, and whatever is
+// left in the registers at the end of a sample.  The result is a copy of
+// MPRO with the dead writes turned off, a live flag per step, and a cutoff
+// past which nothing runs.  The interpreter and dynarecs only run that.
+//
+// Values overwritten within the same sample are always dropped.  With
+// dsp_liveness_enabled, values the program overwrites in a later sample
+// before reading them, and EFREG outputs with a zero EFSDL, are dropped too.
+// That holds only while the program is unchanged, so reading
+// TEMP/MEMS/EFREG back turns it off.
+//
+#define DSPRES_MEMS(n)    (((uint64)1) << (n))
+#define DSPRES_FRC        (((uint64)1) << 32)
+#define DSPRES_YREG       (((uint64)1) << 33)
+#define DSPRES_ADRS       (((uint64)1) << 34)
+#define DSPRES_MEMDATA(n) (((uint64)1) << (35 + (n)))
+#define DSPRES_EFREG(n)   (((uint64)1) << (40 + (n)))
+#define DSPRES_ACC        (((uint64)1) << 56)
+
+static uint64 dsp_step_reads(struct MPRO *mpro, uint32 i) {
+  uint8 kis = mpro->__kisxzbon;
+  uint8 wraf = mpro->m_wrAFyyYh;
+  uint64 r = 0;
+  // skip: ACC = TEMP[MDEC_CT] * FRC_REG + TEMP[MDEC_CT]
+  if(kis & 0x80) { return DSPRES_FRC; }
+  if(((kis & 0x0C) == 0x04) || instruction_uses_shifted(mpro)) { r |= DSPRES_ACC; }
+  // INPUTS feeds X, the Y latch, and a non-interpolated address latch
+  if((kis & 0x10) || (wraf & 0x02) || ((wraf & 0x20) && !(kis & 0x40))) {
+    if(mpro->i_00rrrrrr < 0x20) { r |= DSPRES_MEMS(mpro->i_00rrrrrr); }
+  }
+  switch(wraf & 0x0C) {
+  case 0x00: r |= DSPRES_FRC; break;
+  case 0x08: case 0x0C: r |= DSPRES_YREG; break;
+  }
+  if((wraf & 0xC0) && mpro->adrmask) { r |= DSPRES_ADRS; }
+  if(!(mpro->i_0T0wwwww & 0x40)) { r |= DSPRES_MEMDATA(i & 3); }
+  return r;
+}
+
+static uint64 dsp_step_writes(struct MPRO *mpro, uint32 i) {
+  uint8 wraf = mpro->m_wrAFyyYh;
+  uint64 w = DSPRES_ACC;
+  if(mpro->__kisxzbon & 0x80) { return w; }
+  if(wraf & 0x10) { w |= DSPRES_FRC; }
+  if(wraf & 0x02) { w |= DSPRES_YREG; }
+  if(wraf & 0x20) { w |= DSPRES_ADRS; }
+  if(wraf & 0x40) { w |= DSPRES_MEMDATA((i + 2) & 3); }
+  if(!(mpro->i_0T0wwwww & 0x40)) { w |= DSPRES_MEMS(mpro->i_0T0wwwww & 0x1F); }
+  if(!(mpro->e_000Twwww & 0x10)) { w |= DSPRES_EFREG(mpro->e_000Twwww & 0xF); }
+  return w;
+}
+
+//
+// Whether the value step i writes to res is read before it's overwritten.
+// Each step reads before it writes.
+//
+static int dsp_value_live(
+  const uint64 *rd, const uint64 *wr, uint32 i, uint64 res,
+  int wrap, uint64 seen
+) {
+  uint32 j;
+  for(j = i + 1; j < 128; j++) {
+    if(rd[j] & res) { return 1; }
+    if(wr[j] & res) { return 0; }
+  }
+  // end of sample
+  if((!wrap) || (seen & res)) { return 1; }
+  for(j = 0; j <= i; j++) {
+    if(rd[j] & res) { return 1; }
+    if(wr[j] & res) { return 0; }
+  }
+  return 0;
+}
+
+//
+// Same for TEMP, which moves one slot per sample under MDEC_CT: slot r
+// read s samples later holds what slot r-s holds now.
+//
+static int dsp_temp_live(
+  struct MPRO *prog, const uint8 *live, uint32 i, int wrap
+) {
+  uint32 w = prog[i].t_Twwwwwww & 0x7F;
+  uint32 first_rd = 0xFFFFFFFF;
+  uint32 first_wr = 0xFFFFFFFF;
+  uint32 j;
+  for(j = 0; j < 128; j++) {
+    struct MPRO *mpro = prog + j;
+    uint32 s;
+    if(!live[j]) { continue; }
+    if(
+      (mpro->__kisxzbon & 0x80) ||
+      ((mpro->__kisxzbon & 0x10) == 0x00) ||
+      ((mpro->__kisxzbon & 0x0C) == 0x00)
+    ) {
+      s = ((mpro->__kisxzbon & 0x80) ? 0 : mpro->t_0rrrrrrr) - w;
+      s &= 0x7F;
+      if(s == 0 && j <= i) { s = 128; }
+      s = s * 128 + j;
+      if(s < first_rd) { first_rd = s; }
+    }
+    if(!(mpro->__kisxzbon & 0x80) && mpro->t_Twwwwwww < 0x80) {
+      s = (mpro->t_Twwwwwww - w) & 0x7F;
+      if(s == 0 && j <= i) { s = 128; }
+      s = s * 128 + j;
+      if(s < first_wr) { first_wr = s; }
+    }
+  }
+  // not overwritten within the sample: seen at the end of it
+  if((!wrap) && first_wr >= 128) { return 1; }
+  // a step reads before it writes
+  return first_rd <= first_wr;
+}
+
+static void dsp_analyze(struct YAM_STATE *state) {
+  struct MPRO *prog = state->dsp_prog;
+  uint8 *live = state->dsp_step_live;
+  int wrap = state->dsp_liveness_enabled;
+  uint64 rd[128];
+  uint64 wr[128];
+  uint64 seen = 0;
+  uint32 temp_slots[4];
+  int changed;
+  uint32 i;
+
+  memcpy(prog, state->mpro, sizeof(state->mpro));
+  for(i = 0; i < 128; i++) {
+    live[i] = 1;
+    rd[i] = dsp_step_reads(prog + i, i);
+    wr[i] = dsp_step_writes(prog + i, i);
+  }
+  //
+  // Outputs seen at the end of each sample
+  //
+  for(i = 0; i < 16; i++) {
+    if(state->efsdl[i]) { seen |= DSPRES_EFREG(i); }
+  }
+  //
+  // Turn off dead writes until nothing changes.  A removed write never
+  // makes another one live, and neither does a removed read.
+  //
+  do {
+    changed = 0;
+    for(i = 0; i < 128; i++) {
+      struct MPRO *mpro = prog + i;
+      uint64 dead = 0;
+      uint64 res;
+      if(!live[i]) { continue; }
+      for(res = wr[i]; res; res &= res - 1) {
+        uint64 bit = res & (~res + 1);
+        if(!dsp_value_live(rd, wr, i, bit, wrap, seen)) { dead |= bit; }
+      }
+      if(
+        !(mpro->__kisxzbon & 0x80) && mpro->t_Twwwwwww < 0x80 &&
+        !dsp_temp_live(prog, live, i, wrap)
+      ) {
+        mpro->t_Twwwwwww |= 0x80;
+        changed = 1;
+      }
+      if(dead & DSPRES_FRC) { mpro->m_wrAFyyYh &= ~0x10; }
+      if(dead & DSPRES_YREG) { mpro->m_wrAFyyYh &= ~0x02; }
+      if(dead & DSPRES_ADRS) { mpro->m_wrAFyyYh &= ~0x20; }
+      if(dead & DSPRES_MEMDATA((i + 2) & 3)) { mpro->m_wrAFyyYh &= ~0x40; }
+      if(dead & DSPRES_MEMS(mpro->i_0T0wwwww & 0x1F)) { mpro->i_0T0wwwww |= 0x40; }
+      if(dead & DSPRES_EFREG(mpro->e_000Twwww & 0xF)) { mpro->e_000Twwww |= 0x10; }
+      if(dead & ~DSPRES_ACC) { changed = 1; }
+      //
+      // Drop the step if all it has left is a dead ACC
+      //
+      if(
+        (dead & DSPRES_ACC) &&
+        (dsp_step_writes(mpro, i) == DSPRES_ACC) &&
+        ((mpro->__kisxzbon & 0x80) || (
+          (mpro->t_Twwwwwww >= 0x80) && !(mpro->m_wrAFyyYh & 0x80)
+        ))
+      ) {
+        live[i] = 0;
+        changed = 1;
+      }
+      if(live[i]) {
+        rd[i] = dsp_step_reads(mpro, i);
+        wr[i] = dsp_step_writes(mpro, i);
+      } else {
+        rd[i] = 0;
+        wr[i] = 0;
+      }
+    }
+  } while(changed);
+  //
+  // Summarize
+  //
+  memset(state->dsp_info, 0, sizeof(state->dsp_info[0]) * YAM_DSPINFO_REBUILDS);
+  memset(temp_slots, 0, sizeof(temp_slots));
+  state->dsp_cutoff = 0;
+  for(i = 0; i < 128; i++) {
+    struct MPRO *mpro = prog + i;
+    if(!(state->mpro[i].__kisxzbon & 0x80)) { state->dsp_info[YAM_DSPINFO_STEPS]++; }
+    if(!live[i]) { continue; }
+    state->dsp_info[YAM_DSPINFO_LIVE]++;
+    state->dsp_cutoff = i + 1;
+    if(!(mpro->__kisxzbon & 0x80) && mpro->t_Twwwwwww < 0x80) {
+      temp_slots[mpro->t_Twwwwwww >> 5] |= 1 << (mpro->t_Twwwwwww & 0x1F);
+    }
+    if(!(mpro->e_000Twwww & 0x10)) {
+      state->dsp_info[YAM_DSPINFO_EFREG] |= 1 << (mpro->e_000Twwww & 0xF);
+    }
+  }
+  state->dsp_info[YAM_DSPINFO_CUTOFF] = state->dsp_cutoff;
+  for(i = 0; i < 4; i++) {
+    state->dsp_info[YAM_DSPINFO_TEMP] += yam_popcount32(temp_slots[i]);
+  }
+  state->dsp_analysis_valid = 1;
+  dsp_program_changed(state);
+}
+
+//
+// Build the micro-op list for the live steps of the analyzed program
+//
+static void dsp_decode(struct YAM_STATE *state) {
+  struct YAM_DSPUOP *u = state->dsp_uop;
+  uint32 rbmask = (1 << ((state->rbl)+13)) - 1;
+  uint32 i;
+  for(i = 0; i < state->dsp_cutoff; i++) {
+    struct MPRO *mpro = state->dsp_prog + i;
+    uint8 kis = mpro->__kisxzbon;
+    uint8 wraf = mpro->m_wrAFyyYh;
+    sint32 tm = ((sint32)(mpro->tablemask));
+    if(!(state->dsp_step_live[i])) { continue; }
+    if(kis & 0x80) {
+      u->op = DSPUOP_SKIP;
+      u->step = i;
+      u++;
+      continue;
+    }
+    u->op = (wraf & 0xC0) ? DSPUOP_STEP_MEM : DSPUOP_STEP;
+    u->tra = mpro->t_0rrrrrrr;
+    u->twa = mpro->t_Twwwwwww;
+    u->kis = kis;
+    u->wraf = wraf;
+    u->step = i;
+    u->xtemp = (kis & 0x10) ? 0 : -1;
+    u->btemp = ((kis & 0x0C) == 0x00) ? -1 : 0;
+    u->bacc  = ((kis & 0x0C) == 0x04) ? -1 : 0;
+    u->negb = ((sint32)(mpro->negb));
+    u->madrsp = state->madrs + mpro->m_00aaaaaa;
+    u->adrmask = ((sint32)(mpro->adrmask));
+    u->mdecmask = ~tm;
+    u->amask = (rbmask | tm) & 0xFFFF;
+    if(((wraf >> 2) & 3) == YYCHOICE_COEF) {
+      u->yp = state->coef + mpro->c_0rrrrrrr;
+    } else {
+      u->yp = state->yychoice + ((wraf >> 2) & 3);
+    }
+    u->ip = state->inputs + mpro->i_00rrrrrr;
+    u->iwp = state->inputs + mpro->i_0T0wwwww;
+    u->mip = state->mem_in_data + (i & 3);
+    u->mrdp = state->mem_in_data + ((i + 2) & 3);
+    u->ewp = state->efreg + mpro->e_000Twwww;
+    u++;
+  }
+  u->op = DSPUOP_END;
+  state->dsp_info[YAM_DSPINFO_REBUILDS]++;
+  state->dsp_uop_owner = state;
+  state->dsp_uop_valid = 1;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Execute one sample on the effects DSP, from the decoded program
 //
 static void __fastcall dsp_sample_interpret(struct YAM_STATE *state) {
-  const struct MPRO *mpro = state->mpro;
+  const struct YAM_DSPUOP *u = state->dsp_uop;
+  sint32 *temp = state->temp;
+  sint32 *yy = state->yychoice;
+  uint32 mdec = state->mdec_ct;
+  sint32 acc = state->xzbchoice[XZBCHOICE_ACC];
+  uint32 adrs = state->adrs_reg;
+  sint8 *ram = (sint8*)(state->ram_ptr);
+  uint32 rbp = state->rbp;
+  uint32 ram_mask = state->ram_mask;
+  uint32 word_xor = state->mem_word_address_xor;
+  sint32 inputs, shifted;
+
+//
+// Everything but the memory operation and address latch
+//
+#define DSPUOP_ALU {                                                         \
+  sint32 t = temp[((u->tra) + mdec) & 0x7F];                                 \
+  sint32 x, y, b;                                                            \
+  inputs = *(u->ip);                                                         \
+  x = (t & (u->xtemp)) | (inputs & ~(u->xtemp));                             \
+  b = (t & (u->btemp)) | (acc & (u->bacc));                                  \
+  b ^= u->negb;                                                              \
+  b -= u->negb;                                                              \
+  y = *(u->yp);                                                              \
+  if((u->wraf) & 2) {                                                        \
+    yy[YYCHOICE_Y_REG_H] = inputs >> 11;                                     \
+    yy[YYCHOICE_Y_REG_L] = (inputs >> 4) & 0xFFF;                            \
+  }                                                                          \
+  shifted = acc << ((u->wraf) & 1);                                          \
+  if((u->kis) & 0x20) {                                                      \
+    if(shifted > ( 0x7FFFFF)) { shifted = ( 0x7FFFFF); }                     \
+    if(shifted < (-0x800000)) { shifted = (-0x800000); }                     \
+  }                                                                          \
+  acc = ((((sint64)x) * ((sint64)y)) >> 12) + b;                             \
+  if((u->twa) < 0x80) {                                                      \
+    temp[((u->twa) + mdec) & 0x7F] = shifted;                                \
+  }                                                                          \
+  if((u->wraf) & 0x10) {                                                     \
+    if((u->kis) & 0x40) { yy[YYCHOICE_FRC_REG] = shifted & 0xFFF; }          \
+    else                { yy[YYCHOICE_FRC_REG] = shifted >> 11; }            \
+  }                                                                          \
+  *(u->ewp) = shifted >> 8;                                                  \
+  *(u->iwp) = *(u->mip);                                                     \
+}
+
+#define DSPUOP_ADRL {                                                        \
+  if((u->wraf) & 0x20) {                                                     \
+    if((u->kis) & 0x40) { adrs = shifted >> 12; }                            \
+    else                { adrs = inputs >> 16; }                             \
+    adrs &= 0xFFF;                                                           \
+  }                                                                          \
+}
+
+#ifdef DSP_COMPUTED_GOTO
+  static const void *handlers[DSPUOP_COUNT] = {
+    &&uop_end, &&uop_skip, &&uop_step, &&uop_step_mem
+  };
+#define DSPUOP_HANDLER(label,op) label:
+#define DSPUOP_NEXT { u++; goto *handlers[u->op]; }
+  goto *handlers[u->op];
+#else
+#define DSPUOP_HANDLER(label,op) case op:
+#define DSPUOP_NEXT { u++; continue; }
+  for(;;) switch(u->op) {
+#endif
+
+  DSPUOP_HANDLER(uop_skip, DSPUOP_SKIP) {
+    sint32 t = temp[mdec & 0x7F];
+    acc = ((((sint64)t) * ((sint64)(yy[YYCHOICE_FRC_REG]))) >> 12) + t;
+    DSPUOP_NEXT
+  }
+
+  DSPUOP_HANDLER(uop_step, DSPUOP_STEP) {
+    DSPUOP_ALU
+    DSPUOP_ADRL
+    DSPUOP_NEXT
+  }
+
+  DSPUOP_HANDLER(uop_step_mem, DSPUOP_STEP_MEM) {
+    uint32 a;
+    DSPUOP_ALU
+    a = *(u->madrsp) + ((u->kis) & 1);
+    a += adrs & (u->adrmask);
+    a += mdec & (u->mdecmask);
+    a &= u->amask;
+    a <<= 1;
+    a += rbp;
+    a &= ram_mask;
+    a ^= word_xor;
+    if((u->wraf) & 0x40) { // MRD
+      sint32 memdata = *((sint16*)(ram + a));
+      if(!((u->kis) & 2)) { memdata = float16_to_int24(memdata); }
+      else { memdata <<= 8; }
+      *(u->mrdp) = memdata;
+    }
+    if((u->wraf) & 0x80) { // MWT
+      sint32 memdata = shifted;
+      if(!((u->kis) & 2)) { memdata = int24_to_float16(memdata); }
+      else { memdata >>= 8; }
+      *((sint16*)(ram + a)) = memdata;
+    }
+    DSPUOP_ADRL
+    DSPUOP_NEXT
+  }
+
+  DSPUOP_HANDLER(uop_end, DSPUOP_END) {
+    goto done;
+  }
+
+#ifndef DSP_COMPUTED_GOTO
+  }
+#endif
+#undef DSPUOP_HANDLER
+#undef DSPUOP_NEXT
+#undef DSPUOP_ALU
+#undef DSPUOP_ADRL
+
+done:
+  state->xzbchoice[XZBCHOICE_ACC] = acc;
+  state->adrs_reg = adrs;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+//
+//
+
+#define C(N) { *outp++ = ((uint8)(N)); }
+#define C32(N) { *((uint32*)outp) = ((uint32)(N)); outp += 4; }
+#define C32CALL(N) { *((uint32*)outp) = ((uint32)(N)) - (((uint32)(outp))+4); outp += 4; }
+
+#define C64(N) { *((uint64*)outp) = ((uint64)(N)); outp += 8; }
+
+#define STRUCTOFS(thetype,thefield) ((uint32)((size_t)(&(((struct thetype*)0)->thefield))))
+#define STATEOFS(thefield) STRUCTOFS(YAM_STATE,thefield)
+
+
+#ifdef ENABLE_DYNAREC
+/////////////////////////////////////////////////////////////////////////////
+//
+// Executable pool for dynacode
+//
+// One mapped region cut into fixed slots, owned by the library rather than
+// the state blob.  A slot is only writable while it's being compiled into,
+// and executable otherwise (W^X), so nothing is ever mapped RWX and the
+// state blob holds no code and can be copied freely.
+//
+// The code only refers to the state through a register (RBX, or EDI on
+// 32-bit x86), so it's shared by every
+// state running the same program: slots are looked up by the analyzed
+// program plus the RBL/RBP/RAM mask/word XOR it was compiled for.  A state
+// keeps the slot and serial of its code; the serial changes when the slot
+// is reused, so a stale one is just a cache miss.  Slots being compiled
+// into or executed are busy (counted per user) and never evicted; the
+// least recently used idle slot goes first.
+//
+#define DYNAPOOL_SLOTS     (64)
+#define DYNAPOOL_SLOT_SIZE (0x10000) // worst case is about 300 bytes per step
+
+struct DYNAPOOL_KEY {
+  struct MPRO prog[128]; // live steps; dead ones are zero
+  uint8 live[128];
+  uint32 cutoff;
+  uint32 rbl;
+  uint32 rbp;
+  uint32 ram_mask;
+  uint32 word_xor;
+};
+
+struct DYNAPOOL_SLOT {
+  uint32 serial; // 0 = empty
+  uint32 busy;
+  uint32 hash;
+  uint32 last_used;
+  uint8 ready; // compiled and executable
+  struct DYNAPOOL_KEY key;
+};
+
+static uint8 *dynapool_base = NULL;
+static uint8 dynapool_failed = 0;
+#ifdef _WIN32
+static volatile LONG dynapool_lock = 0;
+#else
+static volatile int dynapool_lock = 0;
+#endif
+static uint32 dynapool_serial = 0;
+static uint32 dynapool_clock = 0;
+static uint32 dynapool_info[YAM_DSPCACHE_COUNT];
+static struct DYNAPOOL_SLOT dynapool_slot[DYNAPOOL_SLOTS];
+
+static void dynapool_enter(void) {
+#ifdef _WIN32
+  while(InterlockedExchange(&dynapool_lock, 1)) { }
+#else
+  while(__sync_lock_test_and_set(&dynapool_lock, 1)) { }
+#endif
+}
+
+static void dynapool_leave(void) {
+#ifdef _WIN32
+  InterlockedExchange(&dynapool_lock, 0);
+#else
+  __sync_lock_release(&dynapool_lock);
+#endif
+}
+
+//
+// Map the whole pool, read-only to start with
+//
+static uint8 *dynapool_map(void) {
+#ifdef _WIN32
+  return (uint8*)VirtualAlloc(NULL, DYNAPOOL_SLOTS * DYNAPOOL_SLOT_SIZE,
+    MEM_COMMIT | MEM_RESERVE, PAGE_READONLY);
+#else
+  void *p = mmap(NULL, DYNAPOOL_SLOTS * DYNAPOOL_SLOT_SIZE, PROT_READ,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return (p == MAP_FAILED) ? NULL : (uint8*)p;
+#endif
+}
+
+//
+// Make a slot writable or executable, never both
+// Returns nonzero on failure
+//
+static int dynapool_protect(uint8 *code, int exec) {
+#ifdef _WIN32
+  DWORD old;
+  if(!VirtualProtect(code, DYNAPOOL_SLOT_SIZE,
+    exec ? PAGE_EXECUTE_READ : PAGE_READWRITE, &old)) { return 1; }
+  if(exec) { FlushInstructionCache(GetCurrentProcess(), code, DYNAPOOL_SLOT_SIZE); }
+  return 0;
+#else
+  return mprotect(code, DYNAPOOL_SLOT_SIZE,
+    exec ? (PROT_READ | PROT_EXEC) : (PROT_READ | PROT_WRITE));
+#endif
+}
+
+static uint32 dynapool_hash(const struct DYNAPOOL_KEY *key) {
+  const uint8 *p = (const uint8*)key;
+  uint32 h = 0x811C9DC5;
+  uint32 i;
+  for(i = 0; i < sizeof(struct DYNAPOOL_KEY); i++) { h ^= p[i]; h *= 0x01000193; }
+  return h;
+}
+
+static void dynapool_make_key(struct YAM_STATE *state, struct DYNAPOOL_KEY *key) {
   uint32 i;
+  memset(key, 0, sizeof(struct DYNAPOOL_KEY));
+  for(i = 0; i < state->dsp_cutoff; i++) {
+    if(!(state->dsp_step_live[i])) { continue; }
+    key->prog[i] = state->dsp_prog[i];
+    key->live[i] = 1;
+  }
+  key->cutoff = state->dsp_cutoff;
+  key->rbl = state->rbl;
+  key->rbp = state->rbp;
+  key->ram_mask = state->ram_mask;
+  key->word_xor = state->mem_word_address_xor;
+}
+
+//
+// Point the state at slot n (call with the lock held)
+//
+static void dynapool_use(struct YAM_STATE *state, uint32 n) {
+  state->dyna_slot = n;
+  state->dyna_serial = dynapool_slot[n].serial;
+  state->dsp_dyna_valid = 1;
+}
+
+//
+// Find compiled code for the state's program, or claim a slot to compile
+// it into.  Returns the slot writable and busy if it needs compiling, NULL
+// otherwise; dsp_dyna_valid says whether the state has code.
+//
+static uint8 *dynapool_claim(struct YAM_STATE *state) {
+  struct DYNAPOOL_KEY key;
+  uint32 hash, i, n;
+  uint8 *code;
+  state->dsp_dyna_valid = 0;
+  dynapool_make_key(state, &key);
+  hash = dynapool_hash(&key);
+  dynapool_enter();
+  if(!dynapool_base && !dynapool_failed) {
+    dynapool_base = dynapool_map();
+    if(!dynapool_base) { dynapool_failed = 1; }
+  }
+  if(!dynapool_base || dynapool_failed) { dynapool_leave(); return NULL; }
+  //
+  // Already compiled?
+  //
+  for(n = 0; n < DYNAPOOL_SLOTS; n++) {
+    struct DYNAPOOL_SLOT *slot = dynapool_slot + n;
+    if(
+      slot->ready && slot->hash == hash &&
+      !memcmp(&(slot->key), &key, sizeof(struct DYNAPOOL_KEY))
+    ) {
+      dynapool_info[YAM_DSPCACHE_HITS]++;
+      dynapool_use(state, n);
+      dynapool_leave();
+      return NULL;
+    }
+  }
+  //
+  // Prefer an empty slot, else the least recently used idle one
+  //
+  for(n = 0; n < DYNAPOOL_SLOTS; n++) { if(!dynapool_slot[n].serial) break; }
+  if(n == DYNAPOOL_SLOTS) {
+    uint32 best = DYNAPOOL_SLOTS;
+    for(i = 0; i < DYNAPOOL_SLOTS; i++) {
+      if(dynapool_slot[i].busy) { continue; }
+      if(
+        best == DYNAPOOL_SLOTS ||
+        (dynapool_clock - dynapool_slot[i].last_used) >
+        (dynapool_clock - dynapool_slot[best].last_used)
+      ) { best = i; }
+    }
+    if(best == DYNAPOOL_SLOTS) { dynapool_leave(); return NULL; }
+    n = best;
+    dynapool_info[YAM_DSPCACHE_EVICTIONS]++;
+  }
+  dynapool_info[YAM_DSPCACHE_MISSES]++;
+  dynapool_serial++;
+  if(!dynapool_serial) { dynapool_serial++; }
+  dynapool_slot[n].serial = dynapool_serial;
+  dynapool_slot[n].busy = 1;
+  dynapool_slot[n].hash = hash;
+  dynapool_slot[n].last_used = dynapool_clock;
+  dynapool_slot[n].ready = 0;
+  dynapool_slot[n].key = key;
+  state->dyna_slot = n;
+  state->dyna_serial = dynapool_serial;
+  dynapool_leave();
+  code = dynapool_base + n * DYNAPOOL_SLOT_SIZE;
+  if(dynapool_protect(code, 0)) {
+    // leave the slot empty
+    dynapool_enter();
+    dynapool_slot[n].serial = 0;
+    dynapool_slot[n].busy = 0;
+    dynapool_leave();
+    return NULL;
+  }
+  return code;
+}
+
+//
+// Finish compiling into the claimed slot: make it executable and unbusy
+// If it can't be made executable, the slot is left empty, the state falls
+// back to the interpreter, and nothing more is compiled
+//
+static void dynapool_commit(struct YAM_STATE *state) {
+  uint32 n = state->dyna_slot;
+  if(dynapool_protect(dynapool_base + n * DYNAPOOL_SLOT_SIZE, 1)) {
+    dynapool_enter();
+    dynapool_failed = 1;
+    dynapool_slot[n].ready = 0;
+    dynapool_slot[n].busy--;
+    dynapool_slot[n].serial = 0;
+    dynapool_slot[n].hash = 0;
+    memset(&(dynapool_slot[n].key), 0, sizeof(struct DYNAPOOL_KEY));
+    dynapool_leave();
+    state->dyna_serial = 0;
+    state->dsp_dyna_valid = 0;
+    return;
+  }
+  dynapool_enter();
+  dynapool_slot[n].ready = 1;
+  dynapool_slot[n].busy--;
+  dynapool_use(state, n);
+  dynapool_leave();
+}
+
+//
+// Get the state's code for executing, or NULL if its slot was reused
+// Must be paired with dynapool_release
+//
+static uint8 *dynapool_acquire(struct YAM_STATE *state) {
+  uint8 *code = NULL;
+  uint32 n = state->dyna_slot;
+  if(!(state->dsp_dyna_valid)) { return NULL; }
+  dynapool_enter();
+  if(
+    (n < DYNAPOOL_SLOTS) && dynapool_slot[n].ready &&
+    (dynapool_slot[n].serial == state->dyna_serial)
+  ) {
+    dynapool_slot[n].busy++;
+    dynapool_slot[n].last_used = ++dynapool_clock;
+    code = dynapool_base + n * DYNAPOOL_SLOT_SIZE;
+  }
+  dynapool_leave();
+  if(!code) { state->dsp_dyna_valid = 0; }
+  return code;
+}
+
+static void dynapool_release(struct YAM_STATE *state) {
+  dynapool_enter();
+  dynapool_slot[state->dyna_slot].busy--;
+  dynapool_leave();
+}
+#endif
+
+#ifdef DYNAREC_X64
+//
+// Compile x86-64 code out of the current analyzed DSP program
+//
+// Same inputs as the 32-bit version below, but bit-exact with
+// dsp_sample_interpret: memory operations on every step, both MRD and MWT
+// on one step, unsaturated SHIFTED kept at 32 bits, and skip steps.
+//
+// SysV ABI.  Register use:
+//   rbx = state, ebp = mdec_ct, r12d = ACC, r13d = ADRS_REG,
+//   r14d = SHIFTED, r15 = RAM pointer, esi = memory address
+// The input write is deferred to the end of each step, which is safe
+// since nothing in between reads the MEMS slot it copies.
+//
+static void dynacompile(struct YAM_STATE *state) {
   // Pre-compute ringbuffer size mask
   uint32 rbmask = (1 << ((state->rbl)+13)) - 1;
+  uint8 *outp;
+  int i;
+
+  // Nothing to do if the cache has it
+  outp = dynapool_claim(state);
+  if(!outp) { return; }
+  state->dsp_info[YAM_DSPINFO_REBUILDS]++;
+
+  //
+  // Prefix
   //
-  // For 128 steps:
+  C(0x53)                                         // push rbx
+  C(0x55)                                         // push rbp
+  C(0x41) C(0x54)                                 // push r12
+  C(0x41) C(0x55)                                 // push r13
+  C(0x41) C(0x56)                                 // push r14
+  C(0x41) C(0x57)                                 // push r15
+  C(0x48) C(0x83) C(0xEC) C(0x08)                 // sub rsp,8 (align for calls)
+  C(0x48) C(0x89) C(0xFB)                         // mov rbx,rdi
+  C(0x8B) C(0xAB) C32(STATEOFS(mdec_ct))          // mov ebp,[rbx+<OFS32:mdec_ct>]
+  C(0x44) C(0x8B) C(0xA3) C32(STATEOFS(xzbchoice[XZBCHOICE_ACC])) // mov r12d,[rbx+<OFS32:acc>]
+  C(0x44) C(0x8B) C(0xAB) C32(STATEOFS(adrs_reg)) // mov r13d,[rbx+<OFS32:adrs_reg>]
+  C(0x4C) C(0x8B) C(0xBB) C32(STATEOFS(ram_ptr)) // mov r15,[rbx+<OFS32:ram_ptr>]
   //
-  for(i = 0; i < 128; i++, mpro++) {
-    sint32 b, x, y, shifted;
+  // Each live instruction
+  //
+  for(i = 0; i < (int)(state->dsp_cutoff); i++) {
+    struct MPRO *mpro = state->dsp_prog + i;
+    if(!(state->dsp_step_live[i])) { continue; }
     //
-    // Proper skip for "empty" instructions
+    // Skip step: ACC = TEMP[MDEC_CT] * FRC_REG + TEMP[MDEC_CT]
     //
     if((mpro->__kisxzbon) & 0x80) {
-      x = state->temp[(state->mdec_ct)&0x7F];
-      state->xzbchoice[XZBCHOICE_ACC] =
-        ((((sint64)x) * ((sint64)(state->yychoice[YYCHOICE_FRC_REG]))) >> 12) + x;
+      C(0x89) C(0xE9)                                                 // mov ecx,ebp
+      C(0x83) C(0xE1) C(0x7F)                                         // and ecx,7Fh
+      C(0x48) C(0x63) C(0x84) C(0x8B) C32(STATEOFS(temp))             // movsxd rax,[rbx+rcx*4+<OFS32:temp>]
+      C(0x48) C(0x63) C(0x93) C32(STATEOFS(yychoice[YYCHOICE_FRC_REG])) // movsxd rdx,[rbx+<OFS32:yychoice0>]
+      C(0x48) C(0x0F) C(0xAF) C(0xC2)                                 // imul rax,rdx
+      C(0x48) C(0xC1) C(0xF8) C(0x0C)                                 // sar rax,12
+      C(0x03) C(0x84) C(0x8B) C32(STATEOFS(temp))                     // add eax,[rbx+rcx*4+<OFS32:temp>]
+      C(0x41) C(0x89) C(0xC4)                                         // mov r12d,eax
       continue;
     }
-    state->xzbchoice[XZBCHOICE_TEMP] = state->temp[((mpro->t_0rrrrrrr)+(state->mdec_ct))&0x7F];
-    state->yychoice[YYCHOICE_COEF] = state->coef[mpro->c_0rrrrrrr];
     //
-    // Input read
+    // SHIFTED from the previous accumulator, if this step uses it
     //
-    state->xzbchoice[XZBCHOICE_INPUTS] = state->inputs[mpro->i_00rrrrrr];
+    if(instruction_uses_shifted(mpro)) {
+      C(0x45) C(0x89) C(0xE6)                     // mov r14d,r12d
+      if(mpro->m_wrAFyyYh & 1) {
+        C(0x41) C(0xD1) C(0xE6)                   // shl r14d,1
+      }
+      if(mpro->__kisxzbon & 0x20) { // saturate
+        C(0xB8) C32(0x007FFFFF)                   // mov eax,7FFFFFh
+        C(0x41) C(0x39) C(0xC6)                   // cmp r14d,eax
+        C(0x44) C(0x0F) C(0x4F) C(0xF0)           // cmovg r14d,eax
+        C(0xB8) C32(0xFF800000)                   // mov eax,-800000h
+        C(0x41) C(0x39) C(0xC6)                   // cmp r14d,eax
+        C(0x44) C(0x0F) C(0x4C) C(0xF0)           // cmovl r14d,eax
+      }
+    }
     //
-    // Input write
+    // If X or B is TEMP, compute its index in ECX
     //
-    state->inputs[mpro->i_0T0wwwww] = state->mem_in_data[i & 3];
+    if(
+      ((mpro->__kisxzbon & 0x10) == 0x00) ||
+      ((mpro->__kisxzbon & 0x0C) == 0x00)
+    ) {
+      C(0x8D) C(0x4D) C(mpro->t_0rrrrrrr) // lea ecx,[rbp+<BYTE:TRA>]
+      C(0x83) C(0xE1) C(0x7F)             // and ecx,7Fh
+    }
     //
-    // B selection
+    // Load RDX with the Y value
     //
-    b = SINT32ATOFFSET(state->xzbchoice, (mpro->__kisxzbon) & 0x0C);
-    b ^= ((sint32)(mpro->negb));
-    b -= ((sint32)(mpro->negb));
+    switch(mpro->m_wrAFyyYh & 0x0C) {
+    case 0x00: // FRC_REG
+      C(0x48) C(0x63) C(0x93) C32(STATEOFS(yychoice[YYCHOICE_FRC_REG])) // movsxd rdx,[rbx+<OFS32:yychoice0>]
+      break;
+    case 0x04: // COEF
+      C(0x48) C(0x63) C(0x93) C32(STATEOFS(coef[mpro->c_0rrrrrrr])) // movsxd rdx,[rbx+<OFS32:COEF>]
+      break;
+    case 0x08: // Y_REG_H
+      C(0x48) C(0x63) C(0x93) C32(STATEOFS(yychoice[YYCHOICE_Y_REG_H])) // movsxd rdx,[rbx+<OFS32:yychoice2>]
+      break;
+    case 0x0C: // Y_REG_L
+      C(0x48) C(0x63) C(0x93) C32(STATEOFS(yychoice[YYCHOICE_Y_REG_L])) // movsxd rdx,[rbx+<OFS32:yychoice3>]
+      break;
+    }
     //
-    // X selection
+    // Load RAX with the X value and multiply
     //
-    x = SINT32ATOFFSET(state->xzbchoice, (mpro->__kisxzbon) & 0x10);
+    if((mpro->__kisxzbon & 0x10) == 0) {
+      C(0x48) C(0x63) C(0x84) C(0x8B) C32(STATEOFS(temp))             // movsxd rax,[rbx+rcx*4+<OFS32:temp>]
+    } else {
+      C(0x48) C(0x63) C(0x83) C32(STATEOFS(inputs[mpro->i_00rrrrrr])) // movsxd rax,[rbx+<OFS32:INPUTS+4*IRA>]
+    }
+    C(0x48) C(0x0F) C(0xAF) C(0xC2) // imul rax,rdx
+    C(0x48) C(0xC1) C(0xF8) C(0x0C) // sar rax,12
     //
-    // Y selection
+    // Add B if necessary
     //
-    y = SINT32ATOFFSET(state->yychoice, (mpro->m_wrAFyyYh) & 0x0C);
+    if((mpro->__kisxzbon & 0x08) == 0) {
+      if(mpro->negb == 0) {
+        if((mpro->__kisxzbon & 0x04) == 0) {
+          C(0x03) C(0x84) C(0x8B) C32(STATEOFS(temp)) // add eax,[rbx+rcx*4+<OFS32:temp>]
+        } else {
+          C(0x44) C(0x01) C(0xE0)                     // add eax,r12d
+        }
+      } else {
+        if((mpro->__kisxzbon & 0x04) == 0) {
+          C(0x2B) C(0x84) C(0x8B) C32(STATEOFS(temp)) // sub eax,[rbx+rcx*4+<OFS32:temp>]
+        } else {
+          C(0x44) C(0x29) C(0xE0)                     // sub eax,r12d
+        }
+      }
+    }
+    C(0x41) C(0x89) C(0xC4) // mov r12d,eax
     //
-    // Y latch
+    // If YRL is on, latch Y register
     //
     if(mpro->m_wrAFyyYh & 2) {
-      sint32 inputs = state->xzbchoice[XZBCHOICE_INPUTS];
-      state->yychoice[YYCHOICE_Y_REG_H] = inputs >> 11;
-      state->yychoice[YYCHOICE_Y_REG_L] = (inputs >> 4) & 0xFFF;
+      C(0x8B) C(0x8B) C32(STATEOFS(inputs[mpro->i_00rrrrrr]))   // mov ecx,[rbx+<OFS32:INPUTS+4*IRA>]
+      C(0x89) C(0xCA)                                           // mov edx,ecx
+      C(0xC1) C(0xF9) C(0x0B)                                   // sar ecx,11
+      C(0x89) C(0x8B) C32(STATEOFS(yychoice[YYCHOICE_Y_REG_H])) // mov [rbx+<OFS32:yychoice2>],ecx
+      C(0xC1) C(0xFA) C(0x04)                                   // sar edx,4
+      C(0x81) C(0xE2) C32(0x00000FFF)                           // and edx,0FFFh
+      C(0x89) C(0x93) C32(STATEOFS(yychoice[YYCHOICE_Y_REG_L])) // mov [rbx+<OFS32:yychoice3>],edx
     }
     //
-    // Shift of previous accumulator
+    // If TWT is on, perform the temp write of SHIFTED
     //
-    shifted = state->xzbchoice[XZBCHOICE_ACC] << ((mpro->m_wrAFyyYh) & 1);
-    if((mpro->__kisxzbon) & 0x20) {
-      if(shifted > ( 0x7FFFFF)) { shifted = ( 0x7FFFFF); }
-      if(shifted < (-0x800000)) { shifted = (-0x800000); }
+    if((mpro->t_Twwwwwww & 0x80) == 0) {
+      C(0x8D) C(0x4D) C(mpro->t_Twwwwwww)                 // lea ecx,[rbp+<BYTE:TWA>]
+      C(0x83) C(0xE1) C(0x7F)                             // and ecx,7Fh
+      C(0x44) C(0x89) C(0xB4) C(0x8B) C32(STATEOFS(temp)) // mov [rbx+rcx*4+<OFS32:temp>],r14d
     }
     //
-    // Multiply and accumulate
+    // If FRCL is set, latch it
     //
-    state->xzbchoice[XZBCHOICE_ACC] = ((((sint64)x) * ((sint64)y)) >> 12) + b;
+    if(mpro->m_wrAFyyYh & 0x10) {
+      C(0x44) C(0x89) C(0xF0)   // mov eax,r14d
+      if(mpro->__kisxzbon & 0x40) { // interpolate mode
+        C(0x25) C32(0x00000FFF) // and eax,0FFFh
+      } else { // non-interpolate mode
+        C(0xC1) C(0xF8) C(0x0B) // sar eax,11
+      }
+      C(0x89) C(0x83) C32(STATEOFS(yychoice[YYCHOICE_FRC_REG])) // mov [rbx+<OFS32:yychoice0>],eax
+    }
     //
-    // Temp write
+    // Memory operations; the address is a byte offset into RAM in ESI
+    // It's computed after any conversion call, since ESI isn't preserved
     //
-    if(mpro->t_Twwwwwww < 0x80) {
-      state->temp[((mpro->t_Twwwwwww)+(state->mdec_ct))&0x7F] = shifted;
+    if(mpro->m_wrAFyyYh & 0xC0) {
+      int pass;
+      for(pass = 0; pass < 2; pass++) {
+        if(pass == 0 && !(mpro->m_wrAFyyYh & 0x40)) { continue; }
+        if(pass == 1 && !(mpro->m_wrAFyyYh & 0x80)) { continue; }
+        //
+        // MWT: convert SHIFTED to EAX first
+        //
+        if(pass == 1) {
+          if((mpro->__kisxzbon & 0x02) == 0) { // NOFL=0
+            C(0x44) C(0x89) C(0xF7)                   // mov edi,r14d
+            C(0x48) C(0xB8) C64((size_t)int24_to_float16) // mov rax,<QWORD:int24_to_float16>
+            C(0xFF) C(0xD0)                           // call rax
+          } else { // NOFL=1
+            C(0x44) C(0x89) C(0xF0)                   // mov eax,r14d
+            C(0xC1) C(0xF8) C(0x08)                   // sar eax,8
+          }
+        }
+        //
+        // Address
+        //
+        C(0x0F) C(0xB7) C(0xB3) C32(STATEOFS(madrs[mpro->m_00aaaaaa])) // movzx esi,word ptr [rbx+<OFS32:MADRS>]
+        if(mpro->__kisxzbon & 1) {
+          C(0xFF) C(0xC6)                            // inc esi (NXADR)
+        }
+        if(mpro->tablemask == 0) {
+          C(0x01) C(0xEE)                            // add esi,ebp
+          if(mpro->adrmask != 0) {
+            C(0x44) C(0x01) C(0xEE)                  // add esi,r13d
+          }
+          C(0x81) C(0xE6) C32(rbmask)                // and esi,<DWORD:rblmask>
+        } else {
+          if(mpro->adrmask != 0) {
+            C(0x44) C(0x01) C(0xEE)                  // add esi,r13d
+          }
+          C(0x81) C(0xE6) C32(0x0000FFFF)            // and esi,0FFFFh
+        }
+        C(0x01) C(0xF6)                              // add esi,esi
+        C(0x81) C(0xC6) C32(state->rbp)              // add esi,<DWORD:rbp>
+        C(0x81) C(0xE6) C32(state->ram_mask)         // and esi,<DWORD:RAMMASK>
+        if(state->mem_word_address_xor != 0) {
+          C(0x83) C(0xF6) C(state->mem_word_address_xor) // xor esi,<BYTE:memwxor>
+        }
+        if(pass == 0) {
+          //
+          // MRD: read into MEM_IN_DATA
+          //
+          if((mpro->__kisxzbon & 0x02) == 0) { // NOFL=0
+            C(0x41) C(0x0F) C(0xBF) C(0x3C) C(0x37)       // movsx edi,word ptr [r15+rsi]
+            C(0x48) C(0xB8) C64((size_t)float16_to_int24) // mov rax,<QWORD:float16_to_int24>
+            C(0xFF) C(0xD0)                               // call rax
+          } else { // NOFL=1
+            C(0x41) C(0x0F) C(0xBF) C(0x04) C(0x37)       // movsx eax,word ptr [r15+rsi]
+            C(0xC1) C(0xE0) C(0x08)                       // shl eax,8
+          }
+          C(0x89) C(0x83) C32(STATEOFS(mem_in_data[(i+2)&3])) // mov [rbx+<OFS32:meminptr>],eax
+        } else {
+          //
+          // MWT: write AX
+          //
+          C(0x66) C(0x41) C(0x89) C(0x04) C(0x37)   // mov [r15+rsi],ax
+        }
+      }
     }
     //
-    // Fractional address latch
+    // If ADRL is set, latch address reg
     //
-    if((mpro->m_wrAFyyYh) & 0x10) {
-      if((mpro->__kisxzbon) & 0x40) {
-        state->yychoice[YYCHOICE_FRC_REG] = shifted & 0xFFF;
+    if(mpro->m_wrAFyyYh & 0x20) {
+      if(mpro->__kisxzbon & 0x40) { // interpolate mode
+        C(0x45) C(0x89) C(0xF5)                                           // mov r13d,r14d
+        C(0x41) C(0xC1) C(0xFD) C(0x0C)                                   // sar r13d,12
       } else {
-        state->yychoice[YYCHOICE_FRC_REG] = shifted >> 11;
+        C(0x44) C(0x8B) C(0xAB) C32(STATEOFS(inputs[mpro->i_00rrrrrr]))   // mov r13d,[rbx+<OFS32:INPUTS+4*IRA>]
+        C(0x41) C(0xC1) C(0xFD) C(0x10)                                   // sar r13d,16
       }
+      C(0x41) C(0x81) C(0xE5) C32(0x00000FFF)                             // and r13d,0FFFh
     }
     //
-    // Memory operations
+    // If EWT is on, perform write of EFREG
     //
-    if((mpro->m_wrAFyyYh) & 0xC0) {
-      sint32 tm = ((sint32)(mpro->tablemask));
-      uint32 a = state->madrs[mpro->m_00aaaaaa];
-      a += (state->adrs_reg) & ((sint32)(mpro->adrmask));
-      a += (mpro->__kisxzbon) & 1;
-      a += (state->mdec_ct) & (~tm);
-      a &= (rbmask | tm) & 0xFFFF;
-      a <<= 1;
-      a += state->rbp;
-      a &= (state->ram_mask);
-      a ^= state->mem_word_address_xor;
-      if(mpro->m_wrAFyyYh & 0x40) { // MRD
-        sint32 memdata = *((sint16*)(((sint8*)(state->ram_ptr))+a));
-        if(!(mpro->__kisxzbon & 2)) { memdata = float16_to_int24(memdata); }
-        else { memdata <<= 8; }
-        state->mem_in_data[(i+2)&3] = memdata;
-      }
-      if(mpro->m_wrAFyyYh & 0x80) { // MWT
-        sint32 memdata = shifted;
-        if(!(mpro->__kisxzbon & 2)) { memdata = int24_to_float16(memdata); }
-        else { memdata >>= 8; }
-        *((sint16*)(((sint8*)(state->ram_ptr))+a)) = memdata;
-      }
+    if((mpro->e_000Twwww & 0x10) == 0) {
+      C(0x44) C(0x89) C(0xF0)                                       // mov eax,r14d
+      C(0xC1) C(0xF8) C(0x08)                                       // sar eax,8
+      C(0x66) C(0x89) C(0x83) C32(STATEOFS(efreg[mpro->e_000Twwww])) // mov [rbx+<OFS32:EFREG+2*EWA>],ax
     }
     //
-    // Address latch
+    // If IWT is on, perform input write
     //
-    if((mpro->m_wrAFyyYh) & 0x20) {
-      if((mpro->__kisxzbon) & 0x40) {
-        state->adrs_reg = shifted >> 12;
-      } else {
-        state->adrs_reg = state->xzbchoice[XZBCHOICE_INPUTS] >> 16;
-      }
-      state->adrs_reg &= 0xFFF;
+    if((mpro->i_0T0wwwww & 0x40) == 0) {
+      C(0x8B) C(0x83) C32(STATEOFS(mem_in_data[i&3]))         // mov eax,[rbx+<OFS32:memindata>]
+      C(0x89) C(0x83) C32(STATEOFS(inputs[mpro->i_0T0wwwww])) // mov [rbx+<OFS32:INPUTS+4*IWA>],eax
     }
-    //
-    // Effect output write
-    //
-    state->efreg[mpro->e_000Twwww] = shifted >> 8;
-    // End of step
   }
+  //
+  // Suffix
+  //
+  C(0x44) C(0x89) C(0xA3) C32(STATEOFS(xzbchoice[XZBCHOICE_ACC])) // mov [rbx+<OFS32:acc>],r12d
+  C(0x44) C(0x89) C(0xAB) C32(STATEOFS(adrs_reg)) // mov [rbx+<OFS32:adrs_reg>],r13d
+  C(0x48) C(0x83) C(0xC4) C(0x08)                 // add rsp,8
+  C(0x41) C(0x5F)                                 // pop r15
+  C(0x41) C(0x5E)                                 // pop r14
+  C(0x41) C(0x5D)                                 // pop r13
+  C(0x41) C(0x5C)                                 // pop r12
+  C(0x5D)                                         // pop rbp
+  C(0x5B)                                         // pop rbx
+  C(0xC3)                                         // ret
+  //
+  // Make it executable and set valid flag
+  //
+  dynapool_commit(state);
 }
+#endif
 
-/////////////////////////////////////////////////////////////////////////////
-//
-//
-//
-
-#define C(N) { *outp++ = ((uint8)(N)); }
-#define C32(N) { *((uint32*)outp) = ((uint32)(N)); outp += 4; }
-#define C32CALL(N) { *((uint32*)outp) = ((uint32)(N)) - (((uint32)(outp))+4); outp += 4; }
-
-#define STRUCTOFS(thetype,thefield) ((uint32)(&(((struct thetype*)0)->thefield)))
-#define STATEOFS(thefield) STRUCTOFS(YAM_STATE,thefield)
-
+uint32 EMU_CALL yam_get_dsp_cache_info(uint32 what) {
+  uint32 r = 0;
 #ifdef ENABLE_DYNAREC
-static int instruction_uses_shifted(struct MPRO *mpro) {
-  // uses SHIFTED if:
-  // - ADRL and INTERP
-  if((mpro->m_wrAFyyYh & 0x20) != 0) {
-    if((mpro->__kisxzbon & 0x40) != 0) return 1;
+  uint32 n;
+  if(what >= YAM_DSPCACHE_COUNT) { return 0; }
+  dynapool_enter();
+  if(what == YAM_DSPCACHE_ENTRIES) {
+    for(n = 0; n < DYNAPOOL_SLOTS; n++) { if(dynapool_slot[n].ready) r++; }
+  } else {
+    r = dynapool_info[what];
   }
-  // - FRCL
-  if((mpro->m_wrAFyyYh & 0x10) != 0) return 1;
-  // - EWT
-  if((mpro->e_000Twwww & 0x10) == 0) return 1;
-  // - TWT
-  if((mpro->t_Twwwwwww & 0x80) == 0) return 1;
-  // - MWT
-  if((mpro->m_wrAFyyYh & 0x80) != 0) return 1;
-  // otherwise not
-  return 0;
-}
+  dynapool_leave();
 #endif
+  return r;
+}
 
 //
-// Compile x86 code out of the current DSP program/coef/address set
-// Also uses the current ringbuffer pointer and size, and ram pointer/mask/memwordxor
+// Compile x86 code out of the current analyzed DSP program
+// Also uses the current ringbuffer pointer and size, and ram mask/memwordxor
 // So if any of those change, the compiled dynacode must be invalidated
+// COEF and MADRS are read from the state, so they can change freely
 //
-#ifdef ENABLE_DYNAREC
+#if defined(ENABLE_DYNAREC) && !defined(DYNAREC_X64)
 static void dynacompile(struct YAM_STATE *state) {
   // Pre-compute ringbuffer size mask
   uint32 rbmask = (1 << ((state->rbl)+13)) - 1;
 
-  uint8 *outp = state->dynacode;
+  uint8 *outp;
   int i;
   char ins_uses_acc[129];
   char ins_uses_shifted[129];
-  //
-  // Put some slop here to avoid cache problems?
-  //
-  outp += DYNACODE_SLOP_SIZE;
+
+  // Nothing to do if the cache has it
+  outp = dynapool_claim(state);
+  if(!outp) { return; }
+  state->dsp_info[YAM_DSPINFO_REBUILDS]++;
   //
   // Figure out which instructions need what things
   //
@@ -2577,8 +4558,15 @@ static void dynacompile(struct YAM_STATE *state) {
   memset(ins_uses_shifted, 0, sizeof(ins_uses_shifted));
   ins_uses_acc[128] = 1;
   ins_uses_shifted[128] = 1;
-  for(i = 0; i < 128; i++) {
-    struct MPRO *mpro = state->mpro + i;
+  for(i = 127; i >= 0; i--) {
+    struct MPRO *mpro = state->dsp_prog + i;
+    // a dead step passes on what the next live one needs
+    if(!(state->dsp_step_live[i])) {
+      ins_uses_acc[i] = ins_uses_acc[i + 1];
+      continue;
+    }
+    // a skip step sets ACC without reading it
+    if((mpro->__kisxzbon) & 0x80) { continue; }
     ins_uses_shifted[i] = instruction_uses_shifted(mpro);
     ins_uses_acc[i] =
       (ins_uses_shifted[i]) ||
@@ -2594,10 +4582,24 @@ static void dynacompile(struct YAM_STATE *state) {
   C(0x8B) C(0xB7) C32(STATEOFS(xzbchoice[XZBCHOICE_ACC])) // mov esi,[edi+<OFS32:acc>]
   // 16 bytes
   //
-  // Each instruction
+  // Each live instruction
   //
-  for(i = 0; i < 128; i++) {
-    struct MPRO *mpro = state->mpro + i;
+  for(i = 0; i < (int)(state->dsp_cutoff); i++) {
+    struct MPRO *mpro = state->dsp_prog + i;
+    if(!(state->dsp_step_live[i])) { continue; }
+    //
+    // Skip step: ACC = TEMP[MDEC_CT] * FRC_REG + TEMP[MDEC_CT]
+    //
+    if((mpro->__kisxzbon) & 0x80) {
+      C(0x89) C(0xE9)                                           // mov ecx,ebp
+      C(0x83) C(0xE1) C(0x7F)                                   // and ecx,7Fh
+      C(0x8B) C(0x84) C(0x8F) C32(STATEOFS(temp))               // mov eax,[edi+ecx*4+<OFS32:temp>]
+      C(0xF7) C(0xAF) C32(STATEOFS(yychoice[YYCHOICE_FRC_REG])) // imul dword ptr [edi+<OFS32:yychoice0>]
+      C(0x0F) C(0xAC) C(0xD0) C(0x0C)                           // shrd eax,edx,12
+      C(0x03) C(0x84) C(0x8F) C32(STATEOFS(temp))               // add eax,[edi+ecx*4+<OFS32:temp>]
+      C(0x89) C(0xC6)                                           // mov esi,eax
+      continue;
+    }
     //
     // If we need to compute the new accumulator, do so (to EAX)
     //
@@ -2621,9 +4623,7 @@ static void dynacompile(struct YAM_STATE *state) {
         C(0x8B) C(0x87) C32(STATEOFS(yychoice[YYCHOICE_FRC_REG])) // mov eax,[edi+yychoice0]
         break;
       case 0x04: // COEF
-        { sint32 coef = state->coef[mpro->c_0rrrrrrr];
-          C(0xB8) C32(coef)                                       // mov eax,<SINT32:COEF>
-        }
+        C(0x8B) C(0x87) C32(STATEOFS(coef[mpro->c_0rrrrrrr]))   // mov eax,[edi+<OFS32:COEF>]
         break;
       case 0x08: // Y_REG_H
         C(0x8B) C(0x87) C32(STATEOFS(yychoice[YYCHOICE_Y_REG_H])) // mov eax,[edi+yychoice2]
@@ -2683,9 +4683,10 @@ static void dynacompile(struct YAM_STATE *state) {
     if(ins_uses_shifted[i]) {
       if((mpro->__kisxzbon & 0x20) == 0) { // no saturate
         C(0x89) C(0xF2)                             // mov edx,esi
-        C(0xC1) C(0xE2) C(8+(mpro->m_wrAFyyYh & 1)) // shl edx,<BYTE:8+sh>
-        C(0xC1) C(0xFA) C(0x08)                     // sar edx,8
-        // 8 bytes max
+        if(mpro->m_wrAFyyYh & 1) {
+          C(0xD1) C(0xE2)                           // shl edx,1
+        }
+        // 4 bytes max
       } else { // saturate
         if((mpro->m_wrAFyyYh & 1) == 0) { // NOT shifting left
           C(0x8D) C(0x96) C32(0x00800000)         // lea edx,[esi+800000h]
@@ -2738,41 +4739,42 @@ static void dynacompile(struct YAM_STATE *state) {
     // If EWT is on, perform write of EFREG
     //
     if((mpro->e_000Twwww & 0x10) == 0) {
-      C(0x89) C(0xD0)                                        // mov eax,edx
-      C(0xC1) C(0xF8) C(0x08)                                // sar eax,8
-      C(0x89) C(0x87) C32(STATEOFS(efreg[mpro->e_000Twwww])) // mov [edi+<OFS32:EFREG+4*EWA>],eax
+      C(0x89) C(0xD0)                                               // mov eax,edx
+      C(0xC1) C(0xF8) C(0x08)                                       // sar eax,8
+      C(0x66) C(0x89) C(0x87) C32(STATEOFS(efreg[mpro->e_000Twwww])) // mov [edi+<OFS32:EFREG+2*EWA>],ax
     }
-    // 11 bytes max
+    // 12 bytes max
     //
     // If we'll be needing an address, compute it in EBX (a word address)
-    // ODD LINES ONLY
     //
-    if((i & 1) && (mpro->m_wrAFyyYh & 0xC0)) {
-      uint32 madrsnx = state->madrs[mpro->m_00aaaaaa];
-      if(mpro->__kisxzbon & 1) { madrsnx++; }
-      madrsnx &= 0xFFFF;
+    if(mpro->m_wrAFyyYh & 0xC0) {
+      C(0x0F) C(0xB7) C(0x9F) C32(STATEOFS(madrs[mpro->m_00aaaaaa])) // movzx ebx,word ptr [edi+<OFS32:MADRS>]
+      if(mpro->__kisxzbon & 1) {
+        C(0x43)                                            // inc ebx (NXADR)
+      }
       if(mpro->tablemask == 0) {
-        C(0x8D) C(0x9D) C32(madrsnx)                       // lea ebx,[ebp+<DWORD:MADRS+NXADR>]
+        C(0x01) C(0xEB)                                    // add ebx,ebp
         if(mpro->adrmask != 0) {
           C(0x03) C(0x9F) C32(STATEOFS(adrs_reg))          // add ebx,[edi+<OFS32:adrs_reg>]
         }
         C(0x81) C(0xE3) C32(rbmask)                        // and ebx,<DWORD:rblmask>
-        // 18 bytes max
+        // 22 bytes max
       } else {
-        C(0xBB) C32(madrsnx)                               // mov ebx,<DWORD:MADRS+NXADR masked by 0xFFFF>
         if(mpro->adrmask != 0) {
           C(0x03) C(0x9F) C32(STATEOFS(adrs_reg))          // add ebx,[edi+<OFS32:adrs_reg>]
-          C(0x81) C(0xE3) C32(0x0000FFFF)                  // and ebx,0FFFFh
         }
-        // 17 bytes max
+        C(0x81) C(0xE3) C32(0x0000FFFF)                    // and ebx,0FFFFh
+        // 20 bytes max
       }
       C(0x81) C(0xC3) C32(state->rbp / 2)                  // add ebx,<DWORD:rbp/2>
       C(0x81) C(0xE3) C32(state->ram_mask / 2)             // and ebx,<DWORD:RAMMASK/2>
       if((state->mem_word_address_xor / 2) != 0) {
         C(0x83) C(0xF3) C(state->mem_word_address_xor / 2) // xor ebx,<BYTE:memwxor/2>
       }
+      C(0x01) C(0xDB)                                      // add ebx,ebx
+      C(0x03) C(0x9F) C32(STATEOFS(ram_ptr))               // add ebx,[edi+<OFS32:ram_ptr>]
     }
-    // 33 bytes max ODD LINES ONLY
+    // 45 bytes max
     //
     // If ADRL is set, latch address reg
     //
@@ -2789,48 +4791,54 @@ static void dynacompile(struct YAM_STATE *state) {
     }
     // 20 bytes max
     //
-    // If MRD is set, read from ebx*2:
-    // ODD LINES ONLY
+    // If MRD is set, read from ebx
+    // The conversion call doesn't keep EDX, so SHIFTED is saved around it
+    // for an MWT on the same step
     //
-    if((i & 1) && (mpro->m_wrAFyyYh & 0x40)) {
+    if(mpro->m_wrAFyyYh & 0x40) {
+      if(mpro->m_wrAFyyYh & 0x80) {
+        C(0x52)                                             // push edx
+      }
       if((mpro->__kisxzbon & 0x02) == 0) { // NOFL=0
-        C(0x0F) C(0xBF) C(0x8C) C(0x1B) C32(state->ram_ptr) // movsx ecx, word ptr [ebx+ebx+<DWORD:RAMPTR>]
+        C(0x0F) C(0xBF) C(0x0B)                             // movsx ecx, word ptr [ebx]
         C(0xE8) C32CALL(float16_to_int24)                   // call float16_to_int24
-        // 13 bytes max
+        // 8 bytes max
       } else { // NOFL=1:
-        C(0x0F) C(0xBF) C(0x84) C(0x1B) C32(state->ram_ptr) // movsx eax, word ptr [ebx+ebx+<DWORD:RAMPTR>]
+        C(0x0F) C(0xBF) C(0x03)                             // movsx eax, word ptr [ebx]
         C(0xC1) C(0xE0) C(0x08)                             // shl eax,8
-        // 11 bytes max
+        // 6 bytes max
       }
       C(0x89) C(0x87) C32(STATEOFS(mem_in_data[(i+2)&3]))   // mov [edi+<OFS32:meminptr>],eax
-      // 19 bytes max
+      if(mpro->m_wrAFyyYh & 0x80) {
+        C(0x5A)                                             // pop edx
+      }
+      // 16 bytes max
+    }
     //
-    // Or, if MWT is set, write edx to ebx*2:
-    // ODD LINES ONLY
+    // If MWT is set, write edx to ebx
     //
-    } else if((i & 1) && (mpro->m_wrAFyyYh & 0x80)) {
+    if(mpro->m_wrAFyyYh & 0x80) {
       if((mpro->__kisxzbon & 0x02) == 0) { // NOFL=0
         C(0x89) C(0xD1)                                     // mov ecx,edx
         C(0xE8) C32CALL(int24_to_float16)                   // call int24_to_float16
-        C(0x66) C(0x89) C(0x84) C(0x1B) C32(state->ram_ptr) // mov [ebx+ebx+<DWORD:RAMPTR>],ax
-        // 15 bytes max
+        C(0x66) C(0x89) C(0x03)                             // mov [ebx],ax
+        // 10 bytes max
       } else { // NOFL=1:
         C(0xC1) C(0xFA) C(0x08)                             // sar edx,8
-        C(0x66) C(0x89) C(0x94) C(0x1B) C32(state->ram_ptr) // mov [ebx+ebx+<DWORD:RAMPTR>],dx
-        // 11 bytes max
+        C(0x66) C(0x89) C(0x13)                             // mov [ebx],dx
+        // 6 bytes max
       }
-      // 15 bytes max
+      // 10 bytes max
     }
-    // 19 bytes max ODD LINES ONLY
+    // 26 bytes max
     //
     // If IWT is on, perform input write
-    // ODD LINES ONLY
     //
-    if((i&1) && ((mpro->i_0T0wwwww & 0x40) == 0)) {
+    if((mpro->i_0T0wwwww & 0x40) == 0) {
       C(0x8B) C(0x97) C32(STATEOFS(mem_in_data[i&3]))         // mov edx, [edi+<OFS32:memindata>]
       C(0x89) C(0x97) C32(STATEOFS(inputs[mpro->i_0T0wwwww])) // mov [edi+<OFS32:INPUTS+4*IWA>],edx
     }
-    // 12 bytes max ODD LINES ONLY
+    // 12 bytes max
   }
   //
   // Suffix
@@ -2840,12 +4848,9 @@ static void dynacompile(struct YAM_STATE *state) {
   C(0xC3)                                                 // retn
   // 8 bytes
   //
-  // Set valid flag
+  // Make it executable and set valid flag
   //
-  state->dsp_dyna_valid = 1;
-
-//{FILE*f=fopen("C:\\Corlett\\yamdyna.bin","wb");if(f){fwrite(state->dynacode,1,0x6000,f);fclose(f);}}
-
+  dynapool_commit(state);
 }
 #endif
 
@@ -2853,6 +4858,194 @@ static void dynacompile(struct YAM_STATE *state) {
 
 typedef void (__fastcall *dsp_sample_t)(struct YAM_STATE *state);
 
+/////////////////////////////////////////////////////////////////////////////
+//
+// Idle DSP detection
+//
+// Once the effects have died away, every value the program touches is zero
+// and it keeps writing zeros over zeros.  Running it over a block then
+// changes nothing but MDEC_CT, so it can be skipped as long as:
+// - the FX bus inputs are zero for the whole block
+// - every register a live step reads or writes, and every EFREG that's
+//   mixed, is zero
+// - every RAM word a memory step would access over the block already holds
+//   what it would write, or reads as zero
+// RAM is checked each time since the CPU may have written to it.  Only the
+// words the program actually reaches are looked at.
+//
+static int dsp_block_idle(struct YAM_STATE *state, uint32 samples) {
+  uint32 rbmask = (1 << ((state->rbl)+13)) - 1;
+  const uint8 *ram = (const uint8*)(state->ram_ptr);
+  uint64 res = 0;
+  sint32 any = 0;
+  int temp_used = 0;
+  uint32 i, k;
+
+  for(i = 0; i < state->dsp_cutoff; i++) {
+    struct MPRO *mpro = state->dsp_prog + i;
+    uint8 kis = mpro->__kisxzbon;
+    uint8 wraf = mpro->m_wrAFyyYh;
+    if(!(state->dsp_step_live[i])) { continue; }
+    res |= dsp_step_reads(mpro, i) | dsp_step_writes(mpro, i);
+    if(
+      (kis & 0x80) || !(kis & 0x10) || !(kis & 0x0C) ||
+      (mpro->t_Twwwwwww < 0x80)
+    ) { temp_used = 1; }
+    // EXTS
+    if(
+      !(kis & 0x80) && ((mpro->i_00rrrrrr & 0x3E) == 0x30) &&
+      ((kis & 0x10) || (wraf & 0x02) || ((wraf & 0x20) && !(kis & 0x40)))
+    ) { any |= state->inputs[mpro->i_00rrrrrr]; }
+  }
+  if(temp_used) {
+    for(i = 0; i < 128; i++) { any |= state->temp[i]; }
+  }
+  for(i = 0; i < 0x20; i++) {
+    if(res & DSPRES_MEMS(i)) { any |= state->inputs[i]; }
+  }
+  for(i = 0; i < 4; i++) {
+    if(res & DSPRES_MEMDATA(i)) { any |= state->mem_in_data[i]; }
+  }
+  for(i = 0; i < 16; i++) {
+    if((res & DSPRES_EFREG(i)) || state->efsdl[i]) { any |= state->efreg[i]; }
+  }
+  if(res & DSPRES_ACC) { any |= state->xzbchoice[XZBCHOICE_ACC]; }
+  if(res & DSPRES_FRC) { any |= state->yychoice[YYCHOICE_FRC_REG]; }
+  if(res & DSPRES_YREG) {
+    any |= state->yychoice[YYCHOICE_Y_REG_H] | state->yychoice[YYCHOICE_Y_REG_L];
+  }
+  if(res & DSPRES_ADRS) { any |= state->adrs_reg; }
+  if(any) { return 0; }
+  //
+  // With ADRS_REG zero, each memory step walks down the ring one word per
+  // sample, or stays on one word in table mode
+  //
+  for(i = 0; i < state->dsp_cutoff; i++) {
+    struct MPRO *mpro = state->dsp_prog + i;
+    uint32 tm = (uint32)((sint32)(mpro->tablemask));
+    uint32 amask = (rbmask | tm) & 0xFFFF;
+    uint32 base, n, wmask, want;
+    if(!(state->dsp_step_live[i])) { continue; }
+    if((mpro->__kisxzbon & 0x80) || !(mpro->m_wrAFyyYh & 0xC0)) { continue; }
+    if(mpro->m_wrAFyyYh & 0x80) {
+      // MWT: already holds the zero it would write
+      wmask = 0xFFFF;
+      want = (mpro->__kisxzbon & 2) ? 0 : int24_to_float16(0);
+    } else if(mpro->__kisxzbon & 2) {
+      wmask = 0xFFFF;
+      want = 0;
+    } else {
+      // MRD: a float zero has a denormal exponent and no mantissa
+      wmask = 0xE7FF;
+      want = 0x6000;
+    }
+    base = state->madrs[mpro->m_00aaaaaa] + (mpro->__kisxzbon & 1);
+    n = tm ? 1 : samples;
+    for(k = 0; k < n;) {
+      uint32 idx = (base + ((state->mdec_ct - k) & ~tm)) & amask;
+      uint32 a = ((idx << 1) + state->rbp) & state->ram_mask;
+      // run down to the bottom of the ring or of RAM, whichever is first
+      uint32 run = n - k;
+      if(run > idx + 1) { run = idx + 1; }
+      if(run > (a >> 1) + 1) { run = (a >> 1) + 1; }
+      k += run;
+      for(; run; run--, a -= 2) {
+        uint32 w = *((const uint16*)(ram + (a ^ state->mem_word_address_xor)));
+        if((w & wmask) != want) { return 0; }
+      }
+    }
+  }
+  return 1;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Effects staging
+//
+// The DSP runs one sample at a time, so everything around it is done per
+// block: the FX bus is clipped and promoted up front, and EFREG values are
+// only collected per sample, then scaled and mixed afterwards one slot at a
+// time.  Within a slot the shift is the same for every sample, so the SIMD
+// versions give the same result as the scalar ones.
+//
+
+//
+// Clip FX bus inputs to 20 bits and promote to 24, in place
+// Returns nonzero if any of them are nonzero
+//
+static sint32 effects_stage_inputs(
+  struct YAM_STATE *state,
+  sint32 *fxbus,
+  uint32 n
+) {
+  uint32 i = 0;
+  sint32 any = 0;
+#ifdef ENABLE_SIMD
+  if(state->simd_enabled && yam_simd_level) {
+    const __m128i lo = _mm_set1_epi32(-0x80000);
+    const __m128i hi = _mm_set1_epi32( 0x7FFFF);
+    __m128i vany = _mm_setzero_si128();
+    for(; (i + 4) <= n; i += 4) {
+      __m128i t = _mm_loadu_si128((const __m128i*)(fxbus + i));
+      __m128i m = _mm_cmpgt_epi32(t, hi);
+      vany = _mm_or_si128(vany, t);
+      t = _mm_or_si128(_mm_and_si128(m, hi), _mm_andnot_si128(m, t));
+      m = _mm_cmplt_epi32(t, lo);
+      t = _mm_or_si128(_mm_and_si128(m, lo), _mm_andnot_si128(m, t));
+      _mm_storeu_si128((__m128i*)(fxbus + i), _mm_slli_epi32(t, 4));
+    }
+    any = _mm_movemask_epi8(_mm_cmpeq_epi32(vany, _mm_setzero_si128())) ^ 0xFFFF;
+  }
+#endif
+  for(; i < n; i++) {
+    sint32 t = fxbus[i];
+    any |= t;
+    if(t < (-0x80000)) t = (-0x80000);
+    if(t > ( 0x7FFFF)) t = ( 0x7FFFF);
+    fxbus[i] = t << 4;
+  }
+  return any;
+}
+
+//
+// Scale the collected EFREG values of each mixed slot and add to output
+//
+static void effects_mix_outputs(
+  struct YAM_STATE *state,
+  const sint32 *efout,
+  uint32 nslots,
+  const uint8 *efatt_l, const uint8 *efatt_r,
+  const sint32 *eflin_l, const sint32 *eflin_r,
+  sint32 *out,
+  uint32 samples
+) {
+  uint32 k, i;
+  for(k = 0; k < nslots; k++, efout += state->render_max) {
+    i = 0;
+#ifdef ENABLE_SIMD
+    if(state->simd_enabled && yam_simd_level) {
+      const __m128i ll = _mm_set1_epi32(eflin_l[k]);
+      const __m128i lr = _mm_set1_epi32(eflin_r[k]);
+      const __m128i al = _mm_cvtsi32_si128(efatt_l[k]);
+      const __m128i ar = _mm_cvtsi32_si128(efatt_r[k]);
+      for(; (i + 4) <= samples; i += 4) {
+        __m128i ef = _mm_slli_epi32(_mm_loadu_si128((const __m128i*)(efout + i)), 4);
+        __m128i l = _mm_sra_epi32(mullo_epi32_sse2(ef, ll), al);
+        __m128i r = _mm_sra_epi32(mullo_epi32_sse2(ef, lr), ar);
+        __m128i *o = (__m128i*)(out + 2 * i);
+        _mm_storeu_si128(o + 0, _mm_add_epi32(_mm_loadu_si128(o + 0), _mm_unpacklo_epi32(l, r)));
+        _mm_storeu_si128(o + 1, _mm_add_epi32(_mm_loadu_si128(o + 1), _mm_unpackhi_epi32(l, r)));
+      }
+    }
+#endif
+    for(; i < samples; i++) {
+      sint32 ef = efout[i] << 4;
+      out[2 * i + 0] += (ef*eflin_l[k]) >> efatt_l[k];
+      out[2 * i + 1] += (ef*eflin_r[k]) >> efatt_r[k];
+    }
+  }
+}
+
 /////////////////////////////////////////////////////////////////////////////
 //
 // Render effects by emulating the DSP
@@ -2864,49 +5057,80 @@ static void render_effects(
   uint32 samples
 ) {
   dsp_sample_t samplefunc;
-  uint32 i, j;
+  uint32 i, j, k;
   uint8 efatt_l[16];
   uint8 efatt_r[16];
   sint32 eflin_l[16];
   sint32 eflin_r[16];
+  uint8 efslot[16];
+  uint32 nslots;
+  sint32 *efout = EFOUT(state);
+
+#ifdef ENABLE_DYNAREC
+  uint8 *dynacode = NULL;
+#endif
+
+  if(!(state->dsp_analysis_valid)) {
+    dsp_analyze(state);
+  }
+
+  //
+  // Clip and promote the whole fxbus block (20-bit, pre-promote to 24-bit)
+  //
+  if(
+    !effects_stage_inputs(state, fxbus, 16 * samples) &&
+    state->dsp_idle_skip_enabled && dsp_block_idle(state, samples)
+  ) {
+    // Idle: all a sample would have done is clear MIXS and advance MDEC_CT
+    memset(state->inputs + 0x20, 0, 16 * sizeof(sint32));
+    state->mdec_ct -= samples;
+    state->dsp_info[YAM_DSPINFO_IDLE] += samples;
+    return;
+  }
 
 #ifdef ENABLE_DYNAREC
   if(state->dsp_dyna_enabled) {
     if(!(state->dsp_dyna_valid)) {
       dynacompile(state);
     }
-    samplefunc = (dsp_sample_t)(((uint8*)(state->dynacode)) + DYNACODE_SLOP_SIZE);
+    // Look the code up again if our slot was reused
+    dynacode = dynapool_acquire(state);
+    if(!dynacode) {
+      dynacompile(state);
+      dynacode = dynapool_acquire(state);
+    }
+  }
+  if(dynacode) {
+    samplefunc = (dsp_sample_t)dynacode;
   } else {
 #else
   {
 #endif
+    if(!(state->dsp_uop_valid) || state->dsp_uop_owner != state) {
+      dsp_decode(state);
+    }
     samplefunc = dsp_sample_interpret;
   }
 
   //
-  // Determine what the effect out levels are, for left and right
+  // Determine what the effect out levels are, for left and right, and
+  // leave muted slots out
   //
+  nslots = 0;
   for(j = 0; j < 16; j++) {
     convert_stereo_send_level(
       state->efsdl[j],
       (state->mono) ? 0 : state->efpan[j],
-      efatt_l + j, efatt_r + j,
-      eflin_l + j, eflin_r + j
+      efatt_l + nslots, efatt_r + nslots,
+      eflin_l + nslots, eflin_r + nslots
     );
+    if(eflin_l[nslots] | eflin_r[nslots]) { efslot[nslots++] = j; }
   }
   //
   // For every sample:
   //
-  for(i = 0; i < samples; i++, fxbus += 16, out += 2) {
-    //
-    // Clip and copy fxbus inputs (20-bit, pre-promote to 24-bit)
-    //
-    for(j = 0; j < 16; j++) {
-      sint32 t = fxbus[j];
-      if(t < (-0x80000)) t = (-0x80000);
-      if(t > ( 0x7FFFF)) t = ( 0x7FFFF);
-      state->inputs[0x20 + j] = t << 4;
-    }
+  for(i = 0; i < samples; i++, fxbus += 16) {
+    memcpy(state->inputs + 0x20, fxbus, 16 * sizeof(sint32));
     //
     // Execute one DSP sample
     //
@@ -2914,46 +5138,116 @@ static void render_effects(
     // Advance MDEC_CT
     state->mdec_ct--;
     //
-    // Copy outputs out of EFREG, scale accordingly, and add to output
+    // Collect the EFREG outputs we mix
     //
-    for(j = 0; j < 16; j++) if(state->efsdl[j]) {
-      sint32 ef = (sint32)((sint16)(state->efreg[j]));
-      ef <<= 4;
-      out[0] += (ef*eflin_l[j]) >> efatt_l[j];
-      out[1] += (ef*eflin_r[j]) >> efatt_r[j];
+    for(k = 0; k < nslots; k++) {
+      efout[k * state->render_max + i] = (sint32)((sint16)(state->efreg[efslot[k]]));
     }
   }
+  //
+  // Scale accordingly, and add to output
+  //
+  effects_mix_outputs(state, efout, nslots,
+    efatt_l, efatt_r, eflin_l, eflin_r, out, samples);
 
+#ifdef ENABLE_DYNAREC
+  if(dynacode) { dynapool_release(state); }
+#endif
 }
 
 /////////////////////////////////////////////////////////////////////////////
 //
-// Must not render more than RENDERMAX samples at a time
+// Compute the SCSP channel render order
 //
-struct render_priority
-{
-  sint32 channel_number;
-  sint32 priority_level;
-};
-int __cdecl render_priority_compare(const void * a, const void * b) {
-  struct render_priority *_a = (struct render_priority *) a;
-  struct render_priority *_b = (struct render_priority *) b;
-  return _b->priority_level - _a->priority_level;
+// A channel's ring modulation sources get a priority one higher than its
+// own, and channels are rendered in order of decreasing priority, ties in
+// channel order.  This only depends on MDXSL/MDYSL, so it's kept in the
+// state and redone when those are written.
+//
+static void compute_render_order(struct YAM_STATE *state) {
+  sint32 priority_level[32];
+  uint32 i, j;
+  uint8 uses_slots = 0;
+  state->ringmod_active = 0;
+  for(i = 0; i < 32; i++) {
+    struct YAM_CHAN *chan = state->chan + i;
+    state->render_order[i] = i;
+    priority_level[i] = 0;
+    if(chan->mdxsl || chan->mdysl) { uses_slots = 1; }
+    if(chan->mdl || chan->mdxsl || chan->mdysl) { state->ringmod_active = 1; }
+  }
+  state->render_order_valid = 1;
+  // Nobody reads another slot: channel order
+  if(!uses_slots) { return; }
+  for(i = 0; i < 32; i++) {
+    struct YAM_CHAN *chan = state->chan + i;
+    sint32 level = priority_level[i] + 1;
+    if(chan->mdxsl) { priority_level[(i+chan->mdxsl)&31] = level; }
+    if(chan->mdysl) { priority_level[(i+chan->mdysl)&31] = level; }
+  }
+  // Stable insertion sort by decreasing priority
+  for(i = 1; i < 32; i++) {
+    uint8 ch = state->render_order[i];
+    for(j = i; j > 0 && priority_level[state->render_order[j-1]] < priority_level[ch]; j--) {
+      state->render_order[j] = state->render_order[j-1];
+    }
+    state->render_order[j] = ch;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Open a render block: decide the outputs and clear the mix buffers
+//
+// Channels caught up by chan_sync mix into these early, so the choices
+// stay fixed until render() closes the block
+//
+static void open_block(struct YAM_STATE *state, uint32 samples) {
+  uint32 i;
+  state->block_dry = (state->out_buf && state->dry_out_enabled);
+  // figure out if we want reverb or not
+  state->block_reverb = 0;
+  if(state->out_buf && state->dsp_emulation_enabled) {
+    for(i = 0; i < 16; i++) { if(state->efsdl[i] != 0) break; }
+    state->block_reverb = (i < 16);
+  }
+  if(state->out_buf) {
+    memset(OUTBUF(state), 0, 4*2*samples);
+    if(state->block_reverb) memset(FXBUS(state), 0, 4*16*samples);
+  }
+  state->block_open = 1;
 }
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Must not render more than render_max samples at a time
+// (yam_flush splits at the state's render_block)
+//
+// Channels with a nonzero voice_done already rendered that much of the block
+//
 static void render(struct YAM_STATE *state, uint32 odometer, uint32 samples) {
   uint32 i, j;
-  struct render_priority priority_list[64];
-  sint32 outbuf[2*RENDERMAX];
-  sint32 fxbus[16*RENDERMAX];
+  uint8 renderlist[64];
+  uint32 nrender = 0;
+  sint32 *outbuf = OUTBUF(state);
+  sint32 *fxbus = FXBUS(state);
   sint32 *directout;
 //  sint32 *fxout;
   sint16 *buf;
   uint32 nchannels;
   uint32 bufptr_base;
   int wantreverb = 0;
+#ifdef ENABLE_SIMD
+  struct YAM_CHAN *lanechans[LANES_MAX];
+  uint32 lanebufptrs[LANES_MAX];
+  uint32 nlanechans = 0;
+  uint32 lanes = 0;
+#endif
   if(!samples) return;
   buf = YAMSTATE->out_buf;
-  directout = (buf && (state->dry_out_enabled)) ? outbuf : NULL;
+  if(!(state->block_open)) { open_block(state, samples); }
+  directout = (state->block_dry) ? outbuf : NULL;
+  wantreverb = state->block_reverb;
   nchannels = ((YAMSTATE->version) == 1) ? 32 : 64;
 
 //  st=odometer;
@@ -2975,49 +5269,86 @@ fclose(f);
 
 //logstep(state,odometer);
 
-  // figure out if we want reverb or not
-  if(buf && (state->dsp_emulation_enabled)) {
-    for(i = 0; i < 16; i++) { if(state->efsdl[i] != 0) break; }
-    wantreverb = (i < 16);
-  } else {
-    wantreverb = 0;
-  }
-  if(buf) {
-    memset(outbuf, 0, 4*2*samples);
-    if(wantreverb) memset(fxbus, 0, 4*16*samples);
-  }
   //
-  // Figure out if any channels need to be rendered before others
+  // Build the list of live channels, in render order
+  // SCSP channels which feed ring modulation must be rendered before others;
+  // AICA renders in channel order, so just walk the active bits
   //
-  for(i = 0; i < nchannels; i++) {
-    priority_list[i].channel_number = i;
-    priority_list[i].priority_level = 0;
-  }
   if (state->version == 1) {
+    if(!(state->render_order_valid)) { compute_render_order(state); }
     for(i = 0; i < nchannels; i++) {
-      struct YAM_CHAN *chan = state->chan + i;
-      sint32 priority_level = priority_list[i].priority_level + 1;
-      if (chan->mdxsl) priority_list[(i+chan->mdxsl)&31].priority_level = priority_level;
-      if (chan->mdysl) priority_list[(i+chan->mdysl)&31].priority_level = priority_level;
+      j = state->render_order[i];
+      if(state->active_voices[0] & (((uint32)1) << j)) { renderlist[nrender++] = j; }
+    }
+  } else {
+    for(i = 0; i < 2; i++) {
+      uint32 m = state->active_voices[i];
+      while(m) {
+        renderlist[nrender++] = 32 * i + yam_ctz32(m);
+        m &= m - 1;
+      }
     }
-    qsort(&priority_list, nchannels, sizeof(*priority_list), render_priority_compare);
   }
   bufptr_base = state->bufptr;
+#ifdef ENABLE_SIMD
+  //
+  // Decide whether to use the SIMD lane renderer
+  // Ring modulation reads other channels' output, so SCSP blocks that use
+  // it are rendered strictly in priority order
+  //
+  if(state->simd_enabled && yam_simd_level) {
+    lanes = (yam_simd_level >= 2) ? 8 : 4;
+    if(state->version == 1 && state->ringmod_active) { lanes = 0; }
+  }
+#endif
   //
   // Render each channel
   //
-  for(i = 0; i < nchannels; i++) {
+  for(i = 0; i < nrender; i++) {
     struct YAM_CHAN *chan;
-    j = priority_list[i].channel_number;
+    uint32 skip;
+    j = renderlist[i];
     chan = state->chan + j;
-    state->bufptr = bufptr_base + j;
+    skip = state->voice_done[j];
+#ifdef ENABLE_SIMD
+    if(lanes && !skip && chan_lane_eligible(state, chan, directout, wantreverb ? fxbus : NULL)) {
+      lanechans[nlanechans] = chan;
+      lanebufptrs[nlanechans] = bufptr_base + j;
+      nlanechans++;
+      if(nlanechans == lanes) {
+        render_and_add_lanes(state, lanechans, lanebufptrs, nlanechans, lanes,
+          directout, wantreverb ? fxbus : NULL, odometer, samples);
+        nlanechans = 0;
+      }
+      continue;
+    }
+#endif
+    state->bufptr = (bufptr_base + 32 * skip + j) & state->ring_mask;
 // is 11
-    render_and_add_channel(state, chan, directout,
-      wantreverb ? (fxbus + chan->dspchan) : NULL,
-      odometer, samples
+    render_and_add_channel(state, chan,
+      directout ? (directout + 2 * skip) : NULL,
+      wantreverb ? (fxbus + 16 * skip + chan->dspchan) : NULL,
+      odometer + skip, samples - skip
     );
   }
-  state->bufptr = (bufptr_base + (32*samples)) & (32*RINGMAX-1);
+#ifdef ENABLE_SIMD
+  if(nlanechans) {
+    render_and_add_lanes(state, lanechans, lanebufptrs, nlanechans, lanes,
+      directout, wantreverb ? fxbus : NULL, odometer, samples);
+  }
+#endif
+  state->bufptr = (bufptr_base + (32*samples)) & state->ring_mask;
+  state->block_open = 0;
+  memset(state->voice_done, 0, sizeof(state->voice_done));
+  //
+  // Retire channels whose envelope died during this block
+  //
+  for(i = 0; i < nrender; i++) {
+    j = renderlist[i];
+    if(state->chan[j].envlevel == 0x1FFF) {
+      state->active_voices[j >> 5] &= ~(((uint32)1) << (j & 31));
+    }
+  }
   //
   // Emulate DSP effects if desired
   //
@@ -3044,6 +5375,123 @@ fclose(f);
   }
 }
 
+/////////////////////////////////////////////////////////////////////////////
+//
+// Render the oldest n pending samples into the output buffer
+//
+static void render_pending(struct YAM_STATE *state, uint32 n) {
+  render(state, state->odometer - state->out_pending, n);
+  state->out_pending -= n;
+  if(state->out_buf) { state->out_buf += 2 * n; }
+}
+
+//
+// Same for any n up to out_pending, a render block at a time
+//
+static void render_oldest(struct YAM_STATE *state, uint32 n) {
+  while(n) {
+    uint32 k = n;
+    if(k > state->render_block) { k = state->render_block; }
+    render_pending(state, k);
+    n -= k;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Returns nonzero if live channels can be caught up one at a time
+//
+// SCSP ring modulation reads other channels' output, and the shared noise
+// generator is drawn in render order, so either one needs a full flush.
+// So does a channel playing from RAM the DSP may write, since it has to see
+// the DSP output of every sample before the one it's on.
+//
+static int voices_independent(struct YAM_STATE *state) {
+  uint32 i;
+  uint8 dsp_writes = (state->out_buf && state->dsp_emulation_enabled);
+  if(state->version == 1) {
+    if(!(state->render_order_valid)) { compute_render_order(state); }
+    if(state->ringmod_active) { return 0; }
+  }
+  for(i = 0; i < 2; i++) {
+    uint32 m = state->active_voices[i];
+    while(m) {
+      struct YAM_CHAN *chan = state->chan + 32 * i + yam_ctz32(m);
+      if(chan->ssctl == 1 || chan->alfows == 3 || chan->plfows == 3) { return 0; }
+      if(dsp_writes) {
+        // up to 16-bit samples, plus the one interpolated towards
+        uint32 start = chan->sampleaddr & state->ram_mask;
+        uint32 end = start + 2 * (((uint32)(chan->loopend)) + 2) - 1;
+        if(end > state->ram_mask || dsp_ram_overlap(state, start, end)) { return 0; }
+      }
+      m &= m - 1;
+    }
+  }
+  return 1;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Bring one channel up to the current sample before one of its registers
+// changes
+//
+// The channel is rendered into the open block; the other channels and the
+// DSP catch up when the block closes.  Falls back to yam_flush when the
+// channels can't be rendered independently.
+//
+static void chan_sync(struct YAM_STATE *state, struct YAM_CHAN *chan) {
+  state->sync_odometer = state->odometer;
+  chan_catch_up(state, chan, state->out_pending);
+}
+
+//
+// Bring one channel up to the oldest upto pending samples
+//
+// The channel must not already be past that point.  Renders those samples
+// for everything when the channels can't be rendered independently.
+//
+static void chan_catch_up(struct YAM_STATE *state, struct YAM_CHAN *chan, uint32 upto) {
+  uint32 cn = CHANNUM(state, chan);
+  uint32 done;
+  if(!upto) { return; }
+  if(!voices_independent(state)) { render_oldest(state, upto); return; }
+  // Close any whole blocks
+  while(upto >= state->render_block) {
+    render_pending(state, state->render_block);
+    upto -= state->render_block;
+  }
+  if(!upto) { return; }
+  if(!(state->block_open)) { open_block(state, state->render_block); }
+  done = state->voice_done[cn];
+  if(state->active_voices[cn >> 5] & (((uint32)1) << (cn & 31))) {
+    uint32 bufptr_base = state->bufptr;
+    state->bufptr = (bufptr_base + 32 * done + cn) & state->ring_mask;
+    render_and_add_channel(state, chan,
+      (state->block_dry) ? (OUTBUF(state) + 2 * done) : NULL,
+      (state->block_reverb) ? (FXBUS(state) + 16 * done + chan->dspchan) : NULL,
+      state->odometer - state->out_pending + done,
+      upto - done
+    );
+    state->bufptr = bufptr_base;
+  }
+  state->voice_done[cn] = upto;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Bring the channel selected for a status read up to the current sample
+//
+// Only that channel's envelope, loop and position state has to be current;
+// the rest of the mix waits for the block to close
+//
+static void status_sync(struct YAM_STATE *state, struct YAM_CHAN *chan) {
+  if(state->status_sync_enabled) {
+    chan_sync(state, chan);
+  } else if(state->out_pending > 0) {
+    yam_flush(state);
+  }
+}
+
 /////////////////////////////////////////////////////////////////////////////
 //
 // Flush all pending samples into the output buffer
@@ -3052,48 +5500,37 @@ void EMU_CALL yam_flush(void *state) {
 //  return;
 //printf("yam_flush(%up)",YAMSTATE->out_pending);
 
+  YAMSTATE->sync_odometer = YAMSTATE->odometer;
   for(;;) {
     uint32 n = YAMSTATE->out_pending;
     if(n < 1) { break; }
-    if(n > RENDERMAX) { n = RENDERMAX; }
-    render(YAMSTATE, YAMSTATE->odometer - YAMSTATE->out_pending, n);
-    YAMSTATE->out_pending -= n;
-    if(YAMSTATE->out_buf) { YAMSTATE->out_buf += 2 * n; }
+    if(n > YAMSTATE->render_block) { n = YAMSTATE->render_block; }
+    render_pending(YAMSTATE, n);
   }
 }
 
+//
+// Render everything up to the last yam_flush or chan_sync
+//
+// Settings stored without a flush (EFSDL, EFPAN, the dry and DSP enables)
+// take effect from there, as they did when every channel store flushed,
+// rather than from the start of a block chan_sync left open
+//
+static void flush_to_sync(struct YAM_STATE *state) {
+  render_oldest(state, state->out_pending - (state->odometer - state->sync_odometer));
+}
+
 /////////////////////////////////////////////////////////////////////////////
 //
 // Prepare or unprepare dynacode buffer for execution
 //
+// Nothing to do: compiled code lives in the library's executable pool, not
+// in the state.  Kept so existing callers still link.
+//
 void EMU_CALL yam_prepare_dynacode(void *state) {
-#ifdef ENABLE_DYNAREC
-#ifdef _WIN32
-  DWORD i;
-  VirtualProtect( &YAMSTATE->dynacode, sizeof(YAMSTATE->dynacode), PAGE_EXECUTE_READWRITE, &i );
-#elif defined(HAVE_MPROTECT)
-  unsigned long startaddr = &YAMSTATE->dynacode;
-  unsigned long length    = sizeof(YAMSTATE->dynacode);
-  int           psize     = getpagesize();
-  unsigned long addr      = ( startaddr & ~(psize - 1) );
-  mprotect( (char *) addr, length + startaddr - addr + psize, PROT_READ | PROT_WRITE | PROT_EXEC );
-#endif
-#endif
 }
 
 void EMU_CALL yam_unprepare_dynacode(void *state) {
-#ifdef ENABLE_DYNAREC
-#ifdef _WIN32
-  DWORD i;
-  VirtualProtect( &YAMSTATE->dynacode, sizeof(YAMSTATE->dynacode), PAGE_READWRITE, &i );
-#elif defined(HAVE_MPROTECT)
-  unsigned long startaddr = &YAMSTATE->dynacode;
-  unsigned long length    = sizeof(YAMSTATE->dynacode);
-  int           psize     = getpagesize();
-  unsigned long addr      = ( startaddr & ~(psize - 1) );
-  mprotect( (char *) addr, length + startaddr - addr + psize, PROT_READ | PROT_WRITE );
-#endif
-#endif
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -17,16 +17,95 @@ extern "C" {
 
 // version = 1 for SCSP, 2 for AICA
 // ramsize must be a power of 2
+// Allocate states 64-byte aligned so the render scratch buffers are too
 
 sint32 EMU_CALL yam_init(void);
 uint32 EMU_CALL yam_get_state_size(uint8 version);
 void   EMU_CALL yam_clear_state(void *state, uint8 version);
 
+// Same, choosing the largest render block (1-512) the state has room for,
+// and whether it has room for the decoded ADPCM cache (about 1MB, AICA only).
+// Without it, yam_enable_adpcm_cache does nothing.  The plain versions above
+// use max_block 200 and leave the cache out
+uint32 EMU_CALL yam_get_state_size_ex(uint8 version, uint32 max_block, uint8 adpcm_cache);
+void   EMU_CALL yam_clear_state_ex(void *state, uint8 version, uint32 max_block, uint8 adpcm_cache);
+
 void   EMU_CALL yam_enable_dry(void *state, uint8 enable);
 void   EMU_CALL yam_enable_dsp(void *state, uint8 enable);
 void   EMU_CALL yam_enable_dsp_dynarec(void *state, uint8 enable);
+void   EMU_CALL yam_enable_simd(void *state, uint8 enable);
+void   EMU_CALL yam_enable_adpcm_cache(void *state, uint8 enable);
+
+// When enabled (off by default), the DSP also skips values its program
+// overwrites in a later sample before reading them, and EFREG outputs that
+// aren't mixed.  Exact only while the program is unchanged: a new MPRO can
+// read a value the old one let go.  Reading TEMP/MEMS/EFREG back turns it
+// off
+void   EMU_CALL yam_enable_dsp_liveness(void *state, uint8 enable);
+
+// When enabled (default), blocks over which the DSP would only write zeros
+// over zeros (reverb tail fully decayed, no input) aren't run at all
+void   EMU_CALL yam_enable_dsp_idle_skip(void *state, uint8 enable);
+
+// DSP program analysis, redone when the program or EFSDL changes
+#define YAM_DSPINFO_STEPS  (0) // steps that aren't empty in MPRO
+#define YAM_DSPINFO_LIVE   (1) // steps that still run
+#define YAM_DSPINFO_CUTOFF (2) // steps up to and including the last one that runs
+#define YAM_DSPINFO_TEMP   (3) // TEMP slots still written
+#define YAM_DSPINFO_EFREG  (4) // bitmask of EFREG outputs still written
+// Counters since yam_clear_state
+#define YAM_DSPINFO_REBUILDS (5) // full recompiles/re-decodes of the program
+#define YAM_DSPINFO_PATCHES  (6) // COEF/MADRS changes taken without one
+#define YAM_DSPINFO_IDLE     (7) // samples the DSP was skipped for being idle
+#define YAM_DSPINFO_COUNT  (8)
+
+uint32 EMU_CALL yam_get_dsp_info(void *state, uint32 what);
+
+// Process-wide cache of compiled DSP programs (x86-64 dynarec), shared by
+// all states running the same program
+#define YAM_DSPCACHE_HITS      (0) // lookups that found compiled code
+#define YAM_DSPCACHE_MISSES    (1) // programs compiled
+#define YAM_DSPCACHE_EVICTIONS (2) // compiled programs dropped for room
+#define YAM_DSPCACHE_ENTRIES   (3) // compiled programs held now
+#define YAM_DSPCACHE_COUNT     (4)
+
+uint32 EMU_CALL yam_get_dsp_cache_info(uint32 what);
+
+// When enabled (default), PlayStatus/PlayPos/CallAddress reads only catch
+// up the channel selected by MSLC instead of flushing every channel
+void   EMU_CALL yam_enable_status_sync(void *state, uint8 enable);
+
+// Samples rendered per internal block, clamped to 1 through the state's
+// max_block (default 200)
+// Render order within a block still decides who draws from the noise
+// generator first, so noise and SCSP ring modulation can differ with it
+void   EMU_CALL yam_set_render_block(void *state, uint32 samples);
+
+// Number of channels whose envelope is currently live
+uint32 EMU_CALL yam_get_active_voice_count(void *state);
+
+// Voice shapes: which specialized renderer loop a channel used
+// yam_get_shape_hits returns the number of channel-blocks rendered with the
+// given shape since the last clear
+#define YAM_SHAPE_VOFF  (0x01)
+#define YAM_SHAPE_ALFO  (0x02)
+#define YAM_SHAPE_PLFO  (0x04)
+#define YAM_SHAPE_LPF   (0x08)
+#define YAM_SHAPE_RING  (0x10)
+#define YAM_SHAPE_COUNT (0x20)
+
+uint32 EMU_CALL yam_get_shape_hits(void *state, uint32 shape);
+void   EMU_CALL yam_clear_shape_hits(void *state);
 
 void   EMU_CALL yam_setram(void *state, uint32 *ram, uint32 size, uint8 mbx, uint8 mwx);
+
+// Sound RAM written behind yam's back (CPU stores, uploads)
+// yam_get_ram_watch returns nonzero and the inclusive byte range for which
+// yam_invalidate_ram must be called, or zero if no range needs watching
+void   EMU_CALL yam_invalidate_ram(void *state, uint32 address, uint32 len);
+uint8  EMU_CALL yam_get_ram_watch(void *state, uint32 *start, uint32 *end);
+
+// Samples still pending are flushed to the previous buffer first
 void   EMU_CALL yam_beginbuffer(void *state, sint16 *buf);
 void   EMU_CALL yam_advance(void *state, uint32 samples);
 void   EMU_CALL yam_flush(void *state);
@@ -40,6 +119,7 @@ void   EMU_CALL yam_scsp_store_reg(void *state, uint32 a, uint32 d, uint32 mask,
 uint8* EMU_CALL yam_get_interrupt_pending_ptr(void *state);
 uint32 EMU_CALL yam_get_min_samples_until_interrupt(void *state);
 
+// No longer needed; dynarec code lives in the library's own pool
 void   EMU_CALL yam_prepare_dynacode(void *state);
 void   EMU_CALL yam_unprepare_dynacode(void *state);
 